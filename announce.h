@@ -0,0 +1,274 @@
+#ifndef TXUNAMI_ANNOUNCE_H
+#define TXUNAMI_ANNOUNCE_H
+
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "latency.h"
+#include "p2p.h"
+
+/** Delivers transactions the way an ordinary peer does, instead of pushing unsolicited tx messages: their txids are
+    batched into inv messages, and the node asks for the ones it wants with getdata, which is answered from the
+    transactions held here.  So the node's request tracking and its own inv batching get exercised.
+
+    An inv goes out once it has invBatch txids in it, or once its first txid has waited invUs.  Transactions are held
+    for holdMs after they were announced, in case the node asks for them late (or asks again), then dropped.  The time
+    from an inv to the getdata for each txid in it is recorded.  Transactions are kept in the order they were
+    announced, so the oldest are always at the front and their buffers are reused by the newest.
+
+    Not thread safe: use an announcer from its connection's thread only.  Times are GetStopwatch() nanoseconds.
+*/
+class TxAnnouncer
+{
+public:
+    /** A node ignores an inv with more entries than this */
+    static const unsigned int MAX_INV = 50000;
+    /** How long a sender keeps answering getdata after its last transaction, so the node can ask for the last ones it
+        was told about */
+    static const unsigned int LINGER_MS = 5000;
+
+    class Profile
+    {
+    public:
+        bool enabled = false;
+        unsigned int invBatch = 1000;  // Most txids per inv
+        uint64_t invUs = 100000;  // Longest a txid waits to be announced
+        uint64_t holdMs = 30000;  // How long an announced transaction can still be asked for
+    };
+
+    class Stats
+    {
+    public:
+        uint64_t announced = 0;  // Transactions whose txids have gone out in an inv
+        uint64_t invs = 0;
+        uint64_t requested = 0;  // Transactions asked for with getdata
+        uint64_t served = 0;
+        uint64_t repeats = 0;  // Requests for a transaction that had already been served
+        uint64_t notFound = 0;  // Requests for transactions we don't have (any more)
+        uint64_t unrequested = 0;  // Transactions dropped without ever being asked for
+        uint64_t unsent = 0;  // Requested transactions that didn't fit in the outbound queue
+        LatencyHistogram rtt;  // inv to getdata (microseconds)
+
+        Stats& operator+=(const Stats& o)
+        {
+            announced += o.announced;
+            invs += o.invs;
+            requested += o.requested;
+            served += o.served;
+            repeats += o.repeats;
+            notFound += o.notFound;
+            unrequested += o.unrequested;
+            unsent += o.unsent;
+            rtt += o.rtt;
+            return *this;
+        }
+
+        std::string ToString() const
+        {
+            char buf[400];
+            auto ms = [](uint64_t us) { return us / 1000.0; };
+            snprintf(buf, sizeof(buf), "announced %lu tx in %lu invs, %lu requested (%lu again), %lu served, %lu not found, %lu never requested, %lu didn't fit the queue, getdata rtt p50 %.1f p99 %.1f max %.1f ms",
+                     announced, invs, requested, repeats, served, notFound, unrequested, unsent,
+                     ms(rtt.Percentile(0.5)), ms(rtt.Percentile(0.99)), ms(rtt.Max()));
+            return buf;
+        }
+    };
+
+    /** Sends a message to the node.  Returns false if it couldn't be queued */
+    typedef std::function<bool(const char* msgname, const unsigned char* data, uint32_t size)> SendFn;
+
+    Stats stats;
+    SendFn send;
+
+protected:
+    class Held
+    {
+    public:
+        unsigned char txid[32];
+        std::vector<unsigned char> tx;
+        uint64_t announcedNs;  // 0 until its inv goes out
+        bool requested;
+    };
+
+    Profile prof;
+    std::deque<Held> held;  // In the order they were added
+    uint64_t firstSeq = 0;  // Of held.front()
+    std::unordered_map<uint64_t, uint64_t> index;  // First 8 bytes of the txid to its sequence number
+    std::vector<std::vector<unsigned char> > spare;  // Buffers of dropped transactions, to be reused
+    std::vector<unsigned char> inv;  // The inv being built
+    unsigned int invCount = 0;
+    uint64_t invStart = 0;  // When the first txid in inv was added
+    uint64_t unannounced = 0;  // Sequence number of the first transaction not yet in an inv that went out
+    uint64_t outstanding = 0;  // Announced, held, and not asked for yet
+    std::vector<unsigned char> missing;  // Entries for a notfound reply
+    std::vector<unsigned char> payload;  // Of the inv or notfound being sent
+
+    static uint64_t Key(const unsigned char* txid)
+    {
+        uint64_t k;
+        memcpy(&k, txid, 8);
+        return k;
+    }
+
+    /** Write a compact size prefixed inv vector of count 36 byte entries from items into out */
+    static void InvPayload(std::vector<unsigned char>& out, const unsigned char* items, unsigned int count)
+    {
+        out.clear();
+        if (count < 0xfd)
+            out.push_back(count);
+        else
+        {
+            out.push_back(0xfd);  // MAX_INV fits in 2 bytes
+            out.push_back(count & 0xff);
+            out.push_back(count >> 8);
+        }
+        out.insert(out.end(), items, items + count * 36);
+    }
+
+    /** Drop transactions announced more than holdMs before now */
+    void Expire(uint64_t now)
+    {
+        uint64_t hold = prof.holdMs * 1000000;
+        while (!held.empty() && (firstSeq < unannounced) && (held.front().announcedNs + hold < now))
+        {
+            Held& h = held.front();
+            if (!h.requested)
+            {
+                stats.unrequested++;
+                outstanding--;
+            }
+            auto it = index.find(Key(h.txid));
+            if ((it != index.end()) && (it->second == firstSeq)) index.erase(it);
+            spare.push_back(std::move(h.tx));
+            held.pop_front();
+            firstSeq++;
+        }
+    }
+
+public:
+    TxAnnouncer(const Profile& p) : prof(p)
+    {
+        if (prof.invBatch == 0) prof.invBatch = 1;
+        if (prof.invBatch > MAX_INV) prof.invBatch = MAX_INV;
+        inv.reserve(prof.invBatch * 36);
+    }
+
+    /** Can another transaction be added?  Not while a full inv is waiting because it couldn't be queued, so an inv
+        never grows past invBatch (and so MAX_INV) entries.  Tries to send the full inv first */
+    bool Ready(uint64_t now)
+    {
+        if (invCount >= prof.invBatch) Flush(now);
+        return invCount < prof.invBatch;
+    }
+
+    /** Hold a transaction (its tx message's payload) and queue its txid to be announced.  The inv goes out now if it
+        is full.  Returns false, doing nothing, if it isn't Ready: the caller should back off and try again */
+    bool Add(const unsigned char* txid, const void* tx, uint32_t size, uint64_t now)
+    {
+        if (!Ready(now)) return false;
+        Expire(now);
+        held.emplace_back();
+        Held& h = held.back();
+        memcpy(h.txid, txid, 32);
+        if (!spare.empty())
+        {
+            h.tx.swap(spare.back());
+            spare.pop_back();
+        }
+        h.tx.assign((const unsigned char*)tx, (const unsigned char*)tx + size);
+        h.announcedNs = 0;
+        h.requested = false;
+        index[Key(txid)] = firstSeq + held.size() - 1;
+
+        if (invCount == 0) invStart = now;
+        uint32_t type = 1;  // MSG_TX
+        size_t pos = inv.size();
+        inv.resize(pos + 36);
+        memcpy(&inv[pos], &type, 4);
+        memcpy(&inv[pos + 4], txid, 32);
+        if (++invCount >= prof.invBatch) Flush(now);
+        return true;
+    }
+
+    /** Is there an inv waiting that has been held for invUs? */
+    bool Due(uint64_t now) const { return invCount && (now >= invStart + prof.invUs * 1000); }
+
+    /** When the inv being built will be due, or never (the largest time) if it is empty */
+    uint64_t NextDue() const { return invCount ? invStart + prof.invUs * 1000 : std::numeric_limits<uint64_t>::max(); }
+
+    /** Send the inv being built, if it has anything in it.  If it can't be queued it is kept to try again */
+    void Flush(uint64_t now)
+    {
+        if (invCount == 0) return;
+        InvPayload(payload, inv.data(), invCount);
+        if (!send(INV_MSG, payload.data(), payload.size())) return;
+        for (uint64_t seq = unannounced; seq < firstSeq + held.size(); seq++) held[seq - firstSeq].announcedNs = now;
+        unannounced = firstSeq + held.size();
+        stats.announced += invCount;
+        outstanding += invCount;
+        stats.invs++;
+        inv.clear();
+        invCount = 0;
+    }
+
+    /** Answer a getdata of count 36 byte entries, as passed to P2PReader::onGetData, that arrived at now */
+    void GetData(const unsigned char* items, uint64_t count, uint64_t now)
+    {
+        missing.clear();
+        unsigned int nMissing = 0;
+        for (uint64_t i = 0; i < count; i++, items += 36)
+        {
+            uint32_t type;
+            memcpy(&type, items, 4);
+            if (type != 1) continue;  // Only transactions are ours to give
+            const unsigned char* txid = items + 4;
+            stats.requested++;
+            auto it = index.find(Key(txid));
+            Held* h = nullptr;
+            if ((it != index.end()) && (it->second < unannounced))
+            {
+                h = &held[it->second - firstSeq];
+                if (memcmp(h->txid, txid, 32) != 0) h = nullptr;  // Another txid that starts the same
+            }
+            if (!h)
+            {
+                stats.notFound++;
+                if (nMissing < MAX_INV)
+                {
+                    missing.insert(missing.end(), items, items + 36);
+                    nMissing++;
+                }
+                continue;
+            }
+            if (h->requested)
+                stats.repeats++;
+            else
+            {
+                h->requested = true;
+                outstanding--;
+                stats.rtt.Record((now > h->announcedNs) ? (now - h->announcedNs) / 1000 : 0);
+            }
+            if (send(TX_MSG, h->tx.data(), h->tx.size()))
+                stats.served++;
+            else
+                stats.unsent++;
+        }
+        if (nMissing)
+        {
+            InvPayload(payload, missing.data(), nMissing);
+            send(NOTFOUND_MSG, payload.data(), payload.size());
+        }
+    }
+
+    /** Are there transactions not yet announced, or announced but not yet asked for? */
+    bool Pending() const { return invCount || outstanding; }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef TXUNAMI_COINPOOL_H
+#define TXUNAMI_COINPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "ring.h"
+#include "utxopool.h"
+
+/** Hands out the coins of a UtxoPool to the threads that spend them, so that a fast target keeps spending coins that
+    have never been spent (and so are confirmed) for as long as any are left anywhere, instead of being held to an
+    equal share while slow targets sit on theirs.
+
+    The pool's slots are cut into chunks that wait in a shared lock-free ring.  Each spender has a Cache holding the
+    range of slots it is working through, and takes another chunk from the ring when it runs out.  When the ring is
+    empty it steals the back half of the biggest range some other spender holds.  A spender that is finished gives
+    back what is left of its range.  Once there are no fresh coins left anywhere, a spender goes back over the slots
+    it already spent, which now hold its own unconfirmed outputs, building chains like before.
+*/
+class CoinDispenser
+{
+public:
+    /** Slots per chunk in the shared ring */
+    static const uint32_t CHUNK = 1024;
+    /** Ranges smaller than this aren't worth stealing from */
+    static const uint32_t MIN_STEAL = 64;
+
+    class Range
+    {
+    public:
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    /** One spender's coins.  Only the owning thread may call its methods */
+    class Cache
+    {
+        friend class CoinDispenser;
+
+        CoinDispenser* owner = nullptr;
+        // The fresh slots we hold, as (begin << 32) | end.  Thieves take from the end, so it is only changed by CAS
+        std::atomic<uint64_t> held;
+        std::vector<Range> spent;  // Slots we have taken, in order, to be spent again as chains
+        uint64_t spentQty = 0;
+        size_t chainIdx = 0;
+        uint32_t chainPos = 0;
+
+        static uint64_t Pack(uint32_t begin, uint32_t end) { return ((uint64_t)begin << 32) | end; }
+
+    public:
+        uint64_t fresh = 0;  // Coins taken that had not been spent before
+        uint64_t chained = 0;  // Coins taken that this spender had already spent (so unconfirmed outputs)
+        uint64_t steals = 0;
+
+        Cache() : held(0) {}
+
+        /** Point it at up to max consecutive slots to spend next, and return how many.  Fresh coins come first.
+            Returns 0 only if this spender has never been able to get any coins at all. */
+        uint32_t Take(uint32_t max, UtxoPool::iterator& it)
+        {
+            uint64_t h = held.load(std::memory_order_acquire);
+            while (1)
+            {
+                uint32_t b = h >> 32;
+                uint32_t e = (uint32_t)h;
+                if (b >= e)
+                {
+                    if (!owner->Refill(*this)) break;
+                    h = held.load(std::memory_order_acquire);
+                    continue;
+                }
+                uint32_t n = std::min(max, e - b);
+                if (held.compare_exchange_weak(h, Pack(b + n, e), std::memory_order_acq_rel))
+                {
+                    if (!spent.empty() && (spent.back().end == b))
+                        spent.back().end = b + n;
+                    else
+                        spent.push_back(Range{b, b + n});
+                    spentQty += n;
+                    fresh += n;
+                    it = owner->pool.begin() + b;
+                    return n;
+                }
+            }
+
+            // No fresh coins anywhere, so go around the slots we spent again
+            if (spent.empty()) return 0;
+            if (chainPos >= spent[chainIdx].end - spent[chainIdx].begin)
+            {
+                chainPos = 0;
+                chainIdx = (chainIdx + 1) % spent.size();
+                // Someone may have given coins back since we last looked
+                if (owner->Refill(*this)) return Take(max, it);
+            }
+            const Range& r = spent[chainIdx];
+            uint32_t n = std::min(max, r.end - r.begin - chainPos);
+            it = owner->pool.begin() + r.begin + chainPos;
+            chainPos += n;
+            chained += n;
+            return n;
+        }
+
+        /** How many distinct slots this spender has taken */
+        uint64_t Owned() const { return spentQty; }
+
+        /** Give the fresh coins not yet taken back to the dispenser */
+        void Release()
+        {
+            uint64_t h = held.exchange(0, std::memory_order_acq_rel);
+            uint32_t b = h >> 32;
+            uint32_t e = (uint32_t)h;
+            if (b < e)
+            {
+                Range r{b, e};
+                owner->free.push(r);  // Never full: it has room for every chunk and a release from every cache
+            }
+        }
+    };
+
+protected:
+    UtxoPool& pool;
+    LockFreeRing<Range> free;
+    std::unique_ptr<Cache[]> caches;
+    size_t numCaches;
+    std::atomic<size_t> cachesUsed;
+
+    /** Give c a new range of fresh coins, from the ring or by stealing.  Returns false if there are none */
+    bool Refill(Cache& c)
+    {
+        Range r;
+        if (free.pop(r))
+        {
+            c.held.store(Cache::Pack(r.begin, r.end), std::memory_order_release);
+            return true;
+        }
+
+        while (1)
+        {
+            // Steal from whoever holds the most, since they are least likely to miss it
+            Cache* victim = nullptr;
+            uint64_t victimHeld = 0;
+            uint32_t most = MIN_STEAL - 1;
+            size_t used = std::min(cachesUsed.load(std::memory_order_acquire), numCaches);
+            for (size_t i = 0; i < used; i++)
+            {
+                if (&caches[i] == &c) continue;
+                uint64_t h = caches[i].held.load(std::memory_order_acquire);
+                uint32_t b = h >> 32;
+                uint32_t e = (uint32_t)h;
+                if ((b < e) && (e - b > most))
+                {
+                    most = e - b;
+                    victim = &caches[i];
+                    victimHeld = h;
+                }
+            }
+            if (!victim) return false;
+
+            uint32_t b = victimHeld >> 32;
+            uint32_t e = (uint32_t)victimHeld;
+            uint32_t mid = b + (e - b) / 2;
+            if (victim->held.compare_exchange_strong(victimHeld, Cache::Pack(b, mid), std::memory_order_acq_rel))
+            {
+                c.held.store(Cache::Pack(mid, e), std::memory_order_release);
+                c.steals++;
+                return true;
+            }
+            // The victim (or another thief) got there first, so look again
+        }
+    }
+
+public:
+    /** Dispense the coins of p to at most spenders Caches */
+    CoinDispenser(UtxoPool& p, size_t spenders)
+        : pool(p), free((std::min(p.size(), (size_t)std::numeric_limits<uint32_t>::max()) + CHUNK - 1) / CHUNK + spenders),
+          caches(new Cache[spenders]), numCaches(spenders), cachesUsed(0)
+    {
+        uint32_t qty = std::min(p.size(), (size_t)std::numeric_limits<uint32_t>::max());
+        for (uint32_t b = 0; b < qty; b += std::min(CHUNK, qty - b))
+        {
+            Range r{b, b + std::min(CHUNK, qty - b)};
+            free.push(r);
+        }
+        for (size_t i = 0; i < spenders; i++) caches[i].owner = this;
+    }
+
+    /** A cache for a new spender.  Thread safe.  Throws if more than the constructor's spenders are asked for */
+    Cache& NewCache()
+    {
+        size_t idx = cachesUsed.fetch_add(1);
+        if (idx >= numCaches) throw std::runtime_error("CoinDispenser: more spenders than expected");
+        return caches[idx];
+    }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#define HAVE_CONFIG_H
+#include "corpus.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char MAGIC[8] = {'T', 'X', 'U', 'C', 'O', 'R', 'P', 'S'};
+const uint32_t ENDIAN_MARK = 0x01020304;
+const uint64_t PAGE = 4096;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t sections;
+    unsigned char netMagic[4];
+};
+
+uint64_t PageAlign(uint64_t n) { return (n + PAGE - 1) & ~(PAGE - 1); }
+}
+
+size_t TxCorpus::HeaderSize() const { return sizeof(Header) + sections.size() * sizeof(Section); }
+
+bool TxCorpus::Create(const std::string& p, const std::vector<uint64_t>& capacities)
+{
+    Close();
+    path = p;
+    sections.resize(capacities.size());
+    uint64_t offset = PageAlign(HeaderSize());
+    for (size_t i = 0; i < capacities.size(); i++)
+    {
+        sections[i].offset = offset;
+        sections[i].capacity = capacities[i];
+        sections[i].bytes = 0;
+        sections[i].msgs = 0;
+        offset = PageAlign(offset + capacities[i]);
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Cannot create corpus %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, offset) != 0)  // Sparse: only the pages that get written take space
+    {
+        printf("Cannot size corpus %s to %lu bytes: %s\n", path.c_str(), (long unsigned int)offset, strerror(errno));
+        close(fd);
+        return false;
+    }
+    void* m = mmap(nullptr, offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+    {
+        printf("Cannot map corpus %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    map = (unsigned char*)m;
+    mapLen = offset;
+    writable = true;
+    return true;
+}
+
+bool TxCorpus::Open(const std::string& p, const std::vector<unsigned char>& net)
+{
+    Close();
+    path = p;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Cannot open corpus %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(Header)))
+    {
+        printf("Corpus %s is truncated\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+    {
+        printf("Cannot map corpus %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    map = (unsigned char*)m;
+    mapLen = st.st_size;
+
+    Header h;
+    memcpy(&h, map, sizeof(h));
+    const char* problem = nullptr;
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+        problem = "is not a transaction corpus";
+    else if (h.version != VERSION)
+        problem = "is a different corpus version";
+    else if (h.endian != ENDIAN_MARK)
+        problem = "was written on a machine with a different byte order";
+    else if ((net.size() != sizeof(h.netMagic)) || (memcmp(h.netMagic, net.data(), sizeof(h.netMagic)) != 0))
+        problem = "is for a different network";
+    else if (sizeof(Header) + (size_t)h.sections * sizeof(Section) > mapLen)
+        problem = "is truncated or corrupt";
+    if (!problem)
+    {
+        sections.resize(h.sections);
+        memcpy(sections.data(), map + sizeof(Header), h.sections * sizeof(Section));
+        for (auto& s : sections)
+            if ((s.bytes > s.capacity) || (s.offset + s.bytes > mapLen)) problem = "is truncated or corrupt";
+    }
+    if (problem)
+    {
+        printf("Corpus %s %s\n", path.c_str(), problem);
+        Close();
+        return false;
+    }
+    netMagic = net;
+    for (auto& s : sections) madvise(map + s.offset, s.bytes, MADV_SEQUENTIAL);  // offsets are page aligned
+    return true;
+}
+
+bool TxCorpus::Close()
+{
+    bool ok = true;
+    if (map && writable)
+    {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.endian = ENDIAN_MARK;
+        h.sections = sections.size();
+        memcpy(h.netMagic, netMagic.data(), std::min(netMagic.size(), sizeof(h.netMagic)));
+        memcpy(map, &h, sizeof(h));
+        memcpy(map + sizeof(Header), sections.data(), sections.size() * sizeof(Section));
+        if (msync(map, mapLen, MS_SYNC) != 0)
+        {
+            printf("Cannot write corpus %s: %s\n", path.c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+    if (map) munmap(map, mapLen);
+    map = nullptr;
+    mapLen = 0;
+    writable = false;
+    return ok;
+}
@@ -0,0 +1,74 @@
+#ifndef TXUNAMI_CORPUS_H
+#define TXUNAMI_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** A file of transactions signed ahead of time, already serialized as complete P2P "tx" messages (header included),
+    so that replaying it is nothing but writing byte ranges of the memory mapped file to sockets.
+
+    The file holds one section per schedule target, in schedule order.  Each section is a run of back to back
+    messages that starts on a page boundary.  Sections are sized for the most messages that could be needed, and
+    the unused tail is never written so it takes no disk space.
+*/
+class TxCorpus
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    class Section
+    {
+    public:
+        uint64_t offset;    // from the start of the file
+        uint64_t capacity;  // bytes reserved
+        uint64_t bytes;     // bytes of messages actually written
+        uint64_t msgs;
+    };
+
+protected:
+    std::vector<Section> sections;
+    unsigned char* map = nullptr;
+    size_t mapLen = 0;
+    bool writable = false;
+    std::string path;
+
+    size_t HeaderSize() const;
+
+public:
+    /** The network the messages were made for (the first 4 bytes of every message).  Set before Close()ing a
+        created corpus */
+    std::vector<unsigned char> netMagic;
+
+    TxCorpus() {}
+    ~TxCorpus() { Close(); }
+    TxCorpus(const TxCorpus&) = delete;
+    TxCorpus& operator=(const TxCorpus&) = delete;
+
+    /** Create a corpus file with a section of each of the given capacities, mapped for writing.
+        Returns false, having printed why, on failure. */
+    bool Create(const std::string& path, const std::vector<uint64_t>& capacities);
+
+    /** Map an existing corpus file for reading.  netMagic must match the messages' network.
+        Returns false, having printed why, on failure. */
+    bool Open(const std::string& path, const std::vector<unsigned char>& netMagic);
+
+    /** Write the section table (if the file was created) and unmap.  Returns false if the file could not be
+        written */
+    bool Close();
+
+    size_t size() const { return sections.size(); }
+    const Section& operator[](size_t i) const { return sections[i]; }
+    unsigned char* Data(size_t i) { return map + sections[i].offset; }
+    const unsigned char* Data(size_t i) const { return map + sections[i].offset; }
+
+    /** Record how much of section i a generator filled */
+    void SetFilled(size_t i, uint64_t bytes, uint64_t msgs)
+    {
+        sections[i].bytes = bytes;
+        sections[i].msgs = msgs;
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TXUNAMI_KEYRING_H
+#define TXUNAMI_KEYRING_H
+
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "pubkey.h"
+#include "uint256.h"
+
+/** The keys that generated coins are locked to.
+
+    Instead of a fresh random key per coin, key i is derived from a seed: SHA256(seed | i | attempt), with attempt
+    only bumped in the astronomically unlikely case that the hash is not a valid secret.  So a run (and any coins it
+    leaves behind) can be reproduced from the seed, and only a bounded number of keys ever need their public key
+    computed.  Coins refer to keys by index, and the public key and its hash are computed once per key.
+
+    Keys that were not derived (for example the funding coins in the config file) can also be added.  These sit after
+    the derived keys and are never handed out by Next().
+*/
+class KeyRing
+{
+public:
+    class Key
+    {
+    public:
+        CKey priv;
+        CPubKey pub;
+        CKeyID id;
+    };
+
+protected:
+    std::vector<Key> keys;
+    uint32_t derived = 0;
+    uint32_t next = 0;
+    uint256 seed;
+
+    void DeriveRange(uint32_t start, uint32_t end)
+    {
+        for (uint32_t i = start; i < end; i++)
+        {
+            Key& k = keys[i];
+            k.priv = Derive(seed, i);
+            k.pub = k.priv.GetPubKey();
+            k.id = k.pub.GetID();
+        }
+    }
+
+public:
+    /** Derive the secret for key idx of the ring seeded by seed (always a compressed key) */
+    static CKey Derive(const uint256& seed, uint32_t idx)
+    {
+        CKey ret;
+        unsigned char buf[8];
+        unsigned char secret[32];
+        WriteLE32(buf, idx);
+        for (uint32_t attempt = 0; !ret.IsValid(); attempt++)
+        {
+            WriteLE32(buf + 4, attempt);
+            CSHA256().Write(seed.begin(), 32).Write(buf, sizeof(buf)).Finalize(secret);
+            ret.Set(secret, secret + sizeof(secret), true);
+        }
+        return ret;
+    }
+
+    /** Replace the contents of this ring with qty keys derived from s, splitting the public key calculation across
+        up to threads threads */
+    void Generate(const uint256& s, uint32_t qty, unsigned int threads)
+    {
+        seed = s;
+        keys.clear();
+        keys.resize(qty);
+        derived = qty;
+        next = 0;
+
+        if (threads < 1) threads = 1;
+        uint32_t per = qty / threads;
+        if (per < 256)  // Not worth the threads
+        {
+            DeriveRange(0, qty);
+            return;
+        }
+        std::vector<std::thread> thrds;
+        for (unsigned int t = 0; t < threads - 1; t++)
+            thrds.push_back(std::thread([this, t, per] { DeriveRange(t * per, (t + 1) * per); }));
+        DeriveRange((threads - 1) * per, qty);
+        for (auto& t : thrds) t.join();
+    }
+
+    /** Add a key that was not derived from the seed, returning its index */
+    uint32_t Add(const CKey& priv)
+    {
+        Key k;
+        k.priv = priv;
+        k.pub = priv.GetPubKey();
+        k.id = k.pub.GetID();
+        keys.push_back(k);
+        return keys.size() - 1;
+    }
+
+    /** Round robin through the derived keys.  Not thread safe */
+    uint32_t Next()
+    {
+        uint32_t ret = next;
+        next++;
+        if (next >= derived) next = 0;
+        return ret;
+    }
+
+    const Key& operator[](uint32_t idx) const { return keys[idx]; }
+    uint32_t size() const { return keys.size(); }
+    uint32_t Derived() const { return derived; }
+    const uint256& Seed() const { return seed; }
+};
+
+#endif
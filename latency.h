@@ -0,0 +1,181 @@
+#ifndef TXUNAMI_LATENCY_H
+#define TXUNAMI_LATENCY_H
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+/** A histogram of latencies in the style of HdrHistogram: buckets are linear within each power of 2, so every value
+    is recorded to within 1/128 of itself, from a microsecond to centuries, in a few tens of KB.  Recording is a
+    couple of shifts and an increment.  Not thread safe: give each writer its own and add them up (+=) to report. */
+class LatencyHistogram
+{
+public:
+    static const unsigned int SUB_BITS = 8;
+    static const unsigned int SUB_BUCKETS = 1 << SUB_BITS;
+    static const unsigned int HALF = SUB_BUCKETS / 2;  // Buckets per power of 2 above SUB_BUCKETS, so within 1/128
+
+protected:
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static unsigned int Index(uint64_t v)
+    {
+        if (v < SUB_BUCKETS) return v;
+        unsigned int shift = 63 - __builtin_clzll(v) - SUB_BITS + 1;  // Brings v into [HALF, SUB_BUCKETS)
+        return SUB_BUCKETS + (shift - 1) * HALF + (v >> shift) - HALF;
+    }
+
+    /** The highest value that lands in bucket i */
+    static uint64_t Value(unsigned int i)
+    {
+        if (i < SUB_BUCKETS) return i;
+        unsigned int shift = (i - SUB_BUCKETS) / HALF + 1;
+        uint64_t sub = (i - SUB_BUCKETS) % HALF + HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(SUB_BUCKETS + (64 - SUB_BITS) * HALF, 0) {}
+
+    /** Record a latency of us microseconds */
+    void Record(uint64_t us)
+    {
+        counts[Index(us)]++;
+        total++;
+        maxValue = std::max(maxValue, us);
+    }
+
+    uint64_t Count() const { return total; }
+    uint64_t Max() const { return maxValue; }
+
+    /** The latency (us) that fraction p (0..1) of the recorded latencies are at or below */
+    uint64_t Percentile(double p) const
+    {
+        if (total == 0) return 0;
+        uint64_t want = std::max((uint64_t)1, (uint64_t)(p * total + 0.5));
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i];
+            if (seen >= want) return std::min(Value(i), maxValue);
+        }
+        return maxValue;
+    }
+
+    LatencyHistogram& operator+=(const LatencyHistogram& o)
+    {
+        for (unsigned int i = 0; i < counts.size(); i++) counts[i] += o.counts[i];
+        total += o.total;
+        maxValue = std::max(maxValue, o.maxValue);
+        return *this;
+    }
+};
+
+/** When, and by which target, each transaction was sent, so that announcements of it can be timed.  Keyed by the
+    first 8 bytes of the txid.  Sharded so that many senders and observers can use it at once.  A transaction is
+    forgotten once it was sent more than maxAge ago, so a long run's bookkeeping stays bounded by its rate. */
+class SentTxTracker
+{
+public:
+    class Sent
+    {
+    public:
+        uint64_t stopwatch;  // GetStopwatch() when it was sent
+        uint16_t phase;
+        uint16_t target;
+    };
+
+protected:
+    static const unsigned int SHARDS = 64;
+    struct Shard
+    {
+        std::mutex cs;
+        std::unordered_map<uint64_t, Sent> sent;
+        std::deque<std::pair<uint64_t, uint64_t> > order;  // (key, stopwatch) in the order they were added
+        uint64_t forgotten = 0;
+    };
+    Shard shards[SHARDS];
+    unsigned int sample;
+    uint64_t maxAge;  // ns
+
+    static uint64_t Key(const unsigned char* txid)
+    {
+        uint64_t k;
+        memcpy(&k, txid, 8);
+        return k;
+    }
+
+public:
+    /** Track 1 in every sampleEvery transactions (chosen by txid, so the same ones everywhere), each for maxAgeNs
+        after it was sent */
+    SentTxTracker(unsigned int sampleEvery, uint64_t maxAgeNs) : sample(std::max(sampleEvery, 1U)), maxAge(maxAgeNs) {}
+
+    /** Is this a transaction we track? */
+    bool Tracked(const unsigned char* txid) const { return (Key(txid) % sample) == 0; }
+
+    /** Record that txid (32 bytes, internal byte order, as in an inv) was sent */
+    void Add(const unsigned char* txid, const Sent& s)
+    {
+        if (!Tracked(txid)) return;
+        uint64_t k = Key(txid);
+        Shard& sh = shards[(k >> 32) % SHARDS];
+        std::lock_guard<std::mutex> lock(sh.cs);
+        while (!sh.order.empty() && (sh.order.front().second + maxAge < s.stopwatch))
+        {
+            auto it = sh.sent.find(sh.order.front().first);
+            if ((it != sh.sent.end()) && (it->second.stopwatch == sh.order.front().second))  // Not since replaced
+            {
+                sh.sent.erase(it);
+                sh.forgotten++;
+            }
+            sh.order.pop_front();
+        }
+        sh.sent[k] = s;
+        sh.order.emplace_back(k, s.stopwatch);
+    }
+
+    /** Look up a transaction we sent.  Returns false if it isn't one of ours (or isn't sampled) */
+    bool Find(const unsigned char* txid, Sent& s)
+    {
+        if (!Tracked(txid)) return false;
+        uint64_t k = Key(txid);
+        Shard& sh = shards[(k >> 32) % SHARDS];
+        std::lock_guard<std::mutex> lock(sh.cs);
+        auto it = sh.sent.find(k);
+        if (it == sh.sent.end()) return false;
+        s = it->second;
+        return true;
+    }
+
+    /** How many sent transactions were forgotten because they got too old */
+    uint64_t Forgotten()
+    {
+        uint64_t ret = 0;
+        for (auto& sh : shards)
+        {
+            std::lock_guard<std::mutex> lock(sh.cs);
+            ret += sh.forgotten;
+        }
+        return ret;
+    }
+
+    /** How many sent transactions are being tracked */
+    uint64_t Size()
+    {
+        uint64_t ret = 0;
+        for (auto& sh : shards)
+        {
+            std::lock_guard<std::mutex> lock(sh.cs);
+            ret += sh.sent.size();
+        }
+        return ret;
+    }
+};
+
+#endif
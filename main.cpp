@@ -8,14 +8,40 @@
 #include <streambuf>
 #include <stdexcept>
 #include <random>
+#include <memory>
+#include <functional>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <poll.h>
 #include "key.h"
+#include "keyring.h"
 #include "uint256.h"
 #include "base58.h"
 #include "script/script.h"
 #include "streams.h"
 #include "random.h"
 #include "utilstrencodings.h"
-#include "leakybucket.h"
+#include "script/interpreter.h"
+#include "announce.h"
+#include "coinpool.h"
+#include "corpus.h"
+#include "latency.h"
+#include "metrics.h"
+#include "p2p.h"
+#include "pacer.h"
+#include "ring.h"
+#include "saturate.h"
+#include "schnorr.h"
+#include "sha256multi.h"
+#include "sighash.h"
+#include "sink.h"
+#include "snapshot.h"
+#include "splitplan.h"
+#include "trace.h"
+#include "txtemplate.h"
+#include "utxopool.h"
+#include "workload.h"
 
 using namespace std;
 
@@ -25,34 +51,16 @@ static const auto REGTEST_MSG_START = ParseHex("dab5bffa");
 static const auto NOLNET_MSG_START = ParseHex("00000000"); // ParseHex("fbcec4e9");
 static const auto SCALENET_MSG_START = ParseHex("c3afe1a2");
 
-class UTXO
-{
-public:
-    COutPoint prevout;
-
-    CScript constraintScript;
-    uint64_t satoshi;
-    CKey    privKey;
-    CPubKey publicKey;
-
-    CPubKey& pubKey()
-    {
-        if (publicKey.IsValid()) return publicKey;
-        publicKey = privKey.GetPubKey();
-        return publicKey;
-    }
+/** Every key that coins are locked to.  Filled in by main before any coins exist */
+KeyRing keyRing;
 
-    CScript createP2PKH()
-    {
-        CKeyID dest = pubKey().GetID();
-        constraintScript.clear();
-        constraintScript << OP_DUP << OP_HASH160 << ToByteVector(dest) << OP_EQUALVERIFY << OP_CHECKSIG;
-        return constraintScript;
-    }
-};
+typedef UtxoPool::iterator CoinIter;
 
 /** Generate transactions at the maximum rate possible to the specified host */
-void MaxSpeed(const string& host, vector<UTXO>& utxo, vector<UTXO>& txo);
+void MaxSpeed(const string& host, UtxoPool& coins);
+
+/** Run the microbenchmarks whose names contain filter (all of them if it is empty).  Needs no config or node */
+int Bench(const string& filter);
 
 class ConfigException:public runtime_error
 {
@@ -99,14 +107,207 @@ public:
     }
 
 
+    /** Give this copy its own random sequence.  Copies otherwise repeat the fees of the one they were copied from,
+        so each thread that takes a copy should call this */
+    void Reseed() { rnd.seed(std::random_device()()); }
+
+    /** Never produce less than f, for example to meet a node's feefilter */
+    void SetFloor(CAmount f) { floor = f; }
+
     CAmount operator() ()
     {
-        if (constantFee >= 0) return constantFee;
-        else return randRange(rnd);
+        if (constantFee >= 0) return std::max(constantFee, floor);
+        else return std::max((CAmount) randRange(rnd), floor);
         return 0;
     }
+
+protected:
+    CAmount floor = 0;
+};
+
+/** When a SimpleClient flushes the messages it has queued up.  Flushing occurs when any enabled threshold is
+    reached.  Batching many messages into one syscall is much more efficient at high rates, but a message may wait
+    up to maxDelayUs before it is sent.
+ */
+class SendBatchPolicy
+{
+public:
+    unsigned int maxCount = 1;  // Flush after this many messages (0 disables)
+    uint64_t maxBytes = 0;      // Flush after this many bytes (0 disables)
+    uint64_t maxDelayUs = 0;    // Flush once the oldest queued message has waited this many microseconds (0 disables)
+
+    /** A batch object fully specifies the policy: thresholds it does not mention are disabled */
+    void Load(const UniValue& u)
+    {
+        maxCount = 0;
+        maxBytes = 0;
+        maxDelayUs = 0;
+        if (u.exists("count")) maxCount = u["count"].get_int64();
+        if (u.exists("bytes")) maxBytes = u["bytes"].get_int64();
+        if (u.exists("usec")) maxDelayUs = u["usec"].get_int64();
+        if ((maxCount == 0)&&(maxBytes == 0)&&(maxDelayUs == 0))
+            throw ConfigException("'batch' must enable at least one of 'count', 'bytes' or 'usec'");
+    }
+};
+
+/** Fill in a pacing profile from a config "pace" object.  Fields it does not mention keep their current values */
+void LoadPace(Pacer::Profile& p, const UniValue& u)
+{
+    if (u.exists("ramp"))
+    {
+        std::string s = u["ramp"].get_str();
+        if (s == "linear") p.ramp = Pacer::Ramp::LINEAR;
+        else if (s == "exponential") p.ramp = Pacer::Ramp::EXPONENTIAL;
+        else throw ConfigException("'ramp' must be 'linear' or 'exponential'");
+    }
+    if (u.exists("arrivals"))
+    {
+        std::string s = u["arrivals"].get_str();
+        if (s == "uniform") p.arrivals = Pacer::Arrivals::UNIFORM;
+        else if (s == "poisson") p.arrivals = Pacer::Arrivals::POISSON;
+        else if (s == "onoff") p.arrivals = Pacer::Arrivals::ONOFF;
+        else throw ConfigException("'arrivals' must be 'uniform', 'poisson' or 'onoff'");
+    }
+    if (u.exists("onMs")) p.onUs = u["onMs"].get_int64() * 1000;
+    if (u.exists("offMs")) p.offUs = u["offMs"].get_int64() * 1000;
+    if (u.exists("maxLagMs")) p.maxLagUs = u["maxLagMs"].get_int64() * 1000;
+    if ((p.arrivals == Pacer::Arrivals::ONOFF) && (p.onUs == 0))
+        throw ConfigException("'onoff' arrivals need a nonzero 'onMs'");
+}
+
+/** Fill in an adaptive rate profile from a config "saturate" object, which turns it on (false turns it off).  Fields
+    it does not mention keep their current values */
+void LoadSaturate(Saturator::Profile& p, const UniValue& u)
+{
+    if (u.isBool())
+    {
+        p.enabled = u.get_bool();
+        return;
+    }
+    p.enabled = true;
+    if (u.exists("stepSec")) p.stepMs = u["stepSec"].get_real() * 1000;
+    if (u.exists("growth")) p.growth = u["growth"].get_real();
+    if (u.exists("precision")) p.precision = u["precision"].get_real();
+    if (u.exists("maxQueueKB")) p.maxQueueBytes = u["maxQueueKB"].get_int64() * 1024;
+    if (u.exists("maxStallPct")) p.maxStall = u["maxStallPct"].get_real() / 100;
+    if (u.exists("maxWouldBlockPct")) p.maxWouldBlock = u["maxWouldBlockPct"].get_real() / 100;
+    if (u.exists("latencyFactor")) p.latencyFactor = u["latencyFactor"].get_real();
+    if (u.exists("maxRejects")) p.maxRejects = u["maxRejects"].get_int64();
+    if (p.stepMs < 100) throw ConfigException("'stepSec' must be at least 0.1");
+    if (p.growth <= 1) throw ConfigException("'growth' must be more than 1");
+    if (p.precision <= 0) throw ConfigException("'precision' must be more than 0");
+}
+
+/** Fill in announce mode settings from a config "announce" object, which turns it on (false turns it off).  Fields
+    it does not mention keep their current values */
+void LoadAnnounce(TxAnnouncer::Profile& p, const UniValue& u)
+{
+    if (u.isBool())
+    {
+        p.enabled = u.get_bool();
+        return;
+    }
+    p.enabled = true;
+    if (u.exists("invBatch")) p.invBatch = u["invBatch"].get_int64();
+    if (u.exists("invMs")) p.invUs = u["invMs"].get_real() * 1000;
+    if (u.exists("holdSec")) p.holdMs = u["holdSec"].get_real() * 1000;
+    if ((p.invBatch < 1) || (p.invBatch > TxAnnouncer::MAX_INV))
+        throw ConfigException("'invBatch' must be between 1 and " + std::to_string(TxAnnouncer::MAX_INV));
+    if (p.holdMs < 1000) throw ConfigException("'holdSec' must be at least 1");
+}
+
+/** A config count that is either n or [lo, hi] */
+WorkloadMix::Range LoadRange(const UniValue& u, const string& field, unsigned int max)
+{
+    WorkloadMix::Range r;
+    if (u.isArray())
+    {
+        if (u.size() != 2) throw ConfigException("'" + field + "' must be a number or [lo, hi]");
+        r.lo = u[0].get_int64();
+        r.hi = u[1].get_int64();
+    }
+    else
+        r.lo = r.hi = u.get_int64();
+    if ((r.lo < 1) || (r.lo > r.hi) || (r.hi > max))
+        throw ConfigException("'" + field + "' must be between 1 and " + std::to_string(max) + ", low end first");
+    return r;
+}
+
+/** Load a config "workload" object: the shapes of transaction to send, the script types of their outputs, and the
+    sizes of their OP_RETURNs.  Returns null for false, meaning plain one input one output P2PKH transactions */
+std::shared_ptr<const WorkloadMix> LoadWorkload(const UniValue& u)
+{
+    if (u.isBool())
+    {
+        if (u.get_bool()) throw ConfigException("'workload' must be an object, or false");
+        return nullptr;
+    }
+    auto mix = std::make_shared<WorkloadMix>();
+    if (!u.exists("shapes") || (u["shapes"].size() == 0)) throw ConfigException("A 'workload' needs 'shapes'");
+    const UniValue& shapes = u["shapes"];
+    for (unsigned int i = 0; i < shapes.size(); i++)
+    {
+        const UniValue& us = shapes[i];
+        WorkloadMix::Shape s;
+        s.name = us.exists("name") ? us["name"].get_str() : "shape" + std::to_string(i);
+        if (us.exists("inputs")) s.inputs = LoadRange(us["inputs"], "inputs", WorkloadMix::MAX_INPUTS);
+        if (us.exists("outputs")) s.outputs = LoadRange(us["outputs"], "outputs", WorkloadMix::MAX_OUTPUTS);
+        double weight = us.exists("weight") ? us["weight"].get_real() : 1;
+        mix->shapeWeights.Add(mix->shapes.size(), weight);
+        mix->shapes.push_back(s);
+    }
+    if (mix->shapeWeights.empty()) throw ConfigException("Every 'workload' shape has zero weight");
+
+    if (u.exists("scripts"))
+    {
+        const UniValue& sc = u["scripts"];
+        for (const string& k : sc.getKeys())
+        {
+            ScriptType t;
+            if (k == "p2pkh") t = ScriptType::P2PKH;
+            else if (k == "p2pk") t = ScriptType::P2PK;
+            else if (k == "p2sh") t = ScriptType::P2SH_MULTISIG;
+            else throw ConfigException("'scripts' may only weight 'p2pkh', 'p2pk' and 'p2sh'");
+            mix->scripts.Add(t, sc[k].get_real());
+        }
+    }
+
+    if (u.exists("opReturn"))  // [[bytes, weight], ...]
+    {
+        const UniValue& ops = u["opReturn"];
+        for (unsigned int i = 0; i < ops.size(); i++)
+        {
+            if (!ops[i].isArray() || (ops[i].size() != 2)) throw ConfigException("'opReturn' entries must be [bytes, weight]");
+            int64_t bytes = ops[i][0].get_int64();
+            if ((bytes < 0) || (bytes > (int64_t) WorkloadMix::MAX_OP_RETURN))
+                throw ConfigException("'opReturn' sizes must be between 0 and " + std::to_string(WorkloadMix::MAX_OP_RETURN));
+            mix->opReturns.Add(bytes, ops[i][1].get_real());
+        }
+    }
+
+    if (mix->MaxSize() > WorkloadMix::MAX_TX_SIZE)
+        throw ConfigException("The 'workload' shapes can make transactions of up to " + std::to_string(mix->MaxSize()) +
+                              " bytes, over the " + std::to_string(WorkloadMix::MAX_TX_SIZE) + " byte limit");
+    return mix;
+}
+
+/** Which signature scheme generated transactions are signed with */
+enum class SigType
+{
+    ECDSA,
+    SCHNORR
 };
 
+SigType LoadSigType(const UniValue& u)
+{
+    std::string s = u.get_str();
+    if (s == "ecdsa") return SigType::ECDSA;
+    if (s == "schnorr") return SigType::SCHNORR;
+    throw ConfigException("'sigType' must be 'ecdsa' or 'schnorr'");
+}
+
+const char* SigTypeName(SigType t) { return (t == SigType::SCHNORR) ? "schnorr" : "ecdsa"; }
+
 class GlobalConfig
 {
 public:
@@ -115,7 +316,41 @@ public:
     unsigned int defaultPort = 18444;
     unsigned int minUtxos = 4*1000*1000;
     unsigned int maxThreads = 10;
+    unsigned int signers = 0;  // 0 means sign and send serially in the same thread
+    unsigned int pipelineDepth = 4096;  // Max signed transactions queued between the signers and the sender
+    unsigned int ioThreads = 0;  // 0 gives every schedule target a thread of its own, otherwise targets share this many
+    unsigned int connections = 1;  // Connections per schedule target (when ioThreads is set)
+    unsigned int connectAhead = 2;  // Seconds before its phase that a target connects (and its signers start)
+    SendBatchPolicy batch;
+    Pacer::Profile pace;
+    Saturator::Profile saturate;
+    TxAnnouncer::Profile announce;
+    std::shared_ptr<const WorkloadMix> workload;  // Null for plain one input one output transactions
+    unsigned int hashBatch = 8;  // How many transactions signers build at once so their hashes can share SIMD lanes
+    uint64_t sendQueueBytes = 4*1024*1024;  // Bound on each connection's outbound queue
+    SigType sigType = SigType::ECDSA;
+    unsigned int noncePool = 16384;  // Schnorr nonces each signing thread precomputes while it is idle
+    unsigned int keyRingSize = 65536;  // Distinct keys generated coins are spread over
+    uint256 keySeed;  // Keys are derived from this.  Random unless configured
+    bool keySeedSet = false;
+    string loadCoins;  // Start from this coin snapshot instead of splitting the config file's coins
+    string saveSplitCoins;  // Write the coins to this snapshot once they are split
+    string saveFinalCoins;  // Write the coins to this snapshot when the run ends
+    string corpusMode;  // "generate" signs the schedule's transactions into corpusFile, "replay" sends them
+    string corpusFile;
     string bitcoind = "127.0.0.1:18444";  // The default host for non-rate-generation operations like coin splitting.
+    std::vector<string> splitHosts;  // Where split transactions are sent.  Just bitcoind if empty
+    unsigned int splitConnections = 1;  // Connections the split transactions are spread over, round robin over splitHosts
+    MempoolLimits limits;  // The split node's unconfirmed chain limits, which the split tree is planned to stay within
+    string txCommitCmd;  // Run to confirm the split so far when the tree reaches the limits.  Waits for <enter> if empty
+    std::vector<string> observers;  // Nodes whose tx announcements are timed (see LatencyObserver)
+    unsigned int observeSample = 0;  // Time 1 in this many transactions.  0 picks it from the schedule's rates
+    unsigned int observeLinger = 10;  // Seconds to keep observing after the schedule ends
+    unsigned int observeMaxSec = 600;  // Transactions not announced this long after they were sent aren't timed
+    string traceFile;  // Write the stage trace here at the end, as Chrome trace events (only if built with TRACE=1)
+    unsigned int traceEvents = 65536;  // The most recent stage timings each thread keeps for traceFile
+    unsigned int metricsPort = 0;  // Serve live metrics in Prometheus format on this local port, if set
+    string metricsLog;  // Append a JSON line of live metrics to this file every second, if set
     std::vector<unsigned char> msgStart = REGTEST_MSG_START;
     std::string net = "regtest";
 
@@ -125,7 +360,78 @@ public:
         if (settings.exists("splitPerTx")) splitPerTx = settings["splitPerTx"].get_int64();
         if (settings.exists("minUtxos"))  minUtxos = settings["minUtxos"].get_int64();
         if (settings.exists("maxThreads")) maxThreads = settings["maxThreads"].get_int64();
+        if (settings.exists("signers")) signers = settings["signers"].get_int64();
+        if (settings.exists("pipelineDepth")) pipelineDepth = settings["pipelineDepth"].get_int64();
+        if (settings.exists("ioThreads")) ioThreads = settings["ioThreads"].get_int64();
+        if (settings.exists("connections")) connections = settings["connections"].get_int64();
+        if (settings.exists("connectAhead")) connectAhead = settings["connectAhead"].get_int64();
+        if (settings.exists("batch")) batch.Load(settings["batch"]);
+        if (settings.exists("pace")) LoadPace(pace, settings["pace"]);
+        if (settings.exists("saturate")) LoadSaturate(saturate, settings["saturate"]);
+        if (settings.exists("announce")) LoadAnnounce(announce, settings["announce"]);
+        if (settings.exists("workload")) workload = LoadWorkload(settings["workload"]);
+        if (settings.exists("hashBatch"))
+        {
+            hashBatch = settings["hashBatch"].get_int64();
+            if ((hashBatch < 1)||(hashBatch > 16)) throw ConfigException("'hashBatch' must be between 1 and 16");
+        }
+        if (settings.exists("sendQueueBytes")) sendQueueBytes = settings["sendQueueBytes"].get_int64();
+        if (settings.exists("sigType")) sigType = LoadSigType(settings["sigType"]);
+        if (settings.exists("noncePool")) noncePool = settings["noncePool"].get_int64();
+        if (settings.exists("keyRingSize"))
+        {
+            keyRingSize = settings["keyRingSize"].get_int64();
+            if (keyRingSize < 1) throw ConfigException("'keyRingSize' must be at least 1");
+        }
+        if (settings.exists("loadCoins")) loadCoins = settings["loadCoins"].get_str();
+        if (settings.exists("saveSplitCoins")) saveSplitCoins = settings["saveSplitCoins"].get_str();
+        if (settings.exists("saveFinalCoins")) saveFinalCoins = settings["saveFinalCoins"].get_str();
+        if (settings.exists("corpusFile")) corpusFile = settings["corpusFile"].get_str();
+        if (settings.exists("corpusMode"))
+        {
+            corpusMode = settings["corpusMode"].get_str();
+            if ((corpusMode != "generate") && (corpusMode != "replay"))
+                throw ConfigException("'corpusMode' must be 'generate' or 'replay'");
+            if (corpusFile.empty()) throw ConfigException("'corpusMode' needs a 'corpusFile'");
+        }
+        if (settings.exists("keySeed"))
+        {
+            std::string seedHex = settings["keySeed"].get_str();
+            if ((seedHex.size() != 64) || !IsHex(seedHex))
+                throw ConfigException("'keySeed' must be 64 hex digits");
+            keySeed.SetHex(seedHex);
+            keySeedSet = true;
+        }
         if (settings.exists("bitcoind")) bitcoind = settings["bitcoind"].get_str();
+        if (settings.exists("splitHosts"))
+        {
+            const UniValue& hosts = settings["splitHosts"];
+            splitHosts.clear();
+            for (unsigned int i = 0; i < hosts.size(); i++) splitHosts.push_back(hosts[i].get_str());
+        }
+        if (settings.exists("limitAncestorCount")) limits.ancestorCount = settings["limitAncestorCount"].get_int64();
+        if (settings.exists("limitAncestorSize")) limits.ancestorSize = settings["limitAncestorSize"].get_int64()*1000;
+        if (settings.exists("limitDescendantCount")) limits.descendantCount = settings["limitDescendantCount"].get_int64();
+        if (settings.exists("limitDescendantSize")) limits.descendantSize = settings["limitDescendantSize"].get_int64()*1000;
+        if (settings.exists("observers"))
+        {
+            const UniValue& hosts = settings["observers"];
+            observers.clear();
+            for (unsigned int i = 0; i < hosts.size(); i++) observers.push_back(hosts[i].get_str());
+        }
+        if (settings.exists("observeSample")) observeSample = settings["observeSample"].get_int64();
+        if (settings.exists("observeLinger")) observeLinger = settings["observeLinger"].get_int64();
+        if (settings.exists("observeMaxSec")) observeMaxSec = settings["observeMaxSec"].get_int64();
+        if (settings.exists("traceFile")) traceFile = settings["traceFile"].get_str();
+        if (settings.exists("traceEvents")) traceEvents = settings["traceEvents"].get_int64();
+        if (settings.exists("metricsPort")) metricsPort = settings["metricsPort"].get_int64();
+        if (settings.exists("metricsLog")) metricsLog = settings["metricsLog"].get_str();
+        if (settings.exists("txCommitCmd")) txCommitCmd = settings["txCommitCmd"].get_str();
+        if (settings.exists("splitConnections"))
+        {
+            splitConnections = settings["splitConnections"].get_int64();
+            if (splitConnections < 1) throw ConfigException("'splitConnections' must be at least 1");
+        }
         if (settings.exists("net"))
         {
             std::string n = settings["net"].get_str();
@@ -209,115 +515,160 @@ UniValue readJson(const std::string &jsondata)
 }
 
 
-void ParseInputCoins(UniValue coins, std::vector<UTXO>& utxo)
+void ParseInputCoins(UniValue coins, UtxoPool& utxo)
 {
     for (unsigned int idx = 0; idx < coins.size(); idx++)
     {
         const UniValue &coin = coins[idx];
-        UTXO u;
-        u.prevout.hash.SetHex(coin["txid"].get_str());
-        u.prevout.n = coin["vout"].get_int64();
-        u.satoshi = coin["satoshi"].get_int64();
+        uint256 txid;
+        txid.SetHex(coin["txid"].get_str());
         CBitcoinSecret secret;
         if (!secret.SetString(coin["privKey"].get_str()))
         {
             printf("priv key bad");
             exit(1);
         }
-        u.privKey = secret.GetKey();
+        uint32_t keyIdx = keyRing.Add(secret.GetKey());
+        utxo.push_back(txid, coin["vout"].get_int64(), coin["satoshi"].get_int64(), keyIdx, ScriptType::P2PKH);
 
+        // Scripts aren't stored, so work out which of the ones we can rebuild from the key this is
         vector<unsigned char> scriptData(ParseHex(coin["scriptPubKey"].get_str()));
-        u.constraintScript = CScript(scriptData.begin(), scriptData.end());
-
-        // Don't need the address, I have the constraint script and the secret
-        utxo.push_back(u);
+        CScript script(scriptData.begin(), scriptData.end());
+        auto u = utxo[utxo.size()-1];
+        if (script != u.constraintScript())
+        {
+            u.Set(txid, u.vout(), u.satoshi(), ScriptType::P2PK);
+            if (script != u.constraintScript())
+            {
+                printf("coin %s:%u is not P2PKH or P2PK to its privKey\n", txid.GetHex().c_str(), u.vout());
+                exit(1);
+            }
+        }
     }
 }
 
 //std::mutex cs;
 
-bool createTx(CMutableTransaction& tx, const std::vector<UTXO>::iterator& inStart, const std::vector<UTXO>::iterator& inEnd,
-              std::vector<UTXO>::iterator& outStart, const std::vector<UTXO>::iterator& outEnd, uint64_t fee)
+/** Sign input inputIdx of tx, which spends coin in, and write its scriptSig.  sighasher must have begun tx.
+    Multisig inputs are always signed with ECDSA: Schnorr signatures in CHECKMULTISIG need the dummy element to be a
+    bitfield of which keys signed, which the legacy OP_0 dummy every wallet uses doesn't allow */
+void signInput(CMutableTransaction& tx, int inputIdx, const UtxoPool::Coin& in, SighashEngine& sighasher,
+               SigType sigType)
+{
+    CTxIn& txi = tx.vin[inputIdx];
+    bool multisig = (in.scriptType() == ScriptType::P2SH_MULTISIG);
+    CScript redeem;
+    if (multisig) redeem = in.redeemScript();
+
+    uint256 sighash;
+    {
+        TRACE_SCOPE(SIGHASH);
+        sighash = sighasher.Input(inputIdx, multisig ? redeem : in.constraintScript(), in.satoshi());
+    }
+    auto sign = [&](const CKey& key, std::vector<unsigned char>& sig)
+    {
+        bool signedOk;
+        {
+            TRACE_SCOPE(SIGN);
+            signedOk = (sigType == SigType::SCHNORR && !multisig) ? key.SignSchnorr(sighash, sig) :
+                                                                       key.SignECDSA(sighash, sig);
+        }
+        if (!signedOk)
+        {
+            printf("signing error");
+            abort();
+        }
+        sig.push_back((unsigned char)sighasher.sighashType);
+    };
+
+    std::vector<unsigned char> sig;
+    sign(in.privKey(), sig);
+    txi.scriptSig.clear();
+    if (in.scriptType() == ScriptType::P2PKH)
+    {
+        txi.scriptSig << sig << ToByteVector(in.pubKey());
+    }
+    else if (multisig)
+    {
+        std::vector<unsigned char> sig2;
+        sign(in.multisigKey(1).priv, sig2);
+        txi.scriptSig << OP_0 << sig << sig2 << ToByteVector(redeem);
+    }
+    else  // P2PK
+    {
+        txi.scriptSig << sig;
+    }
+}
+
+bool createTx(CMutableTransaction& tx, const CoinIter& inStart, const CoinIter& inEnd,
+              CoinIter& outStart, const CoinIter& outEnd, uint64_t fee)
 {
     uint64_t inQty = 0;
+    uint64_t outQty;
     int numSplits = outEnd - outStart;
     int numInputs = inEnd - inStart;
+    int count=0;
 
-    tx.nVersion = CTransaction::CURRENT_VERSION;
-    tx.nLockTime = 0;
+    {
+        TRACE_SCOPE(PREPARE);
+        tx.nVersion = CTransaction::CURRENT_VERSION;
+        tx.nLockTime = 0;
 
-    tx.vin.resize(numInputs);
+        tx.vin.resize(numInputs);
 
-    int count=0;
-    for(auto in = inStart; in != inEnd; in++,count++)
-    {
-        inQty += in->satoshi;
+        for(auto in = inStart; in != inEnd; in++,count++)
+        {
+            inQty += in->satoshi();
 
-        CTxIn& txi = tx.vin[count];
-        txi.prevout = in->prevout;
-        // txi.scriptSig = CScript(); Will be cleared when signature is created
-        txi.nSequence = CTxIn::SEQUENCE_FINAL;
-    }
+            CTxIn& txi = tx.vin[count];
+            txi.prevout = in->prevout();
+            // txi.scriptSig = CScript(); Will be cleared when signature is created
+            txi.nSequence = CTxIn::SEQUENCE_FINAL;
+        }
 
-    if (fee > inQty) return false;
+        if (fee > inQty) return false;
 
-    uint64_t outQty = (inQty-fee)/numSplits;
+        outQty = (inQty-fee)/numSplits;
 
-    if (outQty == 0) return false;
+        if (outQty == 0) return false;
 
-    tx.vout.resize(numSplits);
-    count=0;
-    for(auto out = outStart; out != outEnd; out++,count++)
-    {
-        assert(count<numSplits);
-        CTxOut& txo = tx.vout[count];
-        txo.nValue = outQty;
-        txo.scriptPubKey = out->createP2PKH();
-        out->satoshi = outQty;
-        out->constraintScript = txo.scriptPubKey;
-        out->prevout.n = count;
+        tx.vout.resize(numSplits);
+        count=0;
+        for(auto out = outStart; out != outEnd; out++,count++)
+        {
+            assert(count<numSplits);
+            CTxOut& txo = tx.vout[count];
+            txo.nValue = outQty;
+            txo.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(out->keyID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
     }
 
     // Sign
     int inputIdx=0;
     int sighashtype = SIGHASH_FORKID | SIGHASH_ALL;
 
-    CTransaction ctx = tx;
+    // Keeps its per-shape caches across calls, so one per thread
+    static thread_local SighashEngine sighasher;
+    sighasher.sighashType = sighashtype;
+    {
+        TRACE_SCOPE(SIGHASH);
+        sighasher.Begin(tx);
+    }
     for(auto in = inStart; in != inEnd; in++,inputIdx++)
     {
-        // std::lock_guard<std::mutex> lock(cs);
-        CTxIn& txi = tx.vin[inputIdx];
-
-        size_t nHashedOut = 0;
-        uint256 sighash = SignatureHash(in->constraintScript, ctx, inputIdx, sighashtype, in->satoshi, &nHashedOut);
-        // printf("script: %s\nqty:%lld input:%d\nSigHash: %s\n", HexStr(in->constraintScript.begin(), in->constraintScript.end()).c_str(),  (long long int) in->satoshi, inputIdx, sighash.ToString().c_str());
-        std::vector<unsigned char> sig;
-        if (!in->privKey.SignECDSA(sighash, sig))
-        {
-            printf("signing error");
-            abort();
-        }
-
-        sig.push_back((unsigned char)sighashtype);
-
-        txi.scriptSig.clear();
-        CPubKey pub = in->pubKey();
-        //printf("pubkey: %s\n", HexStr(pub.begin(), pub.end()).c_str());
-        if (in->constraintScript[0] == OP_DUP)  // P2PKH
-        {
-            txi.scriptSig << sig << ToByteVector(pub);
-        }
-        else  // assume P2PK
-        {
-            txi.scriptSig << sig;
-        }
+        signInput(tx, inputIdx, *in, sighasher, gc.sigType);
     }
 
-    uint256 txHash = tx.GetHash();
+    uint256 txHash;
+    {
+        TRACE_SCOPE(TXID);
+        txHash = tx.GetHash();
+    }
     // printf("TX: %s\n", txHash.ToString().c_str());
+    count=0;
     for(auto out = outStart; out != outEnd; out++,count++)
     {
-        out->prevout.hash = txHash;
+        out->Set(txHash, count, outQty);
     }
 
     return true;
@@ -344,29 +695,211 @@ std::string hostFromHostname(string name)
 }
 
 
-static const char TX_MSG[12] = {'t','x',0,0, 0,0,0,0, 0,0,0,0};
-static const char VERACK_MSG[12] = {'v','e','r','a', 'c','k',0,0, 0,0,0,0};
-static const char VER_MSG[12] = {'v','e','r','s', 'i','o','n',0, 0,0,0,0};
+/** The payload of our version message to the node at endpoint.  See VersionPayload for relay */
+std::vector<unsigned char> VersionMessage(const boost::asio::ip::tcp::endpoint& endpoint, bool relay = false)
+{
+    boost::asio::ip::address_v6 addr;
+    if (endpoint.address().is_v4())
+        addr = boost::asio::ip::address_v6::v4_mapped(endpoint.address().to_v4());
+    else
+        addr = endpoint.address().to_v6();
+    auto ip = addr.to_bytes();
+    return VersionPayload(ip.data(), endpoint.port(), GetRand(std::numeric_limits<uint64_t>::max()), GetTime(), relay);
+}
+
+/** The fee a size byte transaction needs to meet a feefilter of satPerKB */
+CAmount FeeForRate(uint64_t satPerKB, uint32_t size) { return (satPerKB * size + 999) / 1000; }
+
+
+
+/** Counters describing how well a connection is keeping up with what we want to send */
+class SendStats
+{
+public:
+    uint64_t msgsQueued = 0;
+    uint64_t bytesSent = 0;
+    uint64_t writeCalls = 0;      // write syscalls issued
+    uint64_t partialWrites = 0;   // writes that took less than we offered
+    uint64_t wouldBlock = 0;      // writes refused because the socket buffer was full
+    uint64_t queueFull = 0;       // times a sender had to wait because the outbound queue was at its bound
+    uint64_t stallNs = 0;         // total time senders spent waiting for queue space
+    uint64_t maxQueued = 0;       // high water mark of the outbound queue in bytes
+    uint64_t bytesRead = 0;
+    uint64_t reconnects = 0;
+    uint64_t msgsDropped = 0;     // partially written messages discarded when the connection was reestablished
+
+    SendStats& operator+=(const SendStats& o)
+    {
+        msgsQueued += o.msgsQueued;
+        bytesSent += o.bytesSent;
+        writeCalls += o.writeCalls;
+        partialWrites += o.partialWrites;
+        wouldBlock += o.wouldBlock;
+        queueFull += o.queueFull;
+        stallNs += o.stallNs;
+        maxQueued = std::max(maxQueued, o.maxQueued);
+        bytesRead += o.bytesRead;
+        reconnects += o.reconnects;
+        msgsDropped += o.msgsDropped;
+        return *this;
+    }
+
+    std::string ToString() const
+    {
+        char buf[400];
+        snprintf(buf, sizeof(buf), "%lu writes (%lu partial, %lu would block), max queue %lu bytes, %lu queue full stalls (%6.3f sec), %lu reconnects, %lu msgs dropped",
+                 writeCalls, partialWrites, wouldBlock, maxQueued, queueFull, ((float)stallNs)/1000000000.0, reconnects, msgsDropped);
+        return buf;
+    }
+};
+
+static const unsigned int P2P_HEADER_SIZE = 4+12+4+4;
+
+/** Lay out a P2P message header for a size byte message called msgname on our network */
+void FormatP2PHeader(unsigned char* header, const char* msgname, uint32_t size)
+{
+    memcpy(&header[0], &gc.msgStart.at(0), 4);  // magic
+    memcpy(&header[4], msgname, 12);  // message command
+    memcpy(&header[4+12], &size, 4);  // message size
 
+    uint32_t checksum = 0;  // checksum can be 0 in BU to mean no checksum
+    memcpy(&header[4+12+4], &checksum, 4);
+}
 
+/** The payload size recorded in a P2P message header */
+uint32_t P2PMsgSize(const unsigned char* header)
+{
+    uint32_t size;
+    memcpy(&size, &header[4+12], 4);
+    return size;
+}
 
-/** An extremely simple bitcoind P2P compatible client*/
+/** An extremely simple bitcoind P2P compatible client.
+    Sends are buffered: messages are appended to a bounded outbound queue that is written to a non-blocking socket
+    whenever it is flushed.  Short writes leave the remainder queued, so a message is never truncated.  The only
+    time a caller blocks is when the queue reaches its bound, and that wait is counted in stats.
+    Connecting does the version handshake.  After that, what the node sends is parsed as it is drained (see
+    P2PReader): pings are answered, and its feefilter and rejects are recorded in inbound.
+    If announcer is set, SendTx announces transactions instead of pushing them, and the node's getdata is answered
+    as it is drained.
+*/
 class SimpleClient
 {
-    unsigned int readCtr=0;
+    std::vector<unsigned char> sendbuf;  // Outbound queue.  Bytes before sendOffset have been written
+    size_t sendOffset = 0;
+    size_t msgBoundary = 0;  // A message start at or before sendOffset
+    unsigned int queuedMsgs = 0;  // Messages queued since the last flush
+    uint64_t oldestQueued = 0;  // Stopwatch time (ns) when the first message since the last flush was queued
+    uint64_t lastDrain = 0;  // Stopwatch time (ns) that we last read from the socket
 public:
     std::string ip;
     boost::asio::io_service ios;
     boost::asio::ip::tcp::endpoint endpoint;
     boost::asio::ip::tcp::socket socket;
-    std::array<char, 2*1024*1024> readbuf;
+    std::vector<char> readbuf;
+    SendBatchPolicy batch;
+    size_t maxQueueBytes;
+    SendStats stats;
+    P2PReader inbound;
+    std::unique_ptr<TxAnnouncer> announcer;  // See Announce
+
+    /** How long connect() waits for the node's side of the handshake */
+    static const int HANDSHAKE_MS = 10000;
+    /** How long closing waits for the node to take what is still queued */
+    static const int CLOSE_DRAIN_MS = 5000;
+    /** How long WaitForPong waits before saying so */
+    static const int PONG_WARN_MS = 10000;
 
     SimpleClient(std::string _ip):ip(_ip), endpoint(boost::asio::ip::address::from_string(hostFromHostname(ip))
-                                           ,portFromHostname(ip, gc.defaultPort)), socket(ios)
+                                           ,portFromHostname(ip, gc.defaultPort)), socket(ios), readbuf(64*1024),
+                                  batch(gc.batch), maxQueueBytes(gc.sendQueueBytes), inbound(gc.msgStart)
     {
+        // Replies can be made from inside Pump, so they are only queued.  They go out with the next write
+        inbound.reply = [this](const char* msgname, const unsigned char* data, uint32_t size) {
+            Append(msgname, (const char*) data, size);
+        };
         connect();
     }
 
+    /** Deliver transactions with inv and getdata instead of tx messages from now on (see TxAnnouncer) */
+    void Announce(const TxAnnouncer::Profile& prof)
+    {
+        announcer.reset(new TxAnnouncer(prof));
+        announcer->send = [this](const char* msgname, const unsigned char* data, uint32_t size) {
+            Append(msgname, (const char*) data, size);  // Safe inside Pump, like replies
+            return true;
+        };
+        inbound.onGetData = [this](const unsigned char* items, uint64_t count) {
+            announcer->GetData(items, count, GetStopwatch());
+        };
+    }
+
+    /** Send a transaction, or announce it if there is an announcer */
+    void SendTx(const uint256& txid, const char* tx, uint32_t size)
+    {
+        if (!announcer)
+        {
+            SendMessage(TX_MSG, tx, size);
+            return;
+        }
+        uint64_t invs = announcer->stats.invs;
+        announcer->Add(txid.begin(), tx, size, GetStopwatch());
+        if (announcer->stats.invs != invs)
+            Flush();
+        else
+            FlushIfDue();
+    }
+
+    /** Announce anything not yet announced, and keep answering getdata until the node has asked for everything or
+        TxAnnouncer::LINGER_MS has passed.  Does nothing without an announcer */
+    void FinishAnnouncing()
+    {
+        if (!announcer) return;
+        uint64_t deadline = GetStopwatch() + TxAnnouncer::LINGER_MS * 1000000ULL;
+        announcer->Flush(GetStopwatch());
+        Flush();
+        while (announcer->Pending() && (GetStopwatch() < deadline))
+        {
+            if (QueueDepth())
+                WaitForSocket(10);
+            else  // Only the node's requests can make progress, so don't spin on a writable socket
+            {
+                struct pollfd pfd;
+                pfd.fd = socket.native_handle();
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, 10) > 0) DrainInbound();
+            }
+            Flush();
+        }
+    }
+
+    ~SimpleClient()
+    {
+        // Best effort to deliver anything still queued, but don't reconnect if the node has gone away, and don't hang
+        // on one that has stopped reading
+        boost::system::error_code error;
+        if ((sendOffset >= sendbuf.size()) || !socket.is_open()) return;
+        socket.non_blocking(true, error);
+        uint64_t deadline = GetStopwatch() + CLOSE_DRAIN_MS * 1000000ULL;
+        while (!error && (sendOffset < sendbuf.size()) && (GetStopwatch() < deadline))
+        {
+            size_t n = socket.write_some(boost::asio::buffer(&sendbuf[sendOffset], sendbuf.size()-sendOffset), error);
+            sendOffset += n;
+            if (error == boost::asio::error::would_block)
+            {
+                error.clear();
+                struct pollfd pfd;
+                pfd.fd = socket.native_handle();
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, 10);
+            }
+        }
+        if (sendOffset < sendbuf.size())
+            printf("%s: %lu queued bytes were not delivered before closing\n", ip.c_str(), (uint64_t) (sendbuf.size() - sendOffset));
+    }
+
     void connect()
     {
         while(1)
@@ -382,302 +915,2874 @@ public:
             sleep(1);
         }
         }
-        //auto VERSION_MSG = ParseHex("dab5bffa76657273696f6e00000000005e0000002ca922277e1101000100000000000000d6d1675d00000000010000000000000000000000000000000000ffff7f0000013bed010000000000000000000000000000000000ffff000000000000ecaff3bf4f09fcf309747847656e3a302e31ffffffff");
-        auto VER_CONTENTS = ParseHex("7e1101000100000000000000d6d1675d00000000010000000000000000000000000000000000ffff7f0000013bed010000000000000000000000000000000000ffff000000000000ecaff3bf4f09fcf309747847656e3a302e31ffffffff");
-        SendMessage(VER_MSG, (char*) &VER_CONTENTS.at(0), VER_CONTENTS.size());
-        // Ack his version message even though we don't look for it
-        SendMessage(VERACK_MSG, nullptr, 0);
-    }
-    
-    void SendMessage(const char* msgname, const char* data, uint32_t size)
-    {
-        unsigned char header[4+12+4+4];
-
-        memcpy(&header[0], &gc.msgStart.at(0), 4);  // magic
-        memcpy(&header[4], msgname, 12);  // message command
-        memcpy(&header[4+12], &size, 4);  // message size
-
-        uint32_t checksum = 0;  // checksum can be 0 in BU to mean no checksum
-        memcpy(&header[4+12+4], &checksum, 4);
-
-        std::array<boost::asio::const_buffer, 2> sendGroup = {
-            boost::asio::const_buffer(header,sizeof(header)),
-            boost::asio::const_buffer(data, size)
-        };
-        
+        // The handshake is written directly (and blocking) so it goes out ahead of anything already queued
         boost::system::error_code error;
-        auto bytesWritten = socket.write_some(sendGroup, error);
-        if (bytesWritten==0)
+        inbound.Reset();
+        auto version = VersionMessage(endpoint);
+        unsigned char header[P2P_HEADER_SIZE];
+        FormatHeader(header, VER_MSG, version.size());
+        boost::asio::write(socket, boost::asio::buffer(header), error);
+        boost::asio::write(socket, boost::asio::buffer(version), error);
+        socket.non_blocking(true, error);
+
+        // Ack the node's version once it arrives, and wait for its ack of ours, since a node ignores (or
+        // disconnects) a peer that sends anything else before the handshake is done
+        uint64_t deadline = GetStopwatch() + HANDSHAKE_MS * 1000000ULL;
+        bool acked = false;
+        while (!(acked && inbound.gotVerack) && (GetStopwatch() < deadline) && socket.is_open())
         {
-            printf("write error: %d\n", error.value());
-            if (error == boost::system::errc::broken_pipe)
+            if (inbound.gotVersion && !acked)
             {
-                socket.close();
-                connect();
+                FormatHeader(header, VERACK_MSG, 0);
+                boost::asio::write(socket, boost::asio::buffer(header), error);
+                acked = true;
+                continue;
             }
+            struct pollfd pfd;
+            pfd.fd = socket.native_handle();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 100) <= 0) continue;
+            size_t len = socket.read_some(boost::asio::buffer(readbuf), error);
+            if ((error == boost::asio::error::would_block)||(error == boost::asio::error::try_again)) continue;
+            if (error || !inbound.Feed(readbuf.data(), len)) break;
+            stats.bytesRead += len;
         }
-
-        // Periodically read some data and dump it because we don't care what the server sends back to us
-        // If we don't do this though, the buffer will eventually fill up and block sends
-        readCtr+=1;
-        if ((readCtr & 0xfff) == 0)
+        if (!acked)
         {
-            boost::system::error_code error;
-            //size_t len =
-            if (socket.available())
-                socket.read_some(boost::asio::buffer(readbuf), error);
-            // printf("dropped %lu received bytes\n", (long unsigned int) len);
+            printf("%s did not complete the handshake, continuing anyway\n", ip.c_str());
+            FormatHeader(header, VERACK_MSG, 0);
+            boost::asio::write(socket, boost::asio::buffer(header), error);
         }
     }
-};
 
-
-/** Get private and public keys for an large array of UTXO objects */
-void calcKeys(vector<UTXO>::iterator st, vector<UTXO>::iterator end)
-{
-    for (auto it=st; it != end; ++it)
+    /** Tear down a failed connection and make a new one.  Any message that was partially written is dropped since
+        the new stream has to start on a message boundary.  Complete messages stay queued. */
+    void reconnect()
     {
-        it->privKey.MakeNewKey(true);
-        // precalculate the public key because we don't care about optimizing this so do it before timing happens
-        it->publicKey = it->privKey.GetPubKey();
+        boost::system::error_code error;
+        socket.close(error);
+        stats.reconnects++;
+
+        advanceBoundary();
+        if (sendOffset > msgBoundary)  // We were part way through a message
+        {
+            msgBoundary += P2P_HEADER_SIZE + msgSize(msgBoundary);
+            stats.msgsDropped++;
+        }
+        sendbuf.erase(sendbuf.begin(), sendbuf.begin() + msgBoundary);
+        sendOffset = 0;
+        msgBoundary = 0;
+
+        connect();
     }
 
-}
+    void FormatHeader(unsigned char* header, const char* msgname, uint32_t size)
+    {
+        FormatP2PHeader(header, msgname, size);
+    }
 
-/** Generate a bunch of P2PKH transactions -- 1 for every entry in the utxo iterator.  It is expected that the txo 
-    iterator contains at least utxoEnd - utxoSt items.
-*/
-void sendP2PKH(SimpleClient& sc, vector<UTXO>::iterator utxoSt, vector<UTXO>::iterator utxoEnd, vector<UTXO>::iterator txo)
-{
-    CMutableTransaction tx;
+    /** Bytes queued but not yet written */
+    size_t QueueDepth() const { return sendbuf.size() - sendOffset; }
 
-    for (auto uit=utxoSt; uit != utxoEnd; ++uit,++txo)
+    /** Queue a message, and send everything queued if the batch policy says its time */
+    void SendMessage(const char* msgname, const char* data, uint32_t size)
     {
-        bool worked = createTx(tx, uit, uit+1, txo, txo+1, gc.fee());
-        if (worked)
+        // Apply backpressure: wait for the socket to take some of the queue
+        if ((QueueDepth() != 0) && (QueueDepth() + P2P_HEADER_SIZE + size > maxQueueBytes))
         {
-            CDataStream serializer(SER_NETWORK, PROTOCOL_VERSION);
-            serializer << tx;
-            sc.SendMessage(TX_MSG, serializer.data(), serializer.size());
+            uint64_t stallStart = GetStopwatch();
+            stats.queueFull++;
+            do
+            {
+                WaitForSocket(100);
+                Pump();
+            } while ((QueueDepth() != 0) && (QueueDepth() + P2P_HEADER_SIZE + size > maxQueueBytes));
+            stats.stallNs += GetStopwatch() - stallStart;
         }
+
+        if (queuedMsgs == 0) oldestQueued = GetStopwatch();
+        Append(msgname, data, size);
+        queuedMsgs++;
+
+        if (((batch.maxCount != 0)&&(queuedMsgs >= batch.maxCount)) ||
+            ((batch.maxBytes != 0)&&(QueueDepth() >= batch.maxBytes)))
+            Flush();
         else
+            FlushIfDue();
+    }
+
+    /** Send queued messages if the oldest has waited longer than the batch policy allows, and keep a backlog
+        draining.  Call this when idle so that a partial batch (or inv) is not held indefinitely. */
+    void FlushIfDue()
+    {
+        if (announcer && announcer->Due(GetStopwatch())) announcer->Flush(GetStopwatch());
+        if (queuedMsgs == 0)
         {
-            printf("UTXO didn't have enough balance\n");
+            Pump();
+            return;
         }
+        if ((batch.maxDelayUs != 0) && ((GetStopwatch()-oldestQueued)/1000 >= batch.maxDelayUs)) Flush();  // 0 is no time limit
     }
 
-}
-
-
-/** A tx generation operation, consisting of sending transactions at a particular rate to a particular node */
-class ScheduleOp
-{
-public:
-    string host;
-    uint64_t rateBegin = 0;
-    uint64_t rateEnd = std::numeric_limits<unsigned long long int>::max();
-    FeeProducer fee;
-
-    void Load(const UniValue& u)
+    /** Write as much of the queue as the socket will take */
+    void Flush()
     {
-        if (u.exists("fee")) fee.set(u["fee"]);
-        else fee = gc.fee;
+        queuedMsgs = 0;
+        Pump();
+    }
 
-        if (u.exists("host")) host = u["host"].get_str();
-        else ConfigException("Mandatory field 'host' is missing");
-        if (u.exists("rate")) rateBegin = u["rate"].get_int64();
-        else ConfigException("Mandatory field 'rate' is missing");
-        if (u.exists("rateEnd")) rateEnd = u["rateEnd"].get_int64();
-        else rateEnd = rateBegin;
+    /** Block until everything queued has been written */
+    void FlushAll()
+    {
+        queuedMsgs = 0;
+        Pump();
+        while (QueueDepth())
+        {
+            WaitForSocket(100);
+            Pump();
+        }
     }
-};
 
-/** A period in the generation schedule, in which we are sending transactions at specific rates to a specific set
-    of nodes 
-*/
-class SchedulePhase
-{
-public:
-    string      name = "unnamed";
+    /** Write queued data until the socket would block, and read whatever the node has sent us */
+    void Pump()
+    {
+        while (sendOffset < sendbuf.size())
+        {
+            boost::system::error_code error;
+            size_t offered = sendbuf.size() - sendOffset;
+            size_t written;
+            {
+                TRACE_SCOPE(WRITE);
+                written = socket.write_some(boost::asio::buffer(&sendbuf[sendOffset], offered), error);
+            }
+            stats.writeCalls++;
+            if ((error == boost::asio::error::would_block)||(error == boost::asio::error::try_again))
+            {
+                stats.wouldBlock++;
+                break;
+            }
+            if (error)
+            {
+                printf("write error to %s: %s, reconnecting\n", ip.c_str(), error.message().c_str());
+                reconnect();
+                continue;
+            }
+            sendOffset += written;
+            stats.bytesSent += written;
+            if (written < offered) stats.partialWrites++;
+        }
+
+        if (sendOffset == sendbuf.size())
+        {
+            sendbuf.clear();  // keeps its capacity so later batches don't allocate
+            sendOffset = 0;
+            msgBoundary = 0;
+        }
+        else if (sendOffset > (1<<20))  // Don't let written data accumulate at the front of a persistent backlog
+        {
+            advanceBoundary();
+            sendbuf.erase(sendbuf.begin(), sendbuf.begin() + msgBoundary);
+            sendOffset -= msgBoundary;
+            msgBoundary = 0;
+        }
+
+        DrainIfDue();
+    }
+
+    /** Write straight from the caller's buffer instead of the queue, for data that is already laid out as complete
+        P2P messages (see TxCorpus).  Anything queued goes first.  Returns the bytes written (0 if the socket would
+        block), or -1 if the connection failed and was reestablished, in which case the caller must resume at its
+        next message boundary. */
+    long WriteDirect(const unsigned char* data, size_t len)
+    {
+        if (QueueDepth())
+        {
+            Pump();
+            if (QueueDepth()) return 0;
+        }
+        boost::system::error_code error;
+        size_t written;
+        {
+            TRACE_SCOPE(WRITE);
+            written = socket.write_some(boost::asio::buffer(data, len), error);
+        }
+        stats.writeCalls++;
+        if ((error == boost::asio::error::would_block)||(error == boost::asio::error::try_again))
+        {
+            stats.wouldBlock++;
+            DrainIfDue();
+            return 0;
+        }
+        if (error)
+        {
+            printf("write error to %s: %s, reconnecting\n", ip.c_str(), error.message().c_str());
+            reconnect();
+            return -1;
+        }
+        stats.bytesSent += written;
+        if (written < len) stats.partialWrites++;
+        DrainIfDue();
+        return written;
+    }
+
+    /** Read and process whatever the node has sent us.  If we don't do this, its buffer will eventually fill up and
+        block sends, and its pings go unanswered.  Once a millisecond keeps up with the node without an extra syscall
+        per message. */
+    void DrainIfDue()
+    {
+        uint64_t now = GetStopwatch();
+        if (now - lastDrain > 1000000)
+        {
+            lastDrain = now;
+            DrainInbound();
+        }
+    }
+
+    /** Read everything available on the socket without blocking */
+    void DrainInbound()
+    {
+        while (1)
+        {
+            boost::system::error_code error;
+            size_t len = socket.read_some(boost::asio::buffer(readbuf), error);
+            if ((error == boost::asio::error::would_block)||(error == boost::asio::error::try_again)) return;
+            if (error)
+            {
+                printf("read error from %s: %s, reconnecting\n", ip.c_str(), error.message().c_str());
+                reconnect();
+                return;
+            }
+            stats.bytesRead += len;
+            if (!inbound.Feed(readbuf.data(), len))
+            {
+                printf("garbled message from %s, reconnecting\n", ip.c_str());
+                reconnect();
+                return;
+            }
+            if (len < readbuf.size()) return;
+        }
+    }
+
+    /** Wait up to timeoutMs for the socket to become writable (or readable, so inbound data can be drained) */
+    void WaitForSocket(int timeoutMs)
+    {
+        struct pollfd pfd;
+        pfd.fd = socket.native_handle();
+        pfd.events = POLLOUT | POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, timeoutMs);
+        if (pfd.revents & POLLIN) DrainInbound();
+    }
+
+    /** Queue a ping and return its nonce.  A node handles each peer's messages in order, so its pong means it has
+        processed everything we sent before the ping (see WaitForPong) */
+    uint64_t Ping()
+    {
+        uint64_t nonce = GetRand(std::numeric_limits<uint64_t>::max() - 1) + 1;  // 0 is lastPong before any pong
+        Append(PING_MSG, (const char*) &nonce, sizeof(nonce));
+        return nonce;
+    }
+
+    /** Send everything queued and block until the node answers the ping that nonce came from.  If the connection
+        is reestablished meanwhile, the ping is sent again */
+    void WaitForPong(uint64_t nonce)
+    {
+        uint64_t reconnects = stats.reconnects;
+        uint64_t start = GetStopwatch();
+        bool warned = false;
+        FlushAll();
+        while (inbound.lastPong != nonce)
+        {
+            if (stats.reconnects != reconnects)
+            {
+                reconnects = stats.reconnects;
+                Append(PING_MSG, (const char*) &nonce, sizeof(nonce));
+                FlushAll();
+            }
+            if (!warned && (GetStopwatch() - start > PONG_WARN_MS * 1000000ULL))
+            {
+                printf("%s: still waiting for the node to process what was sent\n", ip.c_str());
+                warned = true;
+            }
+            struct pollfd pfd;
+            pfd.fd = socket.native_handle();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 100) > 0) DrainInbound();
+        }
+    }
+
+protected:
+    uint32_t msgSize(size_t offset) const { return P2PMsgSize(&sendbuf[offset]); }
+
+    /** Add a message to the end of the queue */
+    void Append(const char* msgname, const char* data, uint32_t size)
+    {
+        TRACE_SCOPE(QUEUE);
+        unsigned char header[P2P_HEADER_SIZE];
+        FormatHeader(header, msgname, size);
+        sendbuf.insert(sendbuf.end(), header, header+sizeof(header));
+        if (size) sendbuf.insert(sendbuf.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+        stats.msgsQueued++;
+        if (QueueDepth() > stats.maxQueued) stats.maxQueued = QueueDepth();
+    }
+
+    /** Move msgBoundary forward over every message that has been completely written */
+    void advanceBoundary()
+    {
+        while ((msgBoundary < sendOffset) && (msgBoundary + P2P_HEADER_SIZE + msgSize(msgBoundary) <= sendOffset))
+            msgBoundary += P2P_HEADER_SIZE + msgSize(msgBoundary);
+    }
+};
+
+
+/** A fixed set of threads, each running its own io_service.  Connections and whatever drives them are spread over
+    the services round robin.  Everything belonging to one target is put on the same service so it is only ever
+    touched by one thread and needs no locks, and the number of connections doesn't depend on the number of threads.
+*/
+class IoPool
+{
+    std::vector<std::unique_ptr<boost::asio::io_service> > services;
+    std::vector<std::unique_ptr<boost::asio::io_service::work> > work;
+    vector<thread> thrds;
+    unsigned int next = 0;
+
+public:
+    IoPool(unsigned int threads)
+    {
+        for (unsigned int i = 0; i < std::max(threads, 1U); i++)
+            services.emplace_back(new boost::asio::io_service());
+    }
+
+    boost::asio::io_service& Next()
+    {
+        boost::asio::io_service& ret = *services[next];
+        next = (next + 1) % services.size();
+        return ret;
+    }
+
+    /** Start running every service on its own thread.  They keep running, even with nothing to do, until Join */
+    void Start()
+    {
+        thrds.reserve(services.size());
+        for (auto& s : services)
+        {
+            boost::asio::io_service* ios = s.get();
+            work.emplace_back(new boost::asio::io_service::work(*ios));
+            unsigned int idx = thrds.size();
+            thrds.push_back(thread([ios, idx] {
+                        Tracer::NameThread("io " + std::to_string(idx));
+                        ios->run();
+                    }));
+        }
+    }
+
+    /** Wait until none of the services has any work left */
+    void Join()
+    {
+        work.clear();
+        for (auto& t : thrds)
+        {
+            t.join();
+        }
+        thrds.clear();
+    }
+
+    void Run()
+    {
+        Start();
+        Join();
+    }
+};
+
+/** A P2P connection that, unlike SimpleClient, never blocks, so one IoPool thread can serve thousands of them.
+    Connecting, writing and reading are asynchronous, and a connection that fails is retried once a second.  Messages
+    sent while a write is in progress are queued and go out together in the next write.  Like SimpleClient, what the
+    node sends is parsed by a P2PReader, and a message that was cut off by a failed connection is dropped rather than
+    resent.  Our verack goes out with our version instead of waiting for the node's, so nothing is held up.  As with
+    SimpleClient, an announcer makes SendTx announce transactions and serve them when the node asks for them.  Only
+    use a peer from its io_service's thread.  Its handlers hold a reference to it, so it is freed once it has been
+    closed and released by its owner.
+*/
+class AsyncPeer : public std::enable_shared_from_this<AsyncPeer>
+{
+    boost::asio::io_service& ios;
+    boost::asio::ip::tcp::endpoint endpoint;
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::steady_timer retry;
+    std::vector<unsigned char> pending;  // Waiting for the write in progress to finish
+    std::vector<unsigned char> writing;  // The write in progress
+    size_t writingHandshake = 0;  // Bytes at the front of writing that are this connection's handshake
+    std::vector<char> readbuf;
+    bool connected = false;
+    bool writeInProgress = false;
+    bool closing = false;  // Close once everything queued is written
+    bool closed = false;
+
+public:
+    std::string ip;
+    size_t maxQueueBytes;
+    SendStats stats;
+    P2PReader inbound;
+    /** Called (on the peer's thread) whenever everything queued has been written */
+    std::function<void()> onDrained;
+    /** Called (on the peer's thread) when the node sends a feefilter */
+    std::function<void(uint64_t satPerKB)> onFeeFilter;
+    bool relay = false;  // Ask the node to announce its transactions to us
+    std::unique_ptr<TxAnnouncer> announcer;  // See Announce
+
+    AsyncPeer(boost::asio::io_service& _ios, const std::string& _ip):ios(_ios),
+        endpoint(boost::asio::ip::address::from_string(hostFromHostname(_ip)), portFromHostname(_ip, gc.defaultPort)),
+        socket(_ios), retry(_ios), readbuf(64*1024), ip(_ip), maxQueueBytes(gc.sendQueueBytes), inbound(gc.msgStart)
+    {
+        inbound.reply = [this](const char* msgname, const unsigned char* data, uint32_t size) {
+            SendMessage(msgname, (const char*) data, size);  // If the queue is full, the node will ping again
+        };
+    }
+
+    boost::asio::io_service& GetIoService() { return ios; }
+
+    /** Bytes queued but not yet written */
+    size_t QueueDepth() const { return pending.size() + writing.size(); }
+
+    /** Is there room to queue a size byte message? */
+    bool HasRoom(uint32_t size) const { return (QueueDepth() == 0) || (QueueDepth() + P2P_HEADER_SIZE + size <= maxQueueBytes); }
+
+    /** Start connecting.  Messages can be queued before the connection is up */
+    void Connect()
+    {
+        auto self = shared_from_this();
+        socket.async_connect(endpoint, [this, self](const boost::system::error_code& error) {
+            if (closed) return;
+            if (error)
+            {
+                if (closing)  // Don't keep retrying just to deliver the leftovers
+                {
+                    Shutdown();
+                    return;
+                }
+                printf("Cannot connect to %s error %s, retrying...\n", ip.c_str(), error.message().c_str());
+                boost::system::error_code ignored;
+                socket.close(ignored);
+                retry.expires_from_now(std::chrono::seconds(1));
+                retry.async_wait([this, self](const boost::system::error_code& e) { if (!e && !closed) Connect(); });
+                return;
+            }
+            connected = true;
+
+            // The handshake goes out ahead of anything already queued
+            inbound.Reset();
+            auto version = VersionMessage(endpoint, relay);
+            std::vector<unsigned char> handshake(2*P2P_HEADER_SIZE + version.size());
+            FormatP2PHeader(&handshake[0], VER_MSG, version.size());
+            memcpy(&handshake[P2P_HEADER_SIZE], version.data(), version.size());
+            FormatP2PHeader(&handshake[P2P_HEADER_SIZE + version.size()], VERACK_MSG, 0);
+            pending.insert(pending.begin(), handshake.begin(), handshake.end());
+            writingHandshake = handshake.size();
+
+            Read();
+            Write();
+        });
+    }
+
+    /** Queue a message to be written as soon as the socket is free.  Returns false, queueing nothing, if the queue is
+        at its bound (see HasRoom) */
+    bool SendMessage(const char* msgname, const char* data, uint32_t size)
+    {
+        if (closing) return false;
+        if (!HasRoom(size))
+        {
+            stats.queueFull++;
+            return false;
+        }
+        {
+            TRACE_SCOPE(QUEUE);
+            size_t pos = pending.size();
+            pending.resize(pos + P2P_HEADER_SIZE + size);
+            FormatP2PHeader(&pending[pos], msgname, size);
+            if (size) memcpy(&pending[pos + P2P_HEADER_SIZE], data, size);
+        }
+        stats.msgsQueued++;
+        if (QueueDepth() > stats.maxQueued) stats.maxQueued = QueueDepth();
+        if (connected && !writeInProgress) Write();
+        return true;
+    }
+
+    /** Deliver transactions with inv and getdata instead of tx messages from now on (see TxAnnouncer).  The caller
+        must send the announcer's invs when they are due */
+    void Announce(const TxAnnouncer::Profile& prof)
+    {
+        announcer.reset(new TxAnnouncer(prof));
+        announcer->send = [this](const char* msgname, const unsigned char* data, uint32_t size) {
+            return SendMessage(msgname, (const char*) data, size);
+        };
+        inbound.onGetData = [this](const unsigned char* items, uint64_t count) {
+            announcer->GetData(items, count, GetStopwatch());
+        };
+    }
+
+    /** Can a size byte transaction be sent (or announced) now?  An announcing peer also needs its pending inv to
+        have been queued, and so to have room for it */
+    bool CanSendTx(uint32_t size)
+    {
+        if (!HasRoom(size)) return false;
+        return !announcer || announcer->Ready(GetStopwatch());
+    }
+
+    /** Send a transaction, or announce it if there is an announcer.  Returns false, doing neither, if the queue is
+        at its bound or a full inv is waiting for room */
+    bool SendTx(const uint256& txid, const char* tx, uint32_t size)
+    {
+        if (!announcer) return SendMessage(TX_MSG, tx, size);
+        if (closing || !HasRoom(size)) return false;  // Keep room to serve it
+        return announcer->Add(txid.begin(), tx, size, GetStopwatch());
+    }
+
+    /** Write what is queued (if the connection is up or being made), then close the connection */
+    void Close()
+    {
+        closing = true;
+        if (QueueDepth() == 0) Shutdown();
+        else if (connected && !writeInProgress) Write();
+        // Otherwise the write in progress, or the connection being made, will get to it
+    }
+
+protected:
+    void Write()
+    {
+        writing.swap(pending);
+        pending.clear();
+        writeInProgress = true;
+        stats.writeCalls++;
+        TRACE_SCOPE(WRITE);  // Asio tries the write straight away, so this is the syscall unless the socket is full
+        auto self = shared_from_this();
+        boost::asio::async_write(socket, boost::asio::buffer(writing), [this, self](const boost::system::error_code& error, size_t written) {
+            writeInProgress = false;
+            stats.bytesSent += written;
+            if (error || !connected)
+            {
+                if (written < writing.size()) stats.partialWrites++;
+                Requeue(written);
+                if (closing) Shutdown();  // Not worth reconnecting for
+                else if (connected)
+                {
+                    printf("write error to %s: %s, reconnecting\n", ip.c_str(), error.message().c_str());
+                    Reconnect();
+                }
+                else Connect();  // Reconnect() was waiting for this write to finish
+                return;
+            }
+            writing.clear();
+            writingHandshake = 0;
+            if (!pending.empty()) Write();
+            else if (closing) Shutdown();
+            else if (onDrained) onDrained();
+        });
+    }
+
+    /** Put what a failed write didn't send back at the front of the queue, minus any message that was cut off and the
+        old handshake (the next connection makes its own) */
+    void Requeue(size_t written)
+    {
+        size_t boundary = writingHandshake;
+        while ((boundary < writing.size()) && (boundary + P2P_HEADER_SIZE + P2PMsgSize(&writing[boundary]) <= written))
+            boundary += P2P_HEADER_SIZE + P2PMsgSize(&writing[boundary]);
+        if ((written > boundary) && (boundary < writing.size()))
+        {
+            boundary += P2P_HEADER_SIZE + P2PMsgSize(&writing[boundary]);
+            stats.msgsDropped++;
+        }
+        if (boundary < writing.size()) pending.insert(pending.begin(), writing.begin() + boundary, writing.end());
+        writing.clear();
+        writingHandshake = 0;
+    }
+
+    /** Read and process whatever the node sends, so that its pings are answered and its send buffer never fills up
+        and stalls it */
+    void Read()
+    {
+        auto self = shared_from_this();
+        socket.async_read_some(boost::asio::buffer(readbuf), [this, self](const boost::system::error_code& error, size_t len) {
+            if (error)
+            {
+                // operation_aborted means we closed the socket ourselves
+                if ((error != boost::asio::error::operation_aborted) && connected && !closing)
+                {
+                    printf("read error from %s: %s, reconnecting\n", ip.c_str(), error.message().c_str());
+                    Reconnect();
+                }
+                return;
+            }
+            stats.bytesRead += len;
+            uint64_t feeFilter = inbound.stats.feeFilter;
+            if (!inbound.Feed(readbuf.data(), len))
+            {
+                if (!closing)
+                {
+                    printf("garbled message from %s, reconnecting\n", ip.c_str());
+                    Reconnect();
+                }
+                return;
+            }
+            if ((inbound.stats.feeFilter != feeFilter) && onFeeFilter) onFeeFilter(inbound.stats.feeFilter);
+            Read();
+        });
+    }
+
+    void Reconnect()
+    {
+        connected = false;
+        stats.reconnects++;
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        if (!writeInProgress) Connect();  // Otherwise the write's handler does it once it has requeued what it can
+    }
+
+    void Shutdown()
+    {
+        connected = false;
+        closed = true;
+        retry.cancel();
+        boost::system::error_code ignored;
+        socket.close(ignored);
+    }
+};
+
+
+/** Times how long nodes take to accept and relay what we send.  It keeps a connection, with relay on, to each of
+    gc.observers and times every announcement (inv) of a transaction we sent from when we sent it.  If the announcing
+    node is the one the transaction was sent to, that is its acceptance latency, otherwise its propagation latency.
+    Latencies are kept per phase and per observed node.
+*/
+class LatencyObserver
+{
+public:
+    /** Latencies of one phase's transactions as announced by one node (microseconds) */
+    class Latencies
+    {
+    public:
+        LatencyHistogram accepted;  // It was sent to this node
+        LatencyHistogram relayed;  // It was sent to some other node
+    };
+
+    /** Running totals of the acceptance latencies of one target's transactions, for the target to watch as it runs */
+    class Echoes
+    {
+    public:
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> totalUs{0};
+    };
+
+protected:
+    SentTxTracker sent;
+    IoPool pool;
+    std::vector<std::shared_ptr<AsyncPeer> > peers;
+    std::vector<uint16_t> peerHost;  // Index into hosts of each peer's node
+    std::vector<std::vector<Latencies> > latencies;  // [peer][phase].  Only touched by pool's thread until Stop()
+    std::mutex cs;  // Guards phases and hosts
+    std::vector<string> phases;
+    std::vector<string> hosts;
+    std::map<uint32_t, std::shared_ptr<Echoes> > watched;  // By phase << 16 | target.  Guarded by cs
+    std::atomic<bool> watching{false};
+
+    static uint16_t IndexOf(std::vector<string>& names, const string& name)
+    {
+        auto it = std::find(names.begin(), names.end(), name);
+        if (it != names.end()) return it - names.begin();
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    /** host with the port filled in, so that the same node is always called the same thing */
+    static string Canonical(const string& host)
+    {
+        return hostFromHostname(host) + ":" + std::to_string(portFromHostname(host, gc.defaultPort));
+    }
+
+    void Announced(unsigned int peer, const unsigned char* txid)
+    {
+        SentTxTracker::Sent s;
+        if (!sent.Find(txid, s)) return;
+        uint64_t now = GetStopwatch();
+        uint64_t us = (now > s.stopwatch) ? (now - s.stopwatch) / 1000 : 0;
+        auto& l = latencies[peer];
+        if (l.size() <= s.phase) l.resize(s.phase + 1);
+        if (s.target == peerHost[peer])
+        {
+            l[s.phase].accepted.Record(us);
+            if (watching.load(std::memory_order_relaxed))
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                auto it = watched.find(((uint32_t)s.phase << 16) | s.target);
+                if (it != watched.end())
+                {
+                    it->second->count++;
+                    it->second->totalUs += us;
+                }
+            }
+        }
+        else
+            l[s.phase].relayed.Record(us);
+    }
+
+public:
+    LatencyObserver(const std::vector<string>& nodes, unsigned int sample)
+        : sent(sample, gc.observeMaxSec * 1000000000ULL), pool(1)
+    {
+        latencies.resize(nodes.size());
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            peerHost.push_back(IndexOf(hosts, Canonical(nodes[i])));
+            peers.push_back(std::make_shared<AsyncPeer>(pool.Next(), nodes[i]));
+            peers.back()->relay = true;
+            peers.back()->inbound.onTxInv = [this, i](const unsigned char* txid) { Announced(i, txid); };
+        }
+    }
+
+    /** Connect to the observed nodes, and start timing */
+    void Start()
+    {
+        for (auto& p : peers) p->Connect();
+        pool.Start();
+    }
+
+    /** A Sent to fill in for each transaction a target of phase sends to host.  Thread safe */
+    SentTxTracker::Sent Tag(const string& phase, const string& host)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        SentTxTracker::Sent ret;
+        ret.stopwatch = 0;
+        ret.phase = IndexOf(phases, phase);
+        ret.target = IndexOf(hosts, Canonical(host));
+        return ret;
+    }
+
+    /** Acceptance latencies of the transactions sent with tag, as they are observed.  Thread safe */
+    std::shared_ptr<Echoes> Watch(const SentTxTracker::Sent& tag)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        auto& e = watched[((uint32_t)tag.phase << 16) | tag.target];
+        if (!e) e = std::make_shared<Echoes>();
+        watching = true;
+        return e;
+    }
+
+    /** Record that txid was sent at stopwatch time now by the target tag was made for.  Thread safe */
+    void Sent(const uint256& txid, SentTxTracker::Sent tag, uint64_t now)
+    {
+        tag.stopwatch = now;
+        sent.Add(txid.begin(), tag);
+    }
+
+    /** Keep listening for linger seconds, for the announcements of the last transactions sent, then disconnect */
+    void Stop(unsigned int linger)
+    {
+        sleep(linger);
+        for (auto& p : peers)
+        {
+            auto peer = p;
+            peer->GetIoService().post([peer] { peer->inbound.onTxInv = nullptr; peer->Close(); });
+        }
+        pool.Join();
+    }
+
+    /** Print percentiles of the latencies of each phase at each node */
+    void Report()
+    {
+        auto ms = [](uint64_t us) { return us / 1000.0; };
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: latency of %lu tracked transactions, in ms (%lu more were forgotten %u sec after they were sent)\n", now.c_str(), sent.Size(), sent.Forgotten(), gc.observeMaxSec);
+        for (unsigned int i = 0; i < peers.size(); i++)
+        {
+            for (unsigned int ph = 0; ph < latencies[i].size(); ph++)
+            {
+                const Latencies& l = latencies[i][ph];
+                const LatencyHistogram* hists[2] = { &l.accepted, &l.relayed };
+                const char* kinds[2] = { "acceptance", "propagation" };
+                for (unsigned int k = 0; k < 2; k++)
+                {
+                    const LatencyHistogram& h = *hists[k];
+                    if (h.Count() == 0) continue;
+                    printf("%s: %s at %s %s: %lu seen, p50 %.1f p99 %.1f p999 %.1f max %.1f\n", now.c_str(),
+                           phases[ph].c_str(), peers[i]->ip.c_str(), kinds[k], h.Count(), ms(h.Percentile(0.5)),
+                           ms(h.Percentile(0.99)), ms(h.Percentile(0.999)), ms(h.Max()));
+                }
+            }
+        }
+    }
+};
+
+/** Set while a LatencyObserver is running, so that senders record what they send */
+LatencyObserver* latency = nullptr;
+
+/** Set while a MetricsExporter is running, so that targets publish their counters */
+MetricsRegistry* liveMetrics = nullptr;
+
+/** Publish what a target's sender keeps track of: what it has sent, where its pacer is, and its connections' stats */
+void PublishSender(TargetMetrics& m, uint64_t txs, const Pacer& pacer, uint64_t now, const SendStats& s,
+                   uint64_t queued)
+{
+    TargetMetrics::Set(m.txs, txs);
+    TargetMetrics::Set(m.skipped, pacer.skipped);
+    m.targetRate.store(pacer.Rate(now), std::memory_order_relaxed);
+    TargetMetrics::Set(m.bytesSent, s.bytesSent);
+    TargetMetrics::Set(m.writeCalls, s.writeCalls);
+    TargetMetrics::Set(m.partialWrites, s.partialWrites);
+    TargetMetrics::Set(m.reconnects, s.reconnects);
+    TargetMetrics::Set(m.queueFull, s.queueFull);
+    TargetMetrics::Set(m.stallNs, s.stallNs);
+    TargetMetrics::Set(m.queuedBytes, queued);
+}
+
+/** Exports live metrics while a schedule runs.  Once a second it samples every target's counters, appends them as a
+    JSON line to gc.metricsLog, and keeps the latest sample to serve in Prometheus text format to anyone who
+    connects to 127.0.0.1:gc.metricsPort.  It does all of this on a thread of its own, so senders only ever store
+    their counters.  Does nothing if neither is configured.
+*/
+class MetricsExporter
+{
+    static const unsigned int SAMPLE_MS = 1000;
+
+    MetricsRegistry registry;
+    boost::asio::io_service ios;
+    boost::asio::steady_timer timer;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+    FILE* log = nullptr;
+    std::string page;  // The latest sample in Prometheus format
+    std::thread thrd;
+
+    void Sample()
+    {
+        registry.Sample(GetStopwatch(), GetTimeMillis());
+        page = registry.Prometheus();
+        if (log)
+        {
+            fprintf(log, "%s\n", registry.JsonLine().c_str());
+            fflush(log);
+        }
+    }
+
+    void Tick()
+    {
+        timer.expires_from_now(std::chrono::milliseconds(SAMPLE_MS));
+        timer.async_wait([this](const boost::system::error_code& e) {
+                if (e) return;
+                Sample();
+                Tick();
+            });
+    }
+
+    /** Answer each connection with the latest sample, whatever it asks for */
+    void Accept()
+    {
+        auto sock = std::make_shared<boost::asio::ip::tcp::socket>(ios);
+        acceptor->async_accept(*sock, [this, sock](const boost::system::error_code& e) {
+                if (e) return;
+                Accept();
+                auto request = std::make_shared<std::vector<char> >(4096);
+                sock->async_read_some(boost::asio::buffer(*request),
+                                      [this, sock, request](const boost::system::error_code& e, size_t) {
+                        if (e) return;
+                        auto response = std::make_shared<std::string>(
+                            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                            std::to_string(page.size()) + "\r\nConnection: close\r\n\r\n" + page);
+                        boost::asio::async_write(*sock, boost::asio::buffer(*response),
+                                                 [sock, response](const boost::system::error_code&, size_t) {
+                                boost::system::error_code ignored;
+                                sock->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                                sock->close(ignored);
+                            });
+                    });
+            });
+    }
+
+public:
+    MetricsExporter() : timer(ios)
+    {
+        if ((gc.metricsPort == 0) && gc.metricsLog.empty()) return;
+        if (!gc.metricsLog.empty() && !(log = fopen(gc.metricsLog.c_str(), "a")))
+            printf("Cannot open metrics log %s: %s\n", gc.metricsLog.c_str(), strerror(errno));
+        if (gc.metricsPort)
+        {
+            try
+            {
+                boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address::from_string("127.0.0.1"), gc.metricsPort);
+                acceptor.reset(new boost::asio::ip::tcp::acceptor(ios, ep));
+                Accept();
+                printf("serving metrics on http://127.0.0.1:%u/metrics\n", gc.metricsPort);
+            }
+            catch (boost::system::system_error& e)
+            {
+                printf("Cannot serve metrics on port %u: %s\n", gc.metricsPort, e.what());
+                acceptor.reset();
+            }
+        }
+        liveMetrics = &registry;
+        Tick();
+        thrd = std::thread([this] { ios.run(); });
+    }
+
+    /** Log a last sample, with every target's final counts, and stop */
+    ~MetricsExporter()
+    {
+        if (!thrd.joinable()) return;
+        liveMetrics = nullptr;
+        ios.post([this] {
+                Sample();
+                timer.cancel();
+                boost::system::error_code ignored;
+                if (acceptor) acceptor->close(ignored);
+                ios.stop();  // Connections still waiting for a request would otherwise keep it running
+            });
+        thrd.join();
+        if (log) fclose(log);
+    }
+};
+
+/** Assign keys to a range of coins, round robin from the key ring */
+void calcKeys(CoinIter st, CoinIter end)
+{
+    for (auto it=st; it != end; ++it)
+    {
+        it->SetKey(keyRing.Next());
+    }
+}
+
+/** The hot path transaction: spend 1 P2PKH coin to 1 P2PKH coin.  Splitting uses the generic createTx */
+typedef TxTemplate<1, 1, P2PKHScript> P2PKHSpend;
+/** Signers build up to HASH_BATCH_MAX hot path transactions at once (see hashBatch) so their hashes share SIMD lanes */
+static const unsigned int HASH_BATCH_MAX = 16;
+typedef TxTemplateBatch<1, 1, P2PKHScript, HASH_BATCH_MAX> P2PKHSpendBatch;
+
+/** A Schnorr signer for the calling thread if sigType asks for one, otherwise null (sign with ECDSA) */
+std::unique_ptr<SchnorrSigner> MakeSigner(SigType sigType)
+{
+    if (sigType != SigType::SCHNORR) return nullptr;
+    return std::unique_ptr<SchnorrSigner>(new SchnorrSigner(gc.noncePool));
+}
+
+/** Idle senders wake at least this often (ns) so that partial batches get flushed and inbound data drained */
+static const uint64_t MAX_IDLE_NS = 1000000;
+
+/** Wait until (unix) time start, using the wait to fill the signer's nonce pool if there is one */
+void WaitForStart(uint64_t start, SchnorrSigner* signer)
+{
+    uint64_t startNs = Pacer::StopwatchAt(start);
+    if (signer) signer->PrecomputeUntil(startNs);
+    uint64_t now = GetStopwatch();
+    if (startNs > now)
+    {
+        struct timespec ts;
+        ts.tv_sec = (startNs - now) / 1000000000ULL;
+        ts.tv_nsec = (startNs - now) % 1000000000ULL;
+        nanosleep(&ts, nullptr);
+    }
+}
+
+/** Generate a bunch of P2PKH transactions -- 1 for every coin in the range.  Each coin's slot is recycled to hold
+    the output that spends it.
+*/
+void sendP2PKH(SimpleClient& sc, CoinIter utxoSt, CoinIter utxoEnd)
+{
+    P2PKHSpendBatch batch;
+    std::unique_ptr<SchnorrSigner> signer = MakeSigner(gc.sigType);
+    batch.UseSchnorr(signer.get());
+    FeeProducer fee = gc.fee;  // Each thread draws from its own copy
+    fee.Reseed();
+
+    for (auto uit=utxoSt; uit != utxoEnd;)
+    {
+        unsigned int n = std::min((long int) gc.hashBatch, (long int) (utxoEnd - uit));
+        n = batch.Build(uit, uit, n, fee);
+        uit += n;
+        for (unsigned int j = 0; j < n; j++)
+        {
+            if (batch.ok[j])
+            {
+                sc.SendMessage(TX_MSG, batch.txs[j].data(), batch.txs[j].size());
+            }
+            else
+            {
+                printf("UTXO didn't have enough balance or isn't compressed P2PKH\n");
+            }
+        }
+    }
+    sc.FlushAll();
+}
+
+
+/** A tx generation operation, consisting of sending transactions at a particular rate to a particular node */
+class ScheduleOp
+{
+public:
+    string host;
+    uint64_t rateBegin = 0;
+    uint64_t rateEnd = std::numeric_limits<unsigned long long int>::max();
+    FeeProducer fee;
+    unsigned int signers = 0;
+    unsigned int connections = 1;
+    SendBatchPolicy batch;
+    SigType sigType = SigType::ECDSA;
+    Pacer::Profile pace;
+    Saturator::Profile saturate;
+    TxAnnouncer::Profile announce;
+    std::shared_ptr<const WorkloadMix> workload;
+
+    void Load(const UniValue& u)
+    {
+        if (u.exists("sigType")) sigType = LoadSigType(u["sigType"]);
+        else sigType = gc.sigType;
+
+        pace = gc.pace;
+        if (u.exists("pace")) LoadPace(pace, u["pace"]);
+
+        saturate = gc.saturate;
+        if (u.exists("saturate")) LoadSaturate(saturate, u["saturate"]);
+
+        announce = gc.announce;
+        if (u.exists("announce")) LoadAnnounce(announce, u["announce"]);
+
+        batch = gc.batch;
+        if (u.exists("batch")) batch.Load(u["batch"]);
+
+        if (u.exists("fee")) fee.set(u["fee"]);
+        else fee = gc.fee;
+
+        if (u.exists("signers")) signers = u["signers"].get_int64();
+        else signers = gc.signers;
+
+        workload = gc.workload;
+        if (u.exists("workload")) workload = LoadWorkload(u["workload"]);
+        if (workload && (signers == 0)) signers = 1;  // Mixes are only built by signer threads
+
+        if (u.exists("connections")) connections = u["connections"].get_int64();
+        else connections = gc.connections;
+
+        if (u.exists("host")) host = u["host"].get_str();
+        else ConfigException("Mandatory field 'host' is missing");
+        if (u.exists("rate")) rateBegin = u["rate"].get_int64();
+        else ConfigException("Mandatory field 'rate' is missing");
+        if (u.exists("rateEnd")) rateEnd = u["rateEnd"].get_int64();
+        else rateEnd = rateBegin;
+    }
+
+    /** The highest rate a saturating target may try: rateEnd, if it was given */
+    double MaxRate() const { return (rateEnd > rateBegin) ? rateEnd : std::numeric_limits<double>::infinity(); }
+};
+
+/** Sets a target's rate with a Saturator, if the target has "saturate" set.  Otherwise does nothing */
+class RateProbe
+{
+    std::unique_ptr<Saturator> sat;
+    std::shared_ptr<LatencyObserver::Echoes> echoes;
+    string title;
+
+public:
+    /** Take over pacer's rate at stopwatch time now.  tag is the target's, or null if its transactions aren't timed */
+    void Start(const string& name, const ScheduleOp& op, const SentTxTracker::Sent* tag, Pacer& pacer, uint64_t now)
+    {
+        if (!op.saturate.enabled) return;
+        title = name + " to " + op.host;
+        sat.reset(new Saturator(op.saturate, op.rateBegin, op.MaxRate(), now));
+        pacer.SetRate(now, sat->Rate());
+        if (latency && tag) echoes = latency->Watch(*tag);
+    }
+
+    bool Due(uint64_t now) const { return sat && sat->Due(now); }
+
+    /** Judge how the node is keeping up from the target's counters, and move the pacer to a new rate if it is time */
+    void Update(Pacer& pacer, uint64_t now, uint64_t sent, const SendStats& s, uint64_t queued, const InboundStats& in)
+    {
+        Saturator::Signals sig;
+        sig.sent = sent;
+        sig.queuedBytes = queued;
+        sig.stallNs = s.stallNs;
+        sig.writeCalls = s.writeCalls;
+        sig.wouldBlock = s.wouldBlock;
+        sig.rejects = in.rejects;
+        if (echoes)
+        {
+            sig.echoes = echoes->count.load(std::memory_order_relaxed);
+            sig.echoUs = echoes->totalUs.load(std::memory_order_relaxed);
+        }
+        size_t steps = sat->curve.size();
+        double was = sat->Rate();
+        if (sat->Update(now, sig)) pacer.SetRate(now, sat->Rate());
+        if (sat->curve.size() > steps)
+        {
+            const Saturator::Step& st = sat->curve.back();
+            auto date = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+            printf("%s: %s: %.0f tps (%.0f achieved) %s, now %.0f tps\n", date.c_str(), title.c_str(), was, st.tps,
+                   Saturator::VerdictName(st.verdict), sat->Rate());
+        }
+    }
+
+    /** Print the rate against latency curve, and the highest sustainable rate */
+    void Report() const
+    {
+        if (!sat) return;
+        auto date = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        sat->Report(date + ": " + title);
+    }
+};
+
+/** A period in the generation schedule, in which we are sending transactions at specific rates to a specific set
+    of nodes 
+*/
+class SchedulePhase
+{
+public:
+    string      name = "unnamed";
     uint64_t    startTime = 0;
     uint64_t    endTime = 0;
     vector<ScheduleOp> targets;
 
-    uint64_t LoadATime(const UniValue& u, const string& fieldName)
+    uint64_t LoadATime(const UniValue& u, const string& fieldName)
+    {
+        uint64_t ret;
+        if (u.exists(fieldName))
+        {
+            ret = u[fieldName].get_int64();
+            if (ret < 1567000000)
+            {
+                ret = ret + GetTime();
+            }
+            return ret;
+        }
+
+        throw ConfigException("Mandatory field '" + fieldName + "' does not exist in " + name);
+    }
+
+    void Load(const UniValue& u)
+    {
+        if (u.exists("name")) name = u["name"].get_str();
+        startTime = LoadATime(u, "start");
+        endTime = LoadATime(u, "end");
+
+        if (!u.exists("targets")) throw ConfigException("No 'targets' of schedule " + name + "defined");
+
+        UniValue utargets = u["targets"];
+        targets.resize(utargets.size());
+        for(unsigned int idx=0; idx < utargets.size(); idx++)
+        {
+            const UniValue& utgt = utargets[idx];
+            targets[idx].Load(utgt);
+        }
+    }
+};
+
+
+/** A signed transaction on its way from a signer to the sender */
+class SignedTx
+{
+public:
+    std::vector<char> msg;  // Serialized
+    uint256 txid;
+};
+
+/** Transactions waiting to be sent.  They are swapped through the ring so their buffers get reused */
+typedef LockFreeRing<SignedTx> TxMsgRing;
+
+/** Counters shared by the signer threads of one target */
+class SignerStats
+{
+public:
+    std::atomic<uint64_t> ringFull{0};  // Times a signer had to wait for the sender
+    std::atomic<uint64_t> nonceMisses{0};
+    std::atomic<uint64_t> fresh{0};  // Coins spent that had not been spent before
+    std::atomic<uint64_t> chained{0};  // Coins spent that were outputs of this target's earlier transactions
+    std::atomic<CAmount> feeFloor{0};  // Set by the sender to meet the node's feefilter
+    std::atomic<uint64_t> built{0};  // Transactions signed
+    std::atomic<uint64_t> signNs{0};  // Time spent signing them
+    std::mutex mixLock;
+    MixStats mix;  // What each shape of the target's workload made, added in by each signer as it finishes
+    std::atomic<unsigned int> exited{0};  // Signers that have finished
+    /** Set before the signers start if the sender sends everything they signed, even after done is set, so that
+        no coin is left recording an output the node never got (see saveFinalCoins) */
+    bool drainOnDone = false;
+};
+
+/** Publish what a target's signers have done.  Signed transactions that haven't been sent are waiting in its ring */
+void PublishSigners(TargetMetrics& m, const SignerStats& s, uint64_t txs)
+{
+    uint64_t built = s.built;
+    TargetMetrics::Set(m.built, built);
+    TargetMetrics::Set(m.signNs, s.signNs);
+    TargetMetrics::Set(m.ringDepth, (built > txs) ? built - txs : 0);
+}
+
+/** Builds transactions of the shapes in a WorkloadMix from one spender's coins.  Inputs are taken from its cache a
+    slot at a time.  Outputs are written back into the slots of the coins they spent and, when there are more outputs
+    than inputs, into slots a consolidation emptied earlier, so the pool never grows.  An emptied slot has no value;
+    the spender keeps it as a spare for the next fan-out, and skips it whenever the cache hands it out as a coin.
+    Only the owning thread may use it. */
+class MixBuilder
+{
+public:
+    /** Outputs are never made smaller than this, so a fan-out is trimmed if its coins can't pay for all of them */
+    static const uint64_t MIN_OUTPUT = 546;
+    /** The most emptied slots kept for reuse.  Beyond this they are just left empty */
+    static const size_t MAX_SPARE = 4096;
+
+    const WorkloadMix& mix;
+    MixStats stats;
+
+protected:
+    std::mt19937_64 rng;
+    WorkloadMix::Draw draw;
+    CMutableTransaction tx;
+    CDataStream ss;
+    std::vector<CoinIter> ins;
+    std::vector<CoinIter> outs;
+    std::vector<ScriptType> outTypes;
+    std::vector<CoinIter> spare;  // Slots emptied by consolidations
+    std::vector<unsigned char> data;  // OP_RETURN payload
+    SighashEngine sighasher;
+
+    /** Take up to want distinct coins with value from cache into ins */
+    void Gather(CoinDispenser::Cache& cache, unsigned int want)
+    {
+        ins.clear();
+        uint64_t tries = cache.Owned() + want;
+        while ((ins.size() < want) && tries--)
+        {
+            CoinIter it(nullptr, 0);
+            if (cache.Take(1, it) == 0) return;
+            if (it->satoshi() == 0) continue;  // An emptied slot
+            // Going around our own slots again means we have fewer coins than the shape wants
+            if (std::find(ins.begin(), ins.end(), it) != ins.end()) return;
+            ins.push_back(it);
+        }
+    }
+
+    /** Empty a slot whose coin was spent without an output replacing it, and keep it for reuse */
+    void Empty(CoinIter& it)
+    {
+        it->Set(uint256(), 0, 0);
+        if (spare.size() < MAX_SPARE) spare.push_back(it);
+    }
+
+public:
+    MixBuilder(const WorkloadMix& m) : mix(m), rng(std::random_device()()), ss(SER_NETWORK, PROTOCOL_VERSION)
+    {
+        stats.Resize(mix.shapes.size());
+        sighasher.sighashType = SIGHASH_FORKID | SIGHASH_ALL;
+    }
+
+    /** Draw a shape and build, sign and serialize a transaction of it into out, spending coins from cache.  fee is
+        for a P2PKHSpend sized transaction and is scaled to this one's size.  Returns false if the coins couldn't
+        pay for it, and sets empty if the cache has no coins at all */
+    bool Build(CoinDispenser::Cache& cache, FeeProducer& fee, SigType sigType, SignedTx& out, bool& empty)
+    {
+        mix.Pick(rng, draw);
+        {
+            TRACE_SCOPE(COINS);
+            Gather(cache, draw.inputs);
+        }
+        empty = ins.empty();
+        if (empty) return false;
+        MixStats::PerShape& st = stats.shapes[draw.shape];
+
+        uint64_t inQty = 0;
+        uint64_t size = WorkloadMix::TX_OVERHEAD;
+        for (auto& in : ins)
+        {
+            inQty += in->satoshi();
+            size += WorkloadMix::MaxInputSize(in->scriptType());
+        }
+        // Outputs go in the inputs' slots, then in spare ones
+        unsigned int nOut = std::min((size_t)draw.outputs, ins.size() + spare.size());
+        outTypes.resize(nOut);
+        for (unsigned int i = 0; i < nOut; i++)
+        {
+            outTypes[i] = mix.PickScript(rng);
+            size += WorkloadMix::OutputSize(outTypes[i]);
+        }
+        if (draw.opReturn) size += WorkloadMix::OP_RETURN_OUTPUT + draw.opReturn;
+
+        uint64_t txFee = fee() * size / P2PKHSpend::MAX_SIZE;
+        if (inQty <= txFee + MIN_OUTPUT)
+        {
+            stats.failures++;
+            return false;
+        }
+        nOut = std::min((uint64_t)nOut, (inQty - txFee) / MIN_OUTPUT);
+        uint64_t outQty = (inQty - txFee) / nOut;
+        if (nOut < draw.outputs) st.trimmed++;
+
+        outs.clear();
+        for (unsigned int i = 0; (i < ins.size()) && (outs.size() < nOut); i++) outs.push_back(ins[i]);
+        while (outs.size() < nOut)
+        {
+            outs.push_back(spare.back());
+            spare.pop_back();
+        }
+
+        {
+            TRACE_SCOPE(PREPARE);
+            tx.nVersion = CTransaction::CURRENT_VERSION;
+            tx.nLockTime = 0;
+            tx.vin.resize(ins.size());
+            for (size_t i = 0; i < ins.size(); i++)
+            {
+                tx.vin[i].prevout = ins[i]->prevout();
+                tx.vin[i].nSequence = CTxIn::SEQUENCE_FINAL;
+            }
+            tx.vout.resize(nOut + (draw.opReturn ? 1 : 0));
+            for (unsigned int i = 0; i < nOut; i++)
+            {
+                tx.vout[i].nValue = outQty;
+                tx.vout[i].scriptPubKey = outs[i]->constraintScript(outTypes[i]);
+            }
+            if (draw.opReturn)
+            {
+                data.resize(draw.opReturn);
+                for (auto& b : data) b = rng();
+                tx.vout[nOut].nValue = 0;
+                tx.vout[nOut].scriptPubKey = CScript() << OP_RETURN << data;
+            }
+        }
+
+        {
+            TRACE_SCOPE(SIGHASH);
+            sighasher.Begin(tx);
+        }
+        for (size_t i = 0; i < ins.size(); i++) signInput(tx, i, *ins[i], sighasher, sigType);
+
+        {
+            TRACE_SCOPE(SERIALIZE);
+            ss.clear();
+            ss << tx;
+            out.msg.assign(ss.begin(), ss.end());
+        }
+        {
+            TRACE_SCOPE(TXID);
+            CHash256().Write((const unsigned char*)out.msg.data(), out.msg.size()).Finalize(out.txid.begin());
+        }
+
+        for (unsigned int i = 0; i < nOut; i++) outs[i]->Set(out.txid, i, outQty, outTypes[i]);
+        for (size_t i = nOut; i < ins.size(); i++) Empty(ins[i]);
+
+        st.txs++;
+        st.bytes += out.msg.size();
+        st.inputs += ins.size();
+        st.outputs += nOut;
+        return true;
+    }
+};
+
+/** Wait until stx fits on the ring, precomputing Schnorr nonces meanwhile.  Gives up if done is set, unless the
+    sender is draining the ring */
+void PushSigned(TxMsgRing& ring, SignedTx& stx, std::atomic<bool>& done, SignerStats& stats, SchnorrSigner* signer)
+{
+    TRACE_SCOPE(RING);
+    // The sender is behind (or the pacer is holding it back), so wait for space
+    while (!ring.push(stx))
+    {
+        if (done.load(std::memory_order_relaxed) && !stats.drainOnDone) break;
+        stats.ringFull++;
+        if (signer && !signer->Full())
+            signer->Precompute(4);
+        else
+            usleep(100);
+    }
+}
+
+/** Like SignTxs, but building the shapes of a workload mix (see MixBuilder) */
+void SignMixTxs(const WorkloadMix& mix, FeeProducer fee, SigType sigType, uint64_t start, CoinDispenser& coins,
+                TxMsgRing& ring, std::atomic<bool>& done, SignerStats& stats)
+{
+    MixBuilder builder(mix);
+    SignedTx stx;
+    CoinDispenser::Cache& cache = coins.NewCache();
+    Tracer::NameThread("signer");
+
+    WaitForStart(start, nullptr);
+
+    uint64_t failures = 0;  // Draws in a row that couldn't be paid for; once that is all the coins, give up
+    while (!done.load(std::memory_order_relaxed))
+    {
+        fee.SetFloor(stats.feeFloor.load(std::memory_order_relaxed));
+        bool empty;
+        uint64_t buildStart = GetStopwatch();
+        bool ok = builder.Build(cache, fee, sigType, stx, empty);
+        stats.signNs.fetch_add(GetStopwatch() - buildStart, std::memory_order_relaxed);
+        if (empty)
+        {
+            printf("A signer has no coins to spend\n");
+            break;
+        }
+        if (!ok)
+        {
+            if (++failures > cache.Owned())
+            {
+                printf("A signer's coins can no longer pay for its workload's transactions\n");
+                break;
+            }
+            continue;
+        }
+        failures = 0;
+        stats.built.fetch_add(1, std::memory_order_relaxed);
+        PushSigned(ring, stx, done, stats, nullptr);
+    }
+    cache.Release();
+    stats.fresh += cache.fresh;
+    stats.chained += cache.chained;
+    {
+        std::lock_guard<std::mutex> lock(stats.mixLock);
+        stats.mix += builder.stats;
+    }
+    stats.exited++;
+}
+
+/** Sign transactions spending coins from the dispenser, and push them serialized onto the ring until done is set.
+    Like GenerateTxs, each output replaces the coin it spent, so once no fresh coins are left it spends its outputs.
+    Signing starts at (unix) time start; until then, and whenever the ring is full, Schnorr nonces are precomputed.
+    If mix is set its shapes are built instead (see SignMixTxs). */
+void SignTxs(const WorkloadMix* mix, FeeProducer fee, SigType sigType, uint64_t start, CoinDispenser& coins,
+             TxMsgRing& ring, std::atomic<bool>& done, SignerStats& stats)
+{
+    fee.Reseed();
+    if (mix)
+    {
+        SignMixTxs(*mix, fee, sigType, start, coins, ring, done, stats);
+        return;
+    }
+    P2PKHSpendBatch batch;
+    std::unique_ptr<SchnorrSigner> signer = MakeSigner(sigType);
+    batch.UseSchnorr(signer.get());
+    SignedTx stx;
+    CoinDispenser::Cache& cache = coins.NewCache();
+    CoinIter uit(nullptr, 0);
+    Tracer::NameThread("signer");
+
+    WaitForStart(start, signer.get());
+
+    while (!done.load(std::memory_order_relaxed))
+    {
+        // Build several at once so their hashes can share SIMD lanes
+        unsigned int n;
+        {
+            TRACE_SCOPE(COINS);
+            n = cache.Take(gc.hashBatch, uit);
+        }
+        if (n == 0)
+        {
+            printf("A signer has no coins to spend\n");
+            break;
+        }
+        fee.SetFloor(stats.feeFloor.load(std::memory_order_relaxed));
+        uint64_t buildStart = GetStopwatch();
+        n = batch.Build(uit, uit, n, fee);
+        stats.signNs.fetch_add(GetStopwatch() - buildStart, std::memory_order_relaxed);
+        stats.built.fetch_add(n, std::memory_order_relaxed);
+
+        for (unsigned int j = 0; j < n; j++)
+        {
+            if (!batch.ok[j])
+            {
+                printf("UTXO didn't have enough balance or isn't compressed P2PKH\n");
+                continue;
+            }
+
+            stx.msg.assign(batch.txs[j].data(), batch.txs[j].data() + batch.txs[j].size());
+            stx.txid = batch.txs[j].txid;
+            PushSigned(ring, stx, done, stats, signer.get());
+        }
+    }
+    cache.Release();
+    stats.fresh += cache.fresh;
+    stats.chained += cache.chained;
+    if (signer) stats.nonceMisses += signer->poolMisses;
+    stats.exited++;
+}
+
+/** Pipelined version of GenerateTxs: a pool of signer threads fill a ring with serialized transactions, and this
+    thread drains it onto the connection at the paced rate.  This keeps a slow signature from stalling the socket
+    and a blocked socket from stalling signing.  Each signer takes coins from the dispenser independently.
+*/
+void GenerateTxsPipelined(string name, uint64_t start, uint64_t end, ScheduleOp op, CoinDispenser& coins)
+{
+    const string& host = op.host;
+    uint64_t rateBegin = op.rateBegin;
+    uint64_t rateEnd = op.rateEnd;
+    unsigned int signers = op.signers;
+    FeeProducer& fee = op.fee;
+
+    // The signers start now so they can precompute Schnorr nonces until the start time
+    TxMsgRing ring(gc.pipelineDepth);
+    std::atomic<bool> done(false);
+    SignerStats stats;
+    stats.drainOnDone = !gc.saveFinalCoins.empty();
+    SigType sigType = op.sigType;
+    vector<thread> thrds;
+    thrds.reserve(signers);
+    const WorkloadMix* mix = op.workload.get();
+    for (unsigned int i = 0; i < signers; i++)
+    {
+        thrds.push_back(thread([mix, &fee, sigType, start, &coins, &ring, &done, &stats]
+                               { SignTxs(mix, fee, sigType, start, coins, ring, done, stats); }));
+    }
+
+    Tracer::NameThread(name + " to " + host);
+    SimpleClient sc(host);
+    sc.batch = op.batch;
+    if (op.announce.enabled) sc.Announce(op.announce);
+    WaitForStart(start, nullptr);
+
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Starting %s to %s rate %lu tps .. %lu tps, %u %s signers\n", now.c_str(), name.c_str(), host.c_str(), rateBegin, rateEnd, signers, SigTypeName(sigType));
+    }
+
+    uint64_t count = 0;
+    uint64_t txBytes = 0;
+    uint64_t ringEmpty = 0;
+    SignedTx stx;
+    uint64_t feeFilter = 0;
+    SentTxTracker::Sent tag;
+    if (latency) tag = latency->Tag(name, host);
+    std::shared_ptr<TargetMetrics> live;
+    if (liveMetrics) live = liveMetrics->Add(name, host);
+
+    Pacer pacer(op.pace, rateBegin, rateEnd, Pacer::StopwatchAt(start), Pacer::StopwatchAt(end));
+    uint64_t stopwatchStart = GetStopwatch();
+    uint64_t curTime = stopwatchStart;
+    RateProbe probe;
+    probe.Start(name, op, &tag, pacer, curTime);
+
+    while (!pacer.Done(curTime))
+    {
+        if (pacer.Due(curTime))
+        {
+            // The signers are behind, so hold onto this send slot until one is ready
+            bool got = ring.pop(stx);
+            while (!got && !pacer.Done(curTime))
+            {
+                ringEmpty++;
+                sc.FlushIfDue();
+                std::this_thread::yield();
+                curTime = GetStopwatch();
+                got = ring.pop(stx);
+            }
+            if (!got) break;
+
+            sc.SendTx(stx.txid, stx.msg.data(), stx.msg.size());
+            if (latency) latency->Sent(stx.txid, tag, curTime);
+            pacer.Sent();
+            count++;
+            txBytes += stx.msg.size();
+            if (sc.inbound.stats.feeFilter != feeFilter)  // Transactions already signed are sent anyway
+            {
+                feeFilter = sc.inbound.stats.feeFilter;
+                stats.feeFloor = FeeForRate(feeFilter, P2PKHSpend::MAX_SIZE);
+            }
+        }
+        else
+        {
+            sc.FlushIfDue();
+            pacer.Wait(curTime + MAX_IDLE_NS);
+        }
+        curTime = GetStopwatch();
+        if (live && live->Due(curTime))
+        {
+            PublishSender(*live, count, pacer, curTime, sc.stats, sc.QueueDepth());
+            PublishSigners(*live, stats, count);
+        }
+        if (probe.Due(curTime)) probe.Update(pacer, curTime, count, sc.stats, sc.QueueDepth(), sc.inbound.stats);
+    }
+    done = true;
+
+    // Each signed transaction has already replaced its coins, so send what is left if the coins will be saved
+    uint64_t drained = 0;
+    while (stats.drainOnDone)
+    {
+        bool finished = (stats.exited.load() >= signers);  // Before popping, so nothing pushed before it is missed
+        if (ring.pop(stx))
+        {
+            sc.SendTx(stx.txid, stx.msg.data(), stx.msg.size());
+            count++;
+            txBytes += stx.msg.size();
+            drained++;
+        }
+        else if (finished)
+            break;
+        else
+            std::this_thread::yield();
+    }
+    sc.Flush();
+
+    for (auto &t : thrds)
+    {
+        t.join();
+    }
+    if (live)
+    {
+        PublishSender(*live, count, pacer, curTime, sc.stats, sc.QueueDepth());
+        PublishSigners(*live, stats, count);
+        live->active = false;
+    }
+
+    uint64_t stopwatchEnd = GetStopwatch();
+    float elapsedTime = ((float)(stopwatchEnd-stopwatchStart))/1000000000.0;
+    sc.FinishAnnouncing();
+
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Ending %s to %s. Sent %lu tx (%lu bytes) in %6.2f sec, rate %6.2f tps, %.0f bytes/sec (%lu skipped to catch up). Sender waited %lu times, signers waited %lu times\n", now.c_str(), name.c_str(), host.c_str(), count, txBytes, elapsedTime, ((float)count)/elapsedTime, txBytes/elapsedTime, pacer.skipped, ringEmpty, (uint64_t) stats.ringFull);
+        printf("%s: %s to %s: spent %lu fresh coins and %lu of its own outputs\n", now.c_str(), name.c_str(), host.c_str(), (uint64_t) stats.fresh, (uint64_t) stats.chained);
+        if (drained)
+            printf("%s: %s to %s: sent the last %lu signed transactions after the end, so the saved coins match the node's\n", now.c_str(), name.c_str(), host.c_str(), drained);
+        printf("%s: %s to %s: %s, %lu bytes still queued\n", now.c_str(), name.c_str(), host.c_str(), sc.stats.ToString().c_str(), (uint64_t) sc.QueueDepth());
+        printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.inbound.stats.ToString().c_str());
+        if (sc.announcer)
+            printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.announcer->stats.ToString().c_str());
+        if (sigType == SigType::SCHNORR && !op.workload)
+            printf("%s: %s to %s: %lu signatures needed a nonce that was not precomputed\n", now.c_str(), name.c_str(), host.c_str(), (uint64_t) stats.nonceMisses);
+        if (op.workload) stats.mix.Report(now + ": " + name + " to " + host, *op.workload, elapsedTime);
+    }
+    probe.Report();
+}
+
+/** Generate transactions at a certain rate, starting at a certain time, and spending coins from the dispenser.
+    Each transaction's output replaces the coin it spent, so once no fresh coins are left anywhere the routine spends
+    the prior generated transactions, creating chains of unspent transactions.
+*/
+void GenerateTxs(string name, uint64_t start, uint64_t end, ScheduleOp op, CoinDispenser& coins)
+{
+    if (op.signers > 0)
+    {
+        GenerateTxsPipelined(name, start, end, op, coins);
+        return;
+    }
+
+    const string& host = op.host;
+    uint64_t rateBegin = op.rateBegin;
+    uint64_t rateEnd = op.rateEnd;
+    FeeProducer& fee = op.fee;
+    fee.Reseed();
+
+    P2PKHSpend txb;
+    std::unique_ptr<SchnorrSigner> signer = MakeSigner(op.sigType);
+    txb.schnorr = signer.get();
+    Tracer::NameThread(name + " to " + host);
+    // Connect first, since this thread is started a little ahead of time (see connectAhead)
+    SimpleClient sc(host);
+    sc.batch = op.batch;
+    if (op.announce.enabled) sc.Announce(op.announce);
+    WaitForStart(start, signer.get());
+
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Starting %s to %s rate %lu tps .. %lu tps, %s\n", now.c_str(), name.c_str(), host.c_str(), rateBegin, rateEnd, SigTypeName(op.sigType));
+    }
+
+    CoinDispenser::Cache& cache = coins.NewCache();
+    CoinIter uit(nullptr, 0);
+    uint64_t count = 0;
+    uint64_t signNs = 0;
+    SentTxTracker::Sent tag;
+    if (latency) tag = latency->Tag(name, host);
+    std::shared_ptr<TargetMetrics> live;
+    if (liveMetrics) live = liveMetrics->Add(name, host);
+
+    Pacer pacer(op.pace, rateBegin, rateEnd, Pacer::StopwatchAt(start), Pacer::StopwatchAt(end));
+    uint64_t stopwatchStart = GetStopwatch();
+    uint64_t curTime = stopwatchStart;
+    auto publish = [&]()
+    {
+        PublishSender(*live, count, pacer, curTime, sc.stats, sc.QueueDepth());
+        TargetMetrics::Set(live->built, count);  // Signing and sending are one step
+        TargetMetrics::Set(live->signNs, signNs);
+    };
+    RateProbe probe;
+    probe.Start(name, op, &tag, pacer, curTime);
+
+    while (!pacer.Done(curTime))
+    {
+        if (pacer.Due(curTime))
+        {
+            unsigned int taken;
+            {
+                TRACE_SCOPE(COINS);
+                taken = cache.Take(1, uit);
+            }
+            if (taken == 0)
+            {
+                printf("%s to %s has no coins to spend\n", name.c_str(), host.c_str());
+                break;
+            }
+
+            fee.SetFloor(FeeForRate(sc.inbound.stats.feeFilter, P2PKHSpend::MAX_SIZE));
+            uint64_t buildStart = GetStopwatch();
+            bool worked = txb.Build(uit, uit, fee());
+            signNs += GetStopwatch() - buildStart;
+            if (worked)
+            {
+                sc.SendTx(txb.txid, txb.data(), txb.size());
+                if (latency) latency->Sent(txb.txid, tag, curTime);
+            }
+            else
+            {
+                printf("UTXO didn't have enough balance or isn't compressed P2PKH\n");
+            }
+
+            pacer.Sent();
+            count++;
+        }
+        else
+        {
+            sc.FlushIfDue();
+            if (signer && !signer->Full())  // Spend the idle time getting ahead on Schnorr nonces
+                signer->PrecomputeUntil(std::min(pacer.NextSend(), curTime + MAX_IDLE_NS));
+            else
+                pacer.Wait(curTime + MAX_IDLE_NS);
+        }
+        curTime = GetStopwatch();
+        if (live && live->Due(curTime)) publish();
+        if (probe.Due(curTime)) probe.Update(pacer, curTime, count, sc.stats, sc.QueueDepth(), sc.inbound.stats);
+    }
+    sc.Flush();
+    cache.Release();
+    if (live)
+    {
+        publish();
+        live->active = false;
+    }
+
+    uint64_t stopwatchEnd = GetStopwatch();
+    float elapsedTime = ((float)(stopwatchEnd-stopwatchStart))/1000000000.0;
+    sc.FinishAnnouncing();
+
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Ending %s to %s. Sent %lu tx in %6.2f sec, rate %6.2f tps (%lu skipped to catch up)\n", now.c_str(), name.c_str(), host.c_str(),count, elapsedTime, ((float)count)/elapsedTime, pacer.skipped);
+        printf("%s: %s to %s: spent %lu fresh coins and %lu of its own outputs\n", now.c_str(), name.c_str(), host.c_str(), cache.fresh, cache.chained);
+        printf("%s: %s to %s: %s, %lu bytes still queued\n", now.c_str(), name.c_str(), host.c_str(), sc.stats.ToString().c_str(), (uint64_t) sc.QueueDepth());
+        printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.inbound.stats.ToString().c_str());
+        if (sc.announcer)
+            printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.announcer->stats.ToString().c_str());
+        if (signer)
+            printf("%s: %s to %s: %lu of %lu signatures needed a nonce that was not precomputed\n", now.c_str(), name.c_str(), host.c_str(), signer->poolMisses, signer->signatures);
+    }
+    probe.Report();
+}
+
+/** Runs one schedule target on an IoPool thread instead of a thread of its own.  A timer wakes the target whenever its
+    pacer has sends due, and each send goes to the next of its connections that has room.  As in GenerateTxs, each
+    transaction's output replaces the coin it spent.  If the target has signers, they still get threads of their own
+    and the timer only moves their transactions from the ring to the connections.  Like AsyncPeer, a target is kept
+    alive by its handlers, and frees itself (and its connections) once it has finished.
+*/
+class AsyncTarget : public std::enable_shared_from_this<AsyncTarget>
+{
+    /** Sends made per wakeup before giving the thread's other targets a turn */
+    static const unsigned int MAX_SENDS_PER_WAKE = 256;
+    /** How long to wait (ns) before trying again when every connection is full or the signers are behind */
+    static const uint64_t RETRY_NS = 100000;
+    /** How often (ns) to check whether the node has asked for everything announced, once the schedule is over */
+    static const uint64_t LINGER_POLL_NS = 10000000;
+
+    string name;
+    uint64_t start;
+    uint64_t end;
+    ScheduleOp op;
+    CoinDispenser& coins;
+    boost::asio::io_service& ios;
+    boost::asio::steady_timer timer;
+    std::vector<std::shared_ptr<AsyncPeer> > peers;
+    unsigned int nextPeer = 0;
+    std::unique_ptr<Pacer> pacer;
+
+    P2PKHSpend txb;
+    std::unique_ptr<SchnorrSigner> signer;
+    CoinDispenser::Cache* cache = nullptr;
+    CoinIter uit;
+
+    std::unique_ptr<TxMsgRing> ring;
+    SignedTx msg;
+    bool haveMsg = false;
+    std::atomic<bool> done;
+    SignerStats signerStats;
+    vector<thread> signerThreads;
+
+    uint64_t count = 0;
+    uint64_t txBytes = 0;  // Of the transactions sent
+    uint64_t ringEmpty = 0;
+    uint64_t stopwatchStart = 0;
+    uint64_t signNs = 0;
+    SentTxTracker::Sent tag;
+    std::shared_ptr<TargetMetrics> live;
+    RateProbe probe;
+    uint64_t fullSince = 0;  // When every connection filled up, 0 if one has room
+    uint64_t doneAt = 0;  // When the schedule was over (see Linger)
+    uint64_t drained = 0;  // Signed transactions sent after the end (see Drain)
+
+public:
+    AsyncTarget(boost::asio::io_service& _ios, string _name, uint64_t _start, uint64_t _end, const ScheduleOp& _op,
+                CoinDispenser& _coins):name(_name), start(_start), end(_end), op(_op), coins(_coins), ios(_ios),
+                timer(_ios), uit(nullptr, 0), done(false)
+    {
+        op.fee.Reseed();
+        if (op.signers == 0)
+        {
+            signer = MakeSigner(op.sigType);
+            txb.schnorr = signer.get();
+        }
+    }
+
+    ~AsyncTarget() { StopSigners(); }
+
+    /** Connect and arm the start timer.  Call this a little ahead of the start (see connectAhead).  The signers (if
+        any) start now too, so they can precompute Schnorr nonces until the start */
+    void Begin()
+    {
+        for (unsigned int i = 0; i < std::max(op.connections, 1U); i++)
+        {
+            peers.push_back(std::make_shared<AsyncPeer>(ios, op.host));
+            peers.back()->onFeeFilter = [this](uint64_t) { FeeFilterChanged(); };
+            if (op.announce.enabled) peers.back()->Announce(op.announce);
+            peers.back()->Connect();
+        }
+
+        if (op.signers > 0)
+        {
+            ring.reset(new TxMsgRing(gc.pipelineDepth));
+            signerStats.drainOnDone = !gc.saveFinalCoins.empty();
+            for (unsigned int i = 0; i < op.signers; i++)
+            {
+                // Copied here, since FeeFilterChanged updates op.fee on this thread.  Later floors reach the
+                // signers through signerStats.feeFloor
+                FeeProducer fee = op.fee;
+                SigType sigType = op.sigType;
+                uint64_t st = start;
+                const WorkloadMix* mix = op.workload.get();
+                signerThreads.push_back(thread([this, mix, fee, sigType, st]
+                                        { SignTxs(mix, fee, sigType, st, coins, *ring, done, signerStats); }));
+            }
+        }
+        else
+            cache = &coins.NewCache();
+        auto self = shared_from_this();
+        WakeAt(Pacer::StopwatchAt(start), [this, self](const boost::system::error_code& e) { if (!e) Start(); });
+    }
+
+protected:
+    /** Pay enough to get past the highest feefilter of any of our connections */
+    void FeeFilterChanged()
     {
-        uint64_t ret;
-        if (u.exists(fieldName))
+        uint64_t rate = 0;
+        for (auto& p : peers) rate = std::max(rate, p->inbound.stats.feeFilter);
+        op.fee.SetFloor(FeeForRate(rate, P2PKHSpend::MAX_SIZE));
+        signerStats.feeFloor = FeeForRate(rate, P2PKHSpend::MAX_SIZE);
+    }
+
+    void StopSigners()
+    {
+        done = true;
+        for (auto &t : signerThreads)
         {
-            ret = u[fieldName].get_int64();
-            if (ret < 1567000000)
+            t.join();
+        }
+        signerThreads.clear();
+    }
+
+    template <typename Handler> void WakeAt(uint64_t stopwatch, Handler h)
+    {
+        uint64_t now = GetStopwatch();
+        timer.expires_from_now(std::chrono::nanoseconds((stopwatch > now) ? stopwatch - now : 0));
+        timer.async_wait(h);
+    }
+
+    void Start()
+    {
+        {
+            auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+            printf("%s: Starting %s to %s rate %lu tps .. %lu tps, %u connections, %u %s signers\n", now.c_str(), name.c_str(), op.host.c_str(), op.rateBegin, op.rateEnd, (unsigned int) peers.size(), op.signers, SigTypeName(op.sigType));
+        }
+        pacer.reset(new Pacer(op.pace, op.rateBegin, op.rateEnd, Pacer::StopwatchAt(start), Pacer::StopwatchAt(end)));
+        if (latency) tag = latency->Tag(name, op.host);
+        if (liveMetrics) live = liveMetrics->Add(name, op.host);
+        stopwatchStart = GetStopwatch();
+        probe.Start(name, op, &tag, *pacer, stopwatchStart);
+        Run();
+    }
+
+    /** Make the sends that are due, then sleep until the next one */
+    void Run()
+    {
+        uint64_t now = GetStopwatch();
+        if (pacer->Done(now))
+        {
+            if (Drain(now)) return;
+            if (Linger(now)) return;
+            Finish();
+            return;
+        }
+        if (live && live->Due(now)) Publish(now);
+        if (probe.Due(now)) Probe(now);
+
+        bool blocked = false;
+        unsigned int sends = 0;
+        while ((sends < MAX_SENDS_PER_WAKE) && pacer->Due(now))
+        {
+            if (!SendOne())
             {
-                ret = ret + GetTime();
+                blocked = true;
+                break;
             }
-            return ret;
+            pacer->Sent();
+            sends++;
+        }
+
+        uint64_t wake = pacer->NextSend();
+        if (blocked) wake = now + RETRY_NS;
+        else if (sends == MAX_SENDS_PER_WAKE) wake = now;
+        for (auto& p : peers)
+        {
+            if (!p->announcer) continue;
+            if (p->announcer->Due(now)) p->announcer->Flush(now);
+            wake = std::min(wake, std::max(p->announcer->NextDue(), now + RETRY_NS));  // A full queue holds it up
+        }
+        auto self = shared_from_this();
+        WakeAt(wake, [this, self](const boost::system::error_code& e) { if (!e) Run(); });
+    }
+
+    /** Once the schedule is over, stop the signers and, if the coins will be saved, send what they have already
+        signed (see SignerStats::drainOnDone).  Returns true if it has set a timer to carry on */
+    bool Drain(uint64_t now)
+    {
+        if (!ring || !signerStats.drainOnDone) return false;
+        if (!doneAt) doneAt = now;
+        done = true;
+        bool finished = (signerStats.exited.load() >= op.signers);  // Before popping, so nothing pushed is missed
+        while (SendOne()) drained++;
+        if (finished && !haveMsg) return false;  // SendOne found the ring empty
+        auto self = shared_from_this();
+        WakeAt(now + RETRY_NS, [this, self](const boost::system::error_code& e) { if (!e) Run(); });
+        return true;
+    }
+
+    /** Once the schedule is over, announce what hasn't been, and keep the connections up until the node has asked
+        for everything or TxAnnouncer::LINGER_MS has passed.  Returns true if it has set a timer to check again */
+    bool Linger(uint64_t now)
+    {
+        if (!doneAt)
+        {
+            doneAt = now;
+            StopSigners();  // Nothing more will be sent
+        }
+        if (now >= doneAt + TxAnnouncer::LINGER_MS * 1000000ULL) return false;
+        bool pending = false;
+        for (auto& p : peers)
+        {
+            if (!p->announcer) continue;
+            p->announcer->Flush(now);
+            pending |= p->announcer->Pending();
+        }
+        if (!pending) return false;
+        auto self = shared_from_this();
+        WakeAt(now + LINGER_POLL_NS, [this, self](const boost::system::error_code& e) { if (!e) Run(); });
+        return true;
+    }
+
+    /** The next connection that can take a size byte transaction (see CanSendTx), or null if they are all full.
+        The time spent with them all full is counted as a stall */
+    AsyncPeer* NextPeer(uint32_t size)
+    {
+        for (unsigned int i = 0; i < peers.size(); i++)
+        {
+            AsyncPeer* p = peers[nextPeer].get();
+            nextPeer = (nextPeer + 1) % peers.size();
+            if (p->CanSendTx(size))
+            {
+                if (fullSince)
+                {
+                    p->stats.stallNs += GetStopwatch() - fullSince;
+                    fullSince = 0;
+                }
+                return p;
+            }
+        }
+        peers[nextPeer]->stats.queueFull++;
+        if (!fullSince) fullSince = GetStopwatch();
+        return nullptr;
+    }
+
+    /** Let the rate probe judge our connections */
+    void Probe(uint64_t now)
+    {
+        SendStats stats;
+        InboundStats inbound;
+        uint64_t queued = 0;
+        for (auto& p : peers)
+        {
+            stats += p->stats;
+            inbound += p->inbound.stats;
+            queued += p->QueueDepth();
+        }
+        probe.Update(*pacer, now, count, stats, queued, inbound);
+    }
+
+    /** Publish our counters, and our connections' */
+    void Publish(uint64_t now)
+    {
+        SendStats stats;
+        uint64_t queued = 0;
+        for (auto& p : peers)
+        {
+            stats += p->stats;
+            queued += p->QueueDepth();
+        }
+        PublishSender(*live, count, *pacer, now, stats, queued);
+        if (ring)
+            PublishSigners(*live, signerStats, count);
+        else
+        {
+            TargetMetrics::Set(live->built, count);
+            TargetMetrics::Set(live->signNs, signNs);
+        }
+    }
+
+    /** Send one transaction.  Returns false if it has to wait for a connection or a signer */
+    bool SendOne()
+    {
+        if (ring)
+        {
+            if (!haveMsg && !(haveMsg = ring->pop(msg)))
+            {
+                ringEmpty++;
+                return false;
+            }
+            AsyncPeer* p = NextPeer(msg.msg.size());
+            if (!p || !p->SendTx(msg.txid, msg.msg.data(), msg.msg.size())) return false;
+            if (latency) latency->Sent(msg.txid, tag, GetStopwatch());
+            haveMsg = false;
+            count++;
+            txBytes += msg.msg.size();
+            return true;
+        }
+
+        // Don't use up a coin until there is somewhere to send its transaction
+        AsyncPeer* p = NextPeer(P2PKHSpend::MAX_SIZE);
+        if (!p) return false;
+        unsigned int taken;
+        {
+            TRACE_SCOPE(COINS);
+            taken = cache->Take(1, uit);
+        }
+        if (taken == 0) return false;  // No coins at all; the pacer's end still finishes the target
+        uint64_t buildStart = GetStopwatch();
+        bool worked = txb.Build(uit, uit, op.fee());
+        signNs += GetStopwatch() - buildStart;
+        if (worked)
+        {
+            p->SendTx(txb.txid, txb.data(), txb.size());  // NextPeer made sure it will take it
+            if (latency) latency->Sent(txb.txid, tag, GetStopwatch());
+            txBytes += txb.size();
+        }
+        else
+            printf("UTXO didn't have enough balance or isn't compressed P2PKH\n");
+        count++;
+        return true;
+    }
+
+    void Finish()
+    {
+        StopSigners();  // They notice promptly, so this doesn't hold up the thread's other targets for long
+        if (cache) cache->Release();
+        if (live)
+        {
+            Publish(GetStopwatch());
+            live->active = false;
+        }
+        float elapsedTime = ((float)(doneAt-stopwatchStart))/1000000000.0;
+        SendStats stats;
+        InboundStats inbound;
+        TxAnnouncer::Stats announced;
+        uint64_t queued = 0;
+        for (auto& p : peers)
+        {
+            stats += p->stats;
+            inbound += p->inbound.stats;
+            if (p->announcer) announced += p->announcer->stats;
+            queued += p->QueueDepth();
+            p->onFeeFilter = nullptr;  // It may outlive us while it finishes closing
+            p->Close();
+        }
+        peers.clear();  // Each stays alive until it has finished closing
+
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Ending %s to %s. Sent %lu tx (%lu bytes) in %6.2f sec, rate %6.2f tps, %.0f bytes/sec (%lu skipped to catch up)", now.c_str(), name.c_str(), op.host.c_str(), count, txBytes, elapsedTime, ((float)count)/elapsedTime, txBytes/elapsedTime, pacer->skipped);
+        if (ring)
+            printf(". Sender waited %lu times, signers waited %lu times", ringEmpty, (uint64_t) signerStats.ringFull);
+        printf("\n%s: %s to %s: %s, %lu bytes still queued\n", now.c_str(), name.c_str(), op.host.c_str(), stats.ToString().c_str(), queued);
+        printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), op.host.c_str(), inbound.ToString().c_str());
+        if (op.announce.enabled)
+            printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), op.host.c_str(), announced.ToString().c_str());
+        uint64_t fresh = cache ? cache->fresh : (uint64_t) signerStats.fresh;
+        uint64_t chained = cache ? cache->chained : (uint64_t) signerStats.chained;
+        printf("%s: %s to %s: spent %lu fresh coins and %lu of its own outputs\n", now.c_str(), name.c_str(), op.host.c_str(), fresh, chained);
+        if (drained)
+            printf("%s: %s to %s: sent the last %lu signed transactions after the end, so the saved coins match the node's\n", now.c_str(), name.c_str(), op.host.c_str(), drained);
+        if (signer)
+            printf("%s: %s to %s: %lu of %lu signatures needed a nonce that was not precomputed\n", now.c_str(), name.c_str(), op.host.c_str(), signer->poolMisses, signer->signatures);
+        else if (ring && (op.sigType == SigType::SCHNORR) && !op.workload)
+            printf("%s: %s to %s: %lu signatures needed a nonce that was not precomputed\n", now.c_str(), name.c_str(), op.host.c_str(), (uint64_t) signerStats.nonceMisses);
+        if (op.workload) signerStats.mix.Report(now + ": " + name + " to " + op.host, *op.workload, elapsedTime);
+        probe.Report();
+    }
+};
+
+/** How many transactions a corpus needs for op to run for the whole of phase p (with a little to spare, since
+    Poisson arrivals vary) */
+uint64_t CorpusTxCount(const SchedulePhase& p, const ScheduleOp& op)
+{
+    uint64_t duration = (p.endTime > p.startTime) ? p.endTime - p.startTime : 0;
+    uint64_t rateBegin = op.saturate.enabled ? op.rateEnd : op.rateBegin;  // A saturating target may go up to rateEnd
+    double expected = Pacer(op.pace, rateBegin, op.rateEnd, 0, duration * 1000000000ULL).Expected();
+    return (uint64_t)(expected + 4 * sqrt(expected)) + gc.hashBatch;
+}
+
+/** FillCorpusSection for a target with a workload mix */
+uint64_t FillMixCorpusSection(const ScheduleOp& op, CoinDispenser::Cache& cache, uint64_t qty, unsigned char* out,
+                              uint64_t capacity, uint64_t& msgs)
+{
+    MixBuilder builder(*op.workload);
+    FeeProducer fee = op.fee;
+    fee.Reseed();
+    SignedTx stx;
+    uint64_t used = 0;
+    uint64_t failures = 0;  // Draws in a row that couldn't be paid for; once that is all the coins, give up
+    msgs = 0;
+
+    while ((msgs < qty) && (failures <= cache.Owned()))
+    {
+        bool empty;
+        if (!builder.Build(cache, fee, op.sigType, stx, empty))
+        {
+            if (empty) break;
+            failures++;
+            continue;
+        }
+        failures = 0;
+        uint32_t size = stx.msg.size();
+        if (used + P2P_HEADER_SIZE + size > capacity) break;
+        FormatP2PHeader(out + used, TX_MSG, size);
+        memcpy(out + used + P2P_HEADER_SIZE, stx.msg.data(), size);
+        used += P2P_HEADER_SIZE + size;
+        msgs++;
+    }
+    auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+    builder.stats.Report(now + ": corpus for " + op.host, builder.mix, 0);
+    return used;
+}
+
+/** Sign qty transactions for op like GenerateTxs would, spending (in place) coins from cache, and lay them out back
+    to back as complete tx messages in out.  Stops early if out fills up or the coins can't pay.
+    Returns the bytes used, and sets msgs to the number of messages. */
+uint64_t FillCorpusSection(const ScheduleOp& op, CoinDispenser::Cache& cache, uint64_t qty, unsigned char* out,
+                           uint64_t capacity, uint64_t& msgs)
+{
+    if (op.workload) return FillMixCorpusSection(op, cache, qty, out, capacity, msgs);
+
+    P2PKHSpendBatch batch;
+    std::unique_ptr<SchnorrSigner> signer = MakeSigner(op.sigType);
+    batch.UseSchnorr(signer.get());
+    FeeProducer fee = op.fee;
+    fee.Reseed();
+    CoinIter uit(nullptr, 0);
+    uint64_t used = 0;
+    uint64_t failures = 0;  // Coins in a row that couldn't pay; once that is all of them, give up
+    msgs = 0;
+
+    while ((msgs < qty) && (failures <= cache.Owned()))
+    {
+        unsigned int n;
+        {
+            TRACE_SCOPE(COINS);
+            n = cache.Take(std::min((uint64_t) gc.hashBatch, qty - msgs), uit);
+        }
+        if (n == 0) break;
+        n = batch.Build(uit, uit, n, fee);
+
+        for (unsigned int j = 0; j < n; j++)
+        {
+            if (!batch.ok[j])
+            {
+                failures++;
+                continue;
+            }
+            failures = 0;
+            uint32_t size = batch.txs[j].size();
+            if (used + P2P_HEADER_SIZE + size > capacity) return used;
+            FormatP2PHeader(out + used, TX_MSG, size);
+            memcpy(out + used + P2P_HEADER_SIZE, batch.txs[j].data(), size);
+            used += P2P_HEADER_SIZE + size;
+            msgs++;
+        }
+    }
+    return used;
+}
+
+/** Send a corpus section to op.host from start until end at op's rate.  Messages are written to the socket straight
+    out of the mapped corpus, several at a time if the pacer has let several become due. */
+void ReplayTxs(string name, uint64_t start, uint64_t end, ScheduleOp op, const unsigned char* data, uint64_t bytes,
+               uint64_t msgs)
+{
+    const string& host = op.host;
+
+    Tracer::NameThread("replay " + name + " to " + host);
+    SimpleClient sc(host);
+    WaitForStart(start, nullptr);
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Replaying %s to %s rate %lu tps .. %lu tps, %lu tx available\n", now.c_str(), name.c_str(), host.c_str(), op.rateBegin, op.rateEnd, msgs);
+        if (op.announce.enabled)  // Announcing needs the txids, which the corpus doesn't keep
+            printf("%s: %s to %s: a corpus can't be announced, so its transactions are pushed\n", now.c_str(), name.c_str(), host.c_str());
+    }
+
+    uint64_t due = 0;  // Messages before this offset may be sent
+    uint64_t sent = 0;  // Bytes before this offset have been sent
+    uint64_t boundary = 0;  // Start of the first message not known to be completely sent
+    uint64_t count = 0;  // Messages before boundary that were completely sent
+    uint64_t dropped = 0;
+    auto advanceBoundary = [&]()
+    {
+        while ((boundary < bytes) && (boundary + P2P_HEADER_SIZE + P2PMsgSize(data + boundary) <= sent))
+        {
+            boundary += P2P_HEADER_SIZE + P2PMsgSize(data + boundary);
+            count++;
+        }
+    };
+
+    Pacer pacer(op.pace, op.rateBegin, op.rateEnd, Pacer::StopwatchAt(start), Pacer::StopwatchAt(end));
+    uint64_t stopwatchStart = GetStopwatch();
+    uint64_t curTime = stopwatchStart;
+    std::shared_ptr<TargetMetrics> live;
+    if (liveMetrics) live = liveMetrics->Add(name, host);
+    RateProbe probe;
+    probe.Start(name, op, nullptr, pacer, curTime);
+
+    while (!pacer.Done(curTime) && (sent < bytes))
+    {
+        while ((due < bytes) && pacer.Due(curTime))
+        {
+            due += P2P_HEADER_SIZE + P2PMsgSize(data + due);
+            pacer.Sent();
+        }
+
+        if (sent < due)
+        {
+            long written = sc.WriteDirect(data + sent, due - sent);
+            if (written > 0)
+            {
+                sent += written;
+            }
+            else if (written == 0)
+            {
+                sc.WaitForSocket(1);
+            }
+            else
+            {
+                // New connection: skip the rest of any message that was cut off
+                advanceBoundary();
+                if (sent > boundary)
+                {
+                    boundary += P2P_HEADER_SIZE + P2PMsgSize(data + boundary);
+                    sent = boundary;
+                    dropped++;
+                }
+            }
+        }
+        else
+        {
+            pacer.Wait(curTime + MAX_IDLE_NS);
+        }
+        curTime = GetStopwatch();
+        if (live && live->Due(curTime))
+        {
+            advanceBoundary();
+            PublishSender(*live, count, pacer, curTime, sc.stats, sc.QueueDepth());
+        }
+        if (probe.Due(curTime))
+        {
+            advanceBoundary();
+            probe.Update(pacer, curTime, count, sc.stats, (due > sent) ? due - sent : 0, sc.inbound.stats);
+        }
+    }
+    advanceBoundary();
+    if (live)
+    {
+        PublishSender(*live, count, pacer, curTime, sc.stats, sc.QueueDepth());
+        live->active = false;
+    }
+    if (sent >= bytes)
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: %s to %s ran out of corpus transactions\n", now.c_str(), name.c_str(), host.c_str());
+    }
+
+    uint64_t stopwatchEnd = GetStopwatch();
+    float elapsedTime = ((float)(stopwatchEnd-stopwatchStart))/1000000000.0;
+    {
+        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
+        printf("%s: Ending replay %s to %s. Sent %lu tx in %6.2f sec, rate %6.2f tps, %lu dropped on reconnect, %lu skipped to catch up\n", now.c_str(), name.c_str(), host.c_str(), count, elapsedTime, ((float)count)/elapsedTime, dropped, pacer.skipped);
+        printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.stats.ToString().c_str());
+        printf("%s: %s to %s: %s\n", now.c_str(), name.c_str(), host.c_str(), sc.inbound.stats.ToString().c_str());
+    }
+    probe.Report();
+}
+
+/** Threads that are joined as soon as they are noticed to have finished, so that finished ones don't pile up */
+class ThreadSet
+{
+    class Entry
+    {
+    public:
+        thread t;
+        std::shared_ptr<std::atomic<bool> > done;
+    };
+    vector<Entry> entries;
+
+public:
+    void Add(std::function<void()> f)
+    {
+        Reap();
+        auto done = std::make_shared<std::atomic<bool> >(false);
+        entries.push_back(Entry{thread([f, done] { f(); *done = true; }), done});
+    }
+
+    /** Join the threads that have finished */
+    void Reap()
+    {
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            if (*it->done)
+            {
+                it->t.join();
+                it = entries.erase(it);
+            }
+            else ++it;
+        }
+    }
+
+    void JoinAll()
+    {
+        for (auto& e : entries)
+        {
+            e.t.join();
+        }
+        entries.clear();
+    }
+};
+
+class Schedule
+{
+protected:
+    /** A target waiting for its phase to come up */
+    class Activation
+    {
+    public:
+        uint64_t when;  // (unix) time to start it
+        const SchedulePhase* phase;
+        const ScheduleOp* op;
+        unsigned int idx;  // Position of the target in the whole schedule
+
+        // priority_queue puts the greatest on top, so the earliest must compare greatest
+        bool operator<(const Activation& o) const { return (when != o.when) ? when > o.when : idx > o.idx; }
+    };
+
+    /** Call launch(phase, target, index) for each target gc.connectAhead seconds before its phase starts, in start
+        order, from this thread.  A long schedule therefore has no idle threads or connections waiting for later
+        phases.  Returns once the last target has been launched. */
+    void Dispatch(const std::function<void(const SchedulePhase&, const ScheduleOp&, unsigned int)>& launch) const
+    {
+        std::priority_queue<Activation> waiting;
+        unsigned int idx = 0;
+        for(auto& p: phases)
+        {
+            for (auto& t: p.targets)
+            {
+                uint64_t when = (p.startTime > gc.connectAhead) ? p.startTime - gc.connectAhead : 0;
+                waiting.push(Activation{when, &p, &t, idx++});
+            }
+        }
+        while (!waiting.empty())
+        {
+            Activation a = waiting.top();
+            waiting.pop();
+            WaitForStart(a.when, nullptr);
+            launch(*a.phase, *a.op, a.idx);
+        }
+    }
+
+public:
+    vector<SchedulePhase> phases;
+
+    void Load(const UniValue& u)
+    {
+        phases.resize(u.size());
+        for(unsigned int idx=0; idx < u.size(); idx++)
+        {
+            const UniValue& uphase = u[idx];
+            phases[idx].Load(uphase);
+        }
+    }
+
+    /** execute this schedule of transaction generation with the coins provided.
+     *  Coins are spent in place, so if they are exhausted the outputs are spent.
+     *  Targets are started as their phases come up (see Dispatch), either on a thread of their own or, if ioThreads
+     *  is set, on a fixed pool of threads shared by all of them.
+     */
+    void Execute(UtxoPool& utxo)
+    {
+        // Targets share the coins, so a busy target can keep spending fresh ones after a quiet one is done
+        CoinDispenser coins(utxo, Spenders());
+        MetricsExporter exporter;
+
+        std::unique_ptr<LatencyObserver> observer;
+        if (!gc.observers.empty())
+        {
+            observer.reset(new LatencyObserver(gc.observers, ObserveSample()));
+            observer->Start();
+            latency = observer.get();
+        }
+        ExecuteTargets(coins);
+        Tracer::Get().Report("schedule");
+        if (observer)
+        {
+            observer->Stop(gc.observeLinger);
+            latency = nullptr;
+            observer->Report();
+        }
+    }
+
+    /** Run every target of the schedule, sending from coins */
+    void ExecuteTargets(CoinDispenser& coins)
+    {
+        if (gc.ioThreads > 0)
+        {
+            IoPool pool(gc.ioThreads);
+            pool.Start();
+            Dispatch([&](const SchedulePhase& p, const ScheduleOp& t, unsigned int idx) {
+                    boost::asio::io_service& ios = pool.Next();
+                    auto tgt = std::make_shared<AsyncTarget>(ios, p.name, p.startTime, p.endTime, t, coins);
+                    ios.post([tgt] { tgt->Begin(); });
+                });
+            pool.Join();
+            return;
+        }
+
+        ThreadSet thrds;
+        Dispatch([&](const SchedulePhase& p, const ScheduleOp& t, unsigned int idx) {
+                string name = p.name;
+                uint64_t start = p.startTime;
+                uint64_t end = p.endTime;
+                ScheduleOp op = t;
+                CoinDispenser* c = &coins;
+                thrds.Add([=] { GenerateTxs(name, start, end, op, *c); });
+            });
+        thrds.JoinAll();
+    }
+
+    unsigned int NumTargets() const
+    {
+        unsigned int ret = 0;
+        for(auto& p: phases) ret += p.targets.size();
+        return ret;
+    }
+
+    /** gc.observeSample, or if that is 0, 1 in enough transactions that about MAX_OBSERVED are tracked at once when
+        the busiest phase sends at its highest rates */
+    unsigned int ObserveSample() const
+    {
+        static const uint64_t MAX_OBSERVED = 1000000;
+        if (gc.observeSample) return gc.observeSample;
+        uint64_t peak = 0;
+        for(auto& p: phases)
+        {
+            uint64_t rate = 0;
+            for (auto& t: p.targets) rate += std::max(t.rateBegin, t.rateEnd);
+            peak = std::max(peak, rate);
+        }
+        uint64_t sample = std::max(peak * gc.observeMaxSec / MAX_OBSERVED, (uint64_t) 1);
+        if (sample > 1) printf("timing 1 in %lu transactions\n", sample);
+        return std::min(sample, (uint64_t) std::numeric_limits<unsigned int>::max());
+    }
+
+    /** How many threads of this schedule take coins: each signer, or the target itself if it has none */
+    unsigned int Spenders() const
+    {
+        unsigned int ret = 0;
+        for(auto& p: phases)
+            for (auto& t: p.targets) ret += std::max(t.signers, 1U);
+        return ret;
+    }
+
+    /** Sign every transaction this schedule will send into a corpus file, one section per target, sharing the
+     *  coins among targets the same way Execute does.  Targets are generated in parallel.
+     */
+    bool Generate(UtxoPool& utxo, const string& path)
+    {
+        unsigned int numEntities = NumTargets();
+        CoinDispenser coins(utxo, numEntities);
+
+        std::vector<uint64_t> qtys;
+        std::vector<uint64_t> capacities;
+        for(auto& p: phases)
+        {
+            for (auto& t: p.targets)
+            {
+                qtys.push_back(CorpusTxCount(p, t));
+                if (t.workload)  // Sized for the mix's average, with room for one of its biggest on top
+                    capacities.push_back(qtys.back() * (P2P_HEADER_SIZE + t.workload->MeanSize()) + t.workload->MaxSize());
+                else
+                    capacities.push_back(qtys.back() * (P2P_HEADER_SIZE + P2PKHSpend::MAX_SIZE));
+            }
+        }
+
+        TxCorpus corpus;
+        corpus.netMagic = gc.msgStart;
+        if (!corpus.Create(path, capacities)) return false;
+
+        uint64_t start = GetStopwatch();
+        vector<thread> thrds;
+        thrds.reserve(numEntities);
+        unsigned int idx = 0;
+        for(auto& p: phases)
+        {
+            for (auto& t: p.targets)
+            {
+                const ScheduleOp* op = &t;
+                unsigned char* out = corpus.Data(idx);
+                uint64_t qty = qtys[idx];
+                uint64_t capacity = capacities[idx];
+                thrds.push_back(thread( [&corpus, &coins, op, qty, out, capacity, idx] {
+                            uint64_t msgs;
+                            CoinDispenser::Cache& cache = coins.NewCache();
+                            uint64_t bytes = FillCorpusSection(*op, cache, qty, out, capacity, msgs);
+                            cache.Release();
+                            corpus.SetFilled(idx, bytes, msgs);
+                            if (msgs < qty)
+                                printf("corpus section %u (%s): only %lu of %lu transactions could be built\n", idx, op->host.c_str(), msgs, qty);
+                        }));
+                idx++;
+            }
+        }
+        for (auto &t : thrds)
+        {
+            t.join();
         }
 
-        throw ConfigException("Mandatory field '" + fieldName + "' does not exist in " + name);
+        uint64_t totalMsgs = 0;
+        uint64_t totalBytes = 0;
+        for (unsigned int i = 0; i < corpus.size(); i++)
+        {
+            totalMsgs += corpus[i].msgs;
+            totalBytes += corpus[i].bytes;
+        }
+        if (!corpus.Close()) return false;
+        printf("wrote %lu transactions (%lu MB) in %u sections to %s in %6.2f sec\n", totalMsgs, totalBytes >> 20, numEntities, path.c_str(), ((float)(GetStopwatch()-start))/1000000000.0);
+        Tracer::Get().Report("corpus");
+        return true;
     }
 
-    void Load(const UniValue& u)
+    /** Execute this schedule by sending the transactions in corpus (made by Generate for the same schedule) */
+    bool Replay(const TxCorpus& corpus)
     {
-        if (u.exists("name")) name = u["name"].get_str();
-        startTime = LoadATime(u, "start");
-        endTime = LoadATime(u, "end");
-
-        if (!u.exists("targets")) throw ConfigException("No 'targets' of schedule " + name + "defined");
-
-        UniValue utargets = u["targets"];
-        targets.resize(utargets.size());
-        for(unsigned int idx=0; idx < utargets.size(); idx++)
+        if (corpus.size() != NumTargets())
         {
-            const UniValue& utgt = utargets[idx];
-            targets[idx].Load(utgt);
+            printf("The corpus has %lu sections but the schedule has %u targets\n", (long unsigned int) corpus.size(), NumTargets());
+            return false;
         }
+
+        MetricsExporter exporter;
+        ThreadSet thrds;
+        Dispatch([&](const SchedulePhase& p, const ScheduleOp& t, unsigned int idx) {
+                string name = p.name;
+                uint64_t start = p.startTime;
+                uint64_t end = p.endTime;
+                ScheduleOp op = t;
+                const unsigned char* data = corpus.Data(idx);
+                uint64_t bytes = corpus[idx].bytes;
+                uint64_t msgs = corpus[idx].msgs;
+                thrds.Add([=] { ReplayTxs(name, start, end, op, data, bytes, msgs); });
+            });
+        thrds.JoinAll();
+        Tracer::Get().Report("replay");
+        return true;
     }
 };
 
 
-/** Generate transactions at a certain rate, starting at a certain time, and using utxo and txos provided by iterators.
-    If all the utxos and txos are consumed, the routine uses prior generated transactions new utxos, creating chains
-    of unspent transactions.
-*/
-void GenerateTxs(string name, FeeProducer& fee, uint64_t start, uint64_t end, string host, uint64_t rateBegin, uint64_t rateEnd, std::vector<UTXO>::iterator utxoIt, std::vector<UTXO>::iterator txoIt, uint64_t utxoQty)
-{
-    // The leaky bucket is based on integers so makes rounding errors if the rate is near 1.  By multiplying by 1024,
-    // we essentially use fixed point arithmetric, giving us 10 binary decimal points of precision.
-    const uint64_t FIXED_PT_SHIFT = 1024;
-
-    const uint64_t delay = (1000000ULL/rateBegin)/2;  // find microseconds to delay
+/** One level of the coin split is signed in chunks of this many coins */
+static const unsigned int SPLIT_CHUNK = 256;
 
-    CMutableTransaction tx;
-    uint64_t curTime = GetTime();
-    // Wait for our start time
-    if (start > curTime)
-        sleep(start-curTime);
+/** A chunk of one split level: the transactions spending coins [begin, end), serialized back to back */
+class SplitChunk
+{
+public:
+    uint64_t begin;
+    uint64_t end;
+    std::vector<char> data;
+    std::vector<uint32_t> sizes;
+    unsigned int unsent;  // Connections that still have to send it
+    bool ready = false;
+};
 
-    SimpleClient sc(host);
+/** Preparation phase, one level: spend each coin in utxo to curSplit outputs written to txo.  gc.maxThreads threads
+    sign chunks while each connection's thread sends its chunks, in coin order, as soon as they are ready.  Signers
+    are held to a window of chunks ahead of the slowest sender, so memory stays bounded.
 
+    Connection c sends the coins in [bounds[c], bounds[c+1]).  Those are the outputs of what it sent in the previous
+    level, so every transaction follows its parent down the same connection.  If bounds is empty every connection
+    sends every transaction, which is how the first, small, levels reach all the split hosts.
+*/
+void SplitLevel(UtxoPool& utxo, UtxoPool& txo, unsigned int curSplit, const std::vector<uint64_t>& bounds,
+                std::vector<std::unique_ptr<SimpleClient> >& conns)
+{
+    std::vector<SplitChunk> chunks;
+    std::vector<std::vector<size_t> > connChunks(conns.size());
+    if (bounds.empty())
     {
-        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", curTime / 1000000);
-        printf("%s: Starting %s to %s rate %lu tps .. %lu tps\n", now.c_str(), name.c_str(), host.c_str(), rateBegin, rateEnd);
+        for (uint64_t b = 0; b < utxo.size(); b += SPLIT_CHUNK)
+        {
+            chunks.push_back(SplitChunk{b, std::min(b + SPLIT_CHUNK, (uint64_t) utxo.size())});
+            chunks.back().unsent = conns.size();
+            for (auto& cc : connChunks) cc.push_back(chunks.size() - 1);
+        }
     }
-
-    rateBegin *= FIXED_PT_SHIFT;
-    rateEnd *= FIXED_PT_SHIFT;
-
-    auto uit = utxoIt;
-    auto oit = txoIt;
-    uint64_t passCount = 0;
-    uint64_t count;
-
-    CLeakyBucket rateCtrl(rateBegin+10, rateBegin, rateBegin/2);
-    uint64_t stopwatchStart = GetStopwatch();
-
-    while (curTime < end)
+    else
     {
-        if (rateCtrl.try_leak(FIXED_PT_SHIFT))
+        // Interleave the connections' chunks so that they all get their first chunks signed first
+        std::vector<uint64_t> pos(bounds.begin(), bounds.end() - 1);
+        bool more = true;
+        while (more)
         {
-            if (passCount == utxoQty)  // at end, outputs now become inputs and start over.
+            more = false;
+            for (unsigned int c = 0; c < conns.size(); c++)
             {
-                std::swap(utxoIt, txoIt);
-                uit = utxoIt;
-                oit = txoIt;
-                passCount = 0;
+                if (pos[c] >= bounds[c+1]) continue;
+                uint64_t e = std::min(pos[c] + SPLIT_CHUNK, bounds[c+1]);
+                chunks.push_back(SplitChunk{pos[c], e});
+                chunks.back().unsent = 1;
+                connChunks[c].push_back(chunks.size() - 1);
+                pos[c] = e;
+                more = true;
             }
+        }
+    }
 
-            bool worked = createTx(tx, uit, uit+1, oit, oit+1, fee());
-            if (worked)
-            {
-                CDataStream serializer(SER_NETWORK, PROTOCOL_VERSION);
-                serializer << tx;
-                sc.SendMessage(TX_MSG, serializer.data(), serializer.size());
-            }
-            else
-            {
-                printf("UTXO didn't have enough balance\n");
-            }
+    std::mutex cs;
+    std::condition_variable cv;
+    size_t nextChunk = 0;
+    size_t buffered = 0;  // Chunks claimed by a signer but not yet sent everywhere
+    unsigned int signers = std::max(gc.maxThreads, 1U);
+    size_t window = 4 * signers + conns.size();
+    std::atomic<uint64_t> failed(0);
 
-            count++;
-            passCount++;
-            uit++;
-            oit++;
-        }
-        else
-        {
-            curTime = GetTime();
-            usleep(delay);
-        }
+    vector<thread> thrds;
+    thrds.reserve(signers + conns.size());
+    for (unsigned int i = 0; i < signers; i++)
+    {
+        thrds.push_back(thread([&] {
+                    Tracer::NameThread("split signer");
+                    FeeProducer fee = gc.fee;  // It has a random number generator, so one per thread
+                    fee.Reseed();
+                    CMutableTransaction tx;
+                    while (1)
+                    {
+                        size_t idx;
+                        {
+                            std::unique_lock<std::mutex> lock(cs);
+                            cv.wait(lock, [&] { return (nextChunk >= chunks.size()) || (buffered < window); });
+                            if (nextChunk >= chunks.size()) break;
+                            idx = nextChunk++;
+                            buffered++;
+                        }
+                        SplitChunk& ch = chunks[idx];
+                        auto txoIdx = txo.begin() + ch.begin * curSplit;
+                        for (auto u = utxo.begin() + ch.begin; u != utxo.begin() + ch.end; ++u)
+                        {
+                            auto txoStart = txoIdx;
+                            txoIdx += curSplit;
+                            if (createTx(tx, u, u+1, txoStart, txoIdx, fee()))
+                            {
+                                TRACE_SCOPE(SERIALIZE);
+                                CDataStream serializer(SER_NETWORK, PROTOCOL_VERSION);
+                                serializer << tx;
+                                ch.data.insert(ch.data.end(), serializer.begin(), serializer.end());
+                                ch.sizes.push_back(serializer.size());
+                            }
+                            else
+                                failed++;
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(cs);
+                            ch.ready = true;
+                        }
+                        cv.notify_all();
+                    }
+                }));
     }
 
-    uint64_t stopwatchEnd = GetStopwatch();
-    float elapsedTime = ((float)(stopwatchEnd-stopwatchStart))/1000000000.0;
+    for (unsigned int c = 0; c < conns.size(); c++)
+    {
+        thrds.push_back(thread([&, c] {
+                    Tracer::NameThread("split sender " + std::to_string(c));
+                    SimpleClient& sc = *conns[c];
+                    for (size_t idx : connChunks[c])
+                    {
+                        SplitChunk& ch = chunks[idx];
+                        {
+                            std::unique_lock<std::mutex> lock(cs);
+                            while (!ch.ready)
+                            {
+                                // Keep the connection serviced while waiting for the signers
+                                if (cv.wait_for(lock, std::chrono::milliseconds(1)) == std::cv_status::timeout)
+                                {
+                                    lock.unlock();
+                                    sc.FlushIfDue();
+                                    lock.lock();
+                                }
+                            }
+                        }
+                        const char* msg = ch.data.data();
+                        for (uint32_t size : ch.sizes)
+                        {
+                            sc.SendMessage(TX_MSG, msg, size);
+                            msg += size;
+                        }
+                        bool last;
+                        {
+                            std::lock_guard<std::mutex> lock(cs);
+                            last = (--ch.unsent == 0);
+                            if (last) buffered--;
+                        }
+                        if (last)
+                        {
+                            std::vector<char>().swap(ch.data);
+                            std::vector<uint32_t>().swap(ch.sizes);
+                            cv.notify_all();
+                        }
+                    }
+                    sc.FlushAll();
+                }));
+    }
 
+    for (auto &t : thrds)
     {
-        auto now = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetLogTimeMicros() / 1000000);
-        printf("%s: Ending %s to %s. Sent %lu tx in %6.2f sec, rate %6.2f tps\n", now.c_str(), name.c_str(), host.c_str(),count, elapsedTime, ((float)count)/elapsedTime);
+        t.join();
     }
+    if (failed) printf("%lu UTXOs didn't have enough balance\n", (uint64_t) failed);
 }
 
-class Schedule
+/** Wait until everything sent so far is confirmed, by running txCommitCmd or, if there is none, asking the user */
+void ConfirmSplit()
 {
-public:
-    vector<SchedulePhase> phases;
-
-    void Load(const UniValue& u)
+    if (gc.txCommitCmd.empty())
     {
-        phases.resize(u.size());
-        for(unsigned int idx=0; idx < u.size(); idx++)
-        {
-            const UniValue& uphase = u[idx];
-            phases[idx].Load(uphase);
-        }
+        printf("Generate a block to confirm the split so far <enter>\n");
+        string input;
+        cin >> input;
+        return;
+    }
+    printf("confirming the split so far: %s\n", gc.txCommitCmd.c_str());
+    int ret = system(gc.txCommitCmd.c_str());
+    if (ret != 0)
+    {
+        printf("txCommitCmd failed (%d)\n", ret);
+        exit(1);
     }
+}
 
-    /** execute this schedule of transaction generation with the inputs and outputs provided
-     *  If the inputs are exhausted, the vectors will be swapped.
-     */
-    void Execute(std::vector<UTXO>& utxo, std::vector<UTXO>& txo)
+/** Preparation phase: spend utxo in 1-to-many transactions, level by level, until there are at least gc.minUtxos
+    coins.  utxo is replaced by the final level's outputs.  The levels are planned (see SplitPlanner) to stay within
+    the node's unconfirmed chain limits, stopping to have the transactions confirmed where they would not.  Each level
+    is signed on gc.maxThreads threads while it is sent, over gc.splitConnections connections to the split hosts. */
+void SplitCoins(UtxoPool& utxo)
+{
+    printf("preparation: split coins\n");
+
+    std::vector<SplitPlanner::Level> plan;
+    try
+    {
+        plan = SplitPlanner::Plan(utxo.size(), gc.minUtxos, gc.splitPerTx, gc.limits);
+    }
+    catch (std::invalid_argument& e)
     {
-        // The simplest thing is just to create thread for every phase and target, and sleep the thread until it
-        // should run.
+        printf("Error: cannot split coins: %s\n", e.what());
+        exit(1);
+    }
+    unsigned int confirmations = 0;
+    for (auto& l : plan) confirmations += l.confirmAfter;
+    printf("split plan: %u levels, %u confirmations\n", (unsigned int) plan.size(), confirmations);
 
-        unsigned int numEntities = 0;  // Let's see how many we have
-        for(auto& p: phases)
-        {
-            numEntities += p.targets.size();
-        }
+    UtxoPool txo(keyRing);
+    unsigned int step = 1;
 
-        // This is inefficient in coins, but its simple to just split my utxos evenly among entities
-        unsigned int txoPerEntity = utxo.size()/numEntities;
+    std::vector<string> hosts = gc.splitHosts;
+    if (hosts.empty()) hosts.push_back(gc.bitcoind);
+    std::vector<std::unique_ptr<SimpleClient> > conns;
+    for (unsigned int c = 0; c < gc.splitConnections; c++)
+        conns.emplace_back(new SimpleClient(hosts[c % hosts.size()]));
+    // Which coins of the current level each connection sends.  Empty until there are enough coins to go around
+    std::vector<uint64_t> bounds;
 
-        vector<thread> thrds;
-        thrds.reserve(numEntities);
+    uint64_t start = GetStopwatch();
+    uint64_t createTxLoopStart = 0;
+    for (auto& level : plan)
+    {
+        unsigned int curSplit = level.split;
+        uint64_t stepSize = level.coins;
+        printf("Step %d: split %lu utxo into %lu, factor %u\n", step, (long unsigned int) utxo.size(), (long unsigned int) stepSize, curSplit);
 
-        auto utxoIt = utxo.begin();
-        auto txoIt = txo.begin();
-        for(auto& p: phases)
+        txo.resize(stepSize);
+        calcKeys(txo.begin(), txo.end());
+
+        if (bounds.empty() && (utxo.size() >= conns.size()))
         {
-            for (vector<ScheduleOp>::iterator t = p.targets.begin(); t != p.targets.end(); ++t)
-            {
-                thrds.push_back(thread( [=] {
-                            GenerateTxs(p.name, t->fee, p.startTime, p.endTime, t->host, t->rateBegin, t->rateEnd, utxoIt, txoIt, txoPerEntity);
-                        }));
-                utxoIt += txoPerEntity;
-                txoIt += txoPerEntity;
-            }
+            for (unsigned int c = 0; c <= conns.size(); c++) bounds.push_back(utxo.size() * c / conns.size());
         }
 
-        for (auto &t : thrds)
+        createTxLoopStart = GetStopwatch();
+        SplitLevel(utxo, txo, curSplit, bounds, conns);
+        Tracer::Get().Report("split step " + std::to_string(step));
+
+        txo.swap(utxo);  // get outputs I just created into utxo for the next loop
+        for (auto& b : bounds) b *= curSplit;  // Each connection's coins are the outputs of what it sent
+        step += 1;
+        if (level.confirmAfter)
         {
-            t.join();
+            // SplitLevel only handed the transactions to the kernel.  Wait until the node has processed them all,
+            // or the block would leave some of them out
+            std::vector<uint64_t> nonces;
+            for (auto& c : conns) nonces.push_back(c->Ping());
+            for (unsigned int c = 0; c < conns.size(); c++) conns[c]->WaitForPong(nonces[c]);
+            ConfirmSplit();
         }
     }
-};
+    txo.clear();
+    uint64_t end = GetStopwatch();
+    
+    printf("done in %f4.2 sec\n", ((float)(end-start))/1000000000.0);
+    printf("create tx loop in %6.2f sec\n", ((float)(end-createTxLoopStart))/1000000000.0);
+}
 
+/** Write the stage trace to traceFile, if one is configured */
+void WriteTrace()
+{
+    if (gc.traceFile.empty()) return;
+    if (Tracer::Get().WriteChrome(gc.traceFile))
+        printf("wrote stage trace to %s\n", gc.traceFile.c_str());
+}
 
 int main(int argc, char** argv)
 {
+    if ((argc > 1) && (strcmp(argv[1], "bench") == 0)) return Bench((argc > 2) ? argv[2] : "");
+
     UniValue config;
     try
     {
@@ -690,97 +3795,53 @@ int main(int argc, char** argv)
     }
 
     gc.Load(config["config"]);
+    Tracer::Capacity() = gc.traceEvents;
 
     SelectParams(gc.net);
     SHA256AutoDetect();
+    printf("batched tx hashing: %s\n", SHA256DMultiAutoDetect().c_str());
     ECC_Start();
+    ECCVerifyHandle verifyHandle;  // Signature checks (SchnorrSigner's, the sink's) need the verify context alive
     RandomInit();
 
-    std::vector<UTXO> utxo;
-    ParseInputCoins(config["coins"], utxo);
-
-    printf("preparation: split coins\n");
-
-    vector<UTXO> txo;
-    unsigned int stepSize = 0;
-    unsigned int step = 1;
-    SimpleClient sc(gc.bitcoind);
-
-    uint64_t start = GetStopwatch();
-    uint64_t createTxLoopStart = 0;
-    while (stepSize < gc.minUtxos)
+    if (gc.corpusMode == "replay")  // Everything was signed ahead of time, so no coins or keys are needed
     {
-        // Split by the maximum allowed per tx, or by the minimum needed to get beyond our gc.minUtxos choice
-        unsigned int curSplit = 1;
-        if (gc.minUtxos/utxo.size() < gc.splitPerTx)
-        {
-            curSplit = (gc.minUtxos/utxo.size())+1;
-        }
-        else
-        {
-            curSplit = gc.splitPerTx;
-        }
-
-        stepSize = utxo.size()*curSplit;
-        printf("Step %d: split %lu utxo into %lu, factor %u\n", step, (long unsigned int) utxo.size(), (long unsigned int) stepSize, curSplit);
-
-        txo.resize(stepSize);
-        if ((gc.maxThreads > 1)&&(stepSize > gc.maxThreads*100))
-        {
-            int threadedStep = stepSize/gc.maxThreads;
-            vector<thread> thrds;
-            thrds.reserve(gc.maxThreads);
-            auto st = txo.begin();
-            for (unsigned int t = 0; t<gc.maxThreads; t++)
-            {
-                auto end = st + threadedStep;
-                thrds.push_back(thread([st, end] { calcKeys(st, end); }));
-                st = end;
-            }
-            // Do whatever was missed in this thread
-            calcKeys(st, txo.end());
-            for (auto &t : thrds)
-            {
-                t.join();
-            }
-        }
-        else
+        if (!config.exists("schedule"))
         {
-            calcKeys(txo.begin(), txo.end());
+            printf("Error: replaying a corpus needs a 'schedule'\n");
+            return -1;
         }
+        TxCorpus corpus;
+        if (!corpus.Open(gc.corpusFile, gc.msgStart)) return -1;
+        Schedule sched;
+        sched.Load(config["schedule"]);
+        bool ok = sched.Replay(corpus);
+        WriteTrace();
+        return ok ? 0 : -1;
+    }
 
-        auto txoIdx = txo.begin();
-
-        createTxLoopStart = GetStopwatch();
-        CMutableTransaction tx;
-        for(vector<UTXO>::iterator u = utxo.begin(); u != utxo.end(); ++u)
-        {
-            auto txoStart = txoIdx;
-            txoIdx += curSplit;
-            bool worked = createTx(tx, u, u+1, txoStart, txoIdx, gc.fee());
-            if (worked)
-            {
-                // printf("%s\n", EncodeHexTx(tx).c_str());
-                //printf("%s\n", tx.GetHash().ToString().c_str());
-                CDataStream serializer(SER_NETWORK, PROTOCOL_VERSION);
-                serializer << tx;
-                sc.SendMessage(TX_MSG, serializer.data(), serializer.size());
-            }
-            else
-            {
-                printf("UTXO didn't have enough balance\n");
-            }
-        }
+    UtxoPool utxo(keyRing);
+    if (!gc.loadCoins.empty())
+    {
+        uint64_t loadStart = GetStopwatch();
+        if (!CoinSnapshot::Load(gc.loadCoins, utxo, keyRing, gc.msgStart, gc.maxThreads)) return -1;
+        printf("loaded %lu coins from %s in %6.2f sec, key seed: %s\n", (long unsigned int) utxo.size(), gc.loadCoins.c_str(), ((float)(GetStopwatch()-loadStart))/1000000000.0, keyRing.Seed().GetHex().c_str());
+    }
+    else
+    {
+        if (!gc.keySeedSet) GetStrongRandBytes(gc.keySeed.begin(), 32);
+        printf("key seed: %s\n", gc.keySeed.GetHex().c_str());
+        uint64_t keyStart = GetStopwatch();
+        keyRing.Generate(gc.keySeed, gc.keyRingSize, gc.maxThreads);
+        printf("derived %u keys in %6.2f sec\n", keyRing.Derived(), ((float)(GetStopwatch()-keyStart))/1000000000.0);
 
-        std::swap(txo,utxo);  // get outputs I just created into utxo for the next loop
-        step += 1;
+        ParseInputCoins(config["coins"], utxo);
+        SplitCoins(utxo);
+        if (!gc.saveSplitCoins.empty() && CoinSnapshot::Save(gc.saveSplitCoins, utxo, keyRing, gc.msgStart))
+            printf("saved split coins to %s\n", gc.saveSplitCoins.c_str());
     }
-    uint64_t end = GetStopwatch();
-    
-    printf("done in %f4.2 sec\n", ((float)(end-start))/1000000000.0);
-    printf("create tx loop in %6.2f sec\n", ((float)(end-createTxLoopStart))/1000000000.0);
 
-    txo = utxo;  // Copy the vector to send to myself
+    printf("%lu coins, %lu MB\n", (long unsigned int) utxo.size(), (long unsigned int) (utxo.Bytes() >> 20));
 
     // If the "schedule" object exists, load a defined generation sequence.
     // Otherwise we'll run as fast as possible later.
@@ -790,58 +3851,378 @@ int main(int argc, char** argv)
     bool runAschedule = config.exists("schedule");
     if (runAschedule) sched.Load(config["schedule"]);
 
-    // utxo is what's unspent, txo is where the coins are going
-    if (runAschedule)
-        sched.Execute(utxo, txo);
+    // utxo is what's unspent.  Each transaction's output takes the place of the coin it spent
+    if (gc.corpusMode == "generate")
+    {
+        if (!runAschedule)
+        {
+            printf("Error: generating a corpus needs a 'schedule'\n");
+            return -1;
+        }
+        if (!sched.Generate(utxo, gc.corpusFile)) return -1;
+    }
+    else if (runAschedule)
+        sched.Execute(utxo);
     else
     {
         printf("Generate a block <enter>\n");
         string input;
         cin >> input;
-        MaxSpeed(gc.bitcoind, utxo, txo);
+        MaxSpeed(gc.bitcoind, utxo);
     }
 
+    if (!gc.saveFinalCoins.empty() && CoinSnapshot::Save(gc.saveFinalCoins, utxo, keyRing, gc.msgStart))
+        printf("saved remaining coins to %s\n", gc.saveFinalCoins.c_str());
+    WriteTrace();
 }
 
-void MaxSpeed(const string& host, vector<UTXO>& utxo, vector<UTXO>& txo)
+/** Sends a range of coins' transactions over an AsyncPeer as fast as it will take them, building more whenever the
+    connection has written everything it was given.  Used by MaxSpeed when ioThreads is set. */
+class AsyncSpammer
+{
+    std::shared_ptr<AsyncPeer> peer;
+    CoinIter uit;
+    CoinIter end;
+    P2PKHSpendBatch batch;
+    std::unique_ptr<SchnorrSigner> signer;
+    FeeProducer fee;  // Spammers on different io threads can't share gc.fee
+
+public:
+    AsyncSpammer(boost::asio::io_service& ios, const string& host, CoinIter st, CoinIter _end):
+        peer(std::make_shared<AsyncPeer>(ios, host)), uit(st), end(_end), fee(gc.fee)
+    {
+        fee.Reseed();
+        signer = MakeSigner(gc.sigType);
+        batch.UseSchnorr(signer.get());
+        peer->onDrained = [this] { Fill(); };
+        peer->Connect();
+        ios.post([this] { Fill(); });
+    }
+
+    void Fill()
+    {
+        // Keep about half the queue bound waiting so the next write is ready as soon as the current one finishes
+        while ((uit != end) && (peer->QueueDepth() < peer->maxQueueBytes/2))
+        {
+            unsigned int n = std::min((long int) gc.hashBatch, (long int) (end - uit));
+            n = batch.Build(uit, uit, n, fee);
+            uit += n;
+            for (unsigned int j = 0; j < n; j++)
+            {
+                if (batch.ok[j])
+                    peer->SendMessage(TX_MSG, batch.txs[j].data(), batch.txs[j].size());
+                else
+                    printf("UTXO didn't have enough balance or isn't compressed P2PKH\n");
+            }
+        }
+        if (uit == end) peer->Close();
+    }
+};
+
+void MaxSpeed(const string& host, UtxoPool& coins)
 {
     unsigned int step = 0;
 
     while(step < 20)
     {
         printf("Iteration %d: spam P2PKH\n", step);
-        assert(txo.size() == utxo.size());
-        int stepSize = utxo.size();
+        int stepSize = coins.size();
         int threadedStep = stepSize/gc.maxThreads;
-        auto st = txo.begin();
-        auto utxoSt = utxo.begin();
+        auto utxoSt = coins.begin();
         uint64_t start = GetStopwatch();
         vector<thread> thrds;
+        if (gc.ioThreads > 0)  // maxThreads connections sharing ioThreads threads
+        {
+            IoPool pool(gc.ioThreads);
+            vector<unique_ptr<AsyncSpammer> > spammers;
+            unsigned int conns = std::max(gc.maxThreads, 1U);
+            int perConn = stepSize/conns;
+            for (unsigned int c = 0; c < conns; c++)
+            {
+                auto utxoEnd = (c == conns-1) ? coins.end() : utxoSt + perConn;
+                spammers.emplace_back(new AsyncSpammer(pool.Next(), host, utxoSt, utxoEnd));
+                utxoSt = utxoEnd;
+            }
+            pool.Run();
+        }
+        else
+        {
         if (gc.maxThreads > 1)
         {
         thrds.reserve(gc.maxThreads);
         for (unsigned int t = 0; t<gc.maxThreads; t++)
         {
-            auto end = st + threadedStep;
             auto utxoEnd = utxoSt + threadedStep;
-            thrds.push_back(thread([host, utxoSt, utxoEnd, st] { SimpleClient sct(host); sendP2PKH(sct, utxoSt, utxoEnd, st); }));
-            st = end;
+            thrds.push_back(thread([host, utxoSt, utxoEnd] { SimpleClient sct(host); sendP2PKH(sct, utxoSt, utxoEnd); }));
             utxoSt = utxoEnd;
         }
         }
         // Do whatever was missed in this thread
         SimpleClient sc(host);
-        sendP2PKH(sc, utxoSt, utxo.end(), st);
+        sendP2PKH(sc, utxoSt, coins.end());
         if (gc.maxThreads > 1) for (auto &t : thrds)
         {
             t.join();
         }
+        }
         uint64_t end = GetStopwatch();
         float elapsedTime = ((float)(end-start))/1000000000.0;
         printf("Done in %6.2f sec. Rate %8.2f \n", elapsedTime, ((float) stepSize)/elapsedTime );
+        Tracer::Get().Report("max speed step " + std::to_string(step));
 
-        std::swap(txo,utxo);  // get outputs I just created into utxo for the next loop
-        step += 1;
+        step += 1;  // the outputs I just created are now in coins for the next loop
+    }
+}
+
+/** The coins the bench has spent, so that its sink can check the signatures of what it receives */
+class BenchLedger
+{
+    class Spent
+    {
+    public:
+        uint64_t satoshi;
+        uint32_t keyIdx;
+    };
+
+    std::mutex cs;
+    std::map<COutPoint, Spent> spent;
+    SighashEngine sighasher;  // Only used by the sink's thread
+
+public:
+    /** Record that a transaction spending coin is about to be sent */
+    void Spend(const UtxoPool::Coin& coin)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        spent[coin.prevout()] = Spent{coin.satoshi(), coin.keyIdx()};
+    }
+
+    /** Deserialize a transaction and check that each input is a valid signature by the key of a coin we spent */
+    bool Verify(const unsigned char* data, uint32_t size)
+    {
+        CMutableTransaction tx;
+        try
+        {
+            CDataStream stream((const char*) data, (const char*) data + size, SER_NETWORK, PROTOCOL_VERSION);
+            stream >> tx;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        sighasher.Begin(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+        {
+            Spent coin;
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                auto it = spent.find(tx.vin[i].prevout);
+                if (it == spent.end()) return false;
+                coin = it->second;
+                spent.erase(it);
+            }
+            const KeyRing::Key& key = keyRing[coin.keyIdx];
+
+            // A P2PKH scriptSig is two pushes: the signature (with its sighash type) and the public key
+            const CScript& ss = tx.vin[i].scriptSig;
+            if (ss.empty() || (ss[0] + 2u > ss.size())) return false;
+            std::vector<unsigned char> sig(ss.begin() + 1, ss.begin() + 1 + ss[0]);
+            size_t pubAt = 1 + ss[0];
+            if ((ss[pubAt] + pubAt + 1 != ss.size()) || (ss[pubAt] != key.pub.size()) ||
+                !std::equal(key.pub.begin(), key.pub.end(), ss.begin() + pubAt + 1))
+                return false;
+            if (sig.empty() || (sig.back() != (SIGHASH_ALL | SIGHASH_FORKID))) return false;
+            sig.pop_back();
+
+            CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << ToByteVector(key.id) << OP_EQUALVERIFY << OP_CHECKSIG;
+            uint256 sighash = sighasher.Input(i, scriptCode, coin.satoshi);
+            if (!((sig.size() == 64) ? key.pub.VerifySchnorr(sighash, sig) : key.pub.VerifyECDSA(sighash, sig)))
+                return false;
+        }
+        return true;
+    }
+};
+
+/** Runs a benchmark over and over for about a second, and prints how long each operation took */
+class BenchRunner
+{
+public:
+    static const uint64_t RUN_NS = 1000000000;
+
+    string filter;  // Only run benchmarks whose names contain this
+
+    bool Wanted(const char* name) const { return filter.empty() || strstr(name, filter.c_str()); }
+
+    void Print(const char* name, uint64_t ops, uint64_t ns)
+    {
+        double perOp = ops ? (double) ns / ops : 0;
+        printf("%-28s %12.1f ns/op %12.0f op/s %10lu ops\n", name, perOp, perOp ? 1e9 / perOp : 0, ops);
+    }
+
+    /** Time fn, each call of which does opsPerCall operations */
+    template <typename Fn> void Run(const char* name, uint64_t opsPerCall, Fn fn)
+    {
+        if (!Wanted(name)) return;
+        fn();  // Warm up
+        uint64_t ops = 0;
+        uint64_t start = GetStopwatch();
+        uint64_t now = start;
+        while (now - start < RUN_NS)
+        {
+            fn();
+            ops += opsPerCall;
+            now = GetStopwatch();
+        }
+        Print(name, ops, now - start);
+    }
+};
+
+/** Make qty coins worth satoshi each, spread over the key ring, with made up txids */
+void BenchCoins(UtxoPool& coins, size_t qty, uint64_t satoshi)
+{
+    uint256 txid;
+    for (size_t i = 0; i < qty; i++)
+    {
+        GetRandBytes(txid.begin(), 32);
+        coins.push_back(txid, 0, satoshi, i % keyRing.size(), ScriptType::P2PKH);
     }
 }
 
+/** Generate transactions for a second into a SimpleClient connected to sink, as GenerateTxs would with no pacing,
+    and time how long it takes the sink to receive them all */
+void BenchGenerate(BenchRunner& bench, const char* name, P2PSink& sink, UtxoPool& coins, BenchLedger* ledger)
+{
+    if (!bench.Wanted(name)) return;
+    SimpleClient sc("127.0.0.1:" + std::to_string(sink.Port()));
+    sc.batch.maxCount = 64;
+    P2PKHSpendBatch batch;
+    FeeProducer fee(1);
+    uint64_t before = sink.txs;
+    uint64_t sent = 0;
+    CoinIter uit = coins.begin();
+    uint64_t start = GetStopwatch();
+    while (GetStopwatch() - start < BenchRunner::RUN_NS)
+    {
+        unsigned int n = std::min((long int) gc.hashBatch, (long int) (coins.end() - uit));
+        if (ledger)
+            for (unsigned int j = 0; j < n; j++) ledger->Spend(*(uit + j));
+        n = batch.Build(uit, uit, n, fee);
+        for (unsigned int j = 0; j < n; j++)
+        {
+            if (!batch.ok[j]) continue;
+            sc.SendMessage(TX_MSG, batch.txs[j].data(), batch.txs[j].size());
+            sent++;
+        }
+        uit += n;
+        if (uit == coins.end()) uit = coins.begin();  // Spend our own outputs, as chains
+    }
+    sc.FlushAll();
+    if (!sink.WaitFor(before + sent, 60000)) printf("%s: the sink only got %lu of %lu\n", name, (uint64_t) sink.txs - before, sent);
+    bench.Print(name, sent, GetStopwatch() - start);
+}
+
+int Bench(const string& filter)
+{
+    SelectParams(gc.net);
+    SHA256AutoDetect();
+    printf("batched tx hashing: %s\n", SHA256DMultiAutoDetect().c_str());
+    ECC_Start();
+    ECCVerifyHandle verifyHandle;  // Signature checks (SchnorrSigner's, the sink's) need the verify context alive
+    RandomInit();
+    {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        string line;
+        while (std::getline(cpuinfo, line))
+            if (line.compare(0, 10, "model name") == 0)
+            {
+                printf("%s\n", line.c_str());
+                break;
+            }
+    }
+
+    uint256 seed;
+    GetStrongRandBytes(seed.begin(), 32);
+    keyRing.Generate(seed, 1024, gc.maxThreads);
+    UtxoPool coins(keyRing);
+    BenchCoins(coins, 100000, 100000000);
+    UtxoPool outs(keyRing);
+    BenchCoins(outs, gc.splitPerTx, 0);
+
+    BenchRunner bench;
+    bench.filter = filter;
+    CMutableTransaction tx;
+    CoinIter in = coins.begin();
+    CoinIter out = outs.begin();
+
+    // The generic path, used to split coins
+    bench.Run("createTx 1x1", 1, [&] { CoinIter o = in; createTx(tx, in, in + 1, o, in + 1, 1); });
+    string splitName = "createTx 1x" + std::to_string(gc.splitPerTx);
+    bench.Run(splitName.c_str(), 1, [&] { CoinIter o = out; createTx(tx, in, in + 1, o, outs.end(), 1); });
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    createTx(tx, in, in + 1, out, outs.end(), 1);
+    string serName = "serialize 1x" + std::to_string(gc.splitPerTx);
+    bench.Run(serName.c_str(), 1, [&] { stream.clear(); stream << tx; });
+    createTx(tx, in, in + 1, out, out + 1, 1);
+    bench.Run("serialize 1x1", 1, [&] { stream.clear(); stream << tx; });
+    SighashEngine sighasher;
+    CScript scriptCode = in->constraintScript();
+    uint256 sighash;
+    bench.Run("sighash 1x1", 1, [&] { sighasher.Begin(tx); sighash = sighasher.Input(0, scriptCode, in->satoshi()); });
+
+    // Signing
+    std::vector<unsigned char> sig;
+    bench.Run("sign ecdsa", 1, [&] { in->privKey().SignECDSA(sighash, sig); });
+    bench.Run("sign schnorr", 1, [&] { in->privKey().SignSchnorr(sighash, sig); });
+
+    // The hot path: transaction templates
+    P2PKHSpend txb;
+    CoinIter uit = coins.begin();
+    FeeProducer fee(1);
+    auto next = [&](unsigned int n) {
+        uit += n;
+        if (coins.end() - uit < (long int) n) uit = coins.begin();
+    };
+    bench.Run("template 1x1", 1, [&] { txb.Build(uit, uit, fee()); next(1); });
+    P2PKHSpendBatch batch;
+    string batchName = "template batch of " + std::to_string(gc.hashBatch);
+    bench.Run(batchName.c_str(), gc.hashBatch, [&] { batch.Build(uit, uit, gc.hashBatch, fee); next(gc.hashBatch); });
+    std::unique_ptr<SchnorrSigner> signer = MakeSigner(SigType::SCHNORR);
+    txb.schnorr = signer.get();
+    bench.Run("template 1x1 schnorr", 1, [&] { txb.Build(uit, uit, fee()); next(1); });
+    txb.schnorr = nullptr;
+
+    // Sending, to a sink on the loopback interface
+    P2PSink sink(gc.msgStart);
+    sink.Start();
+    if (bench.Wanted("SendMessage"))
+    {
+        SimpleClient sc("127.0.0.1:" + std::to_string(sink.Port()));
+        txb.Build(uit, uit, fee());
+        for (unsigned int batchCount : {1U, 64U})
+        {
+            sc.batch.maxCount = batchCount;
+            uint64_t before = sink.txs;
+            uint64_t sent = 0;
+            uint64_t start = GetStopwatch();
+            while (GetStopwatch() - start < BenchRunner::RUN_NS)
+            {
+                sc.SendMessage(TX_MSG, txb.data(), txb.size());
+                sent++;
+            }
+            sc.FlushAll();
+            sink.WaitFor(before + sent, 60000);
+            string name = "SendMessage batch " + std::to_string(batchCount);
+            bench.Print(name.c_str(), sent, GetStopwatch() - start);
+        }
+    }
+    BenchGenerate(bench, "generate to sink", sink, coins, nullptr);
+    sink.Stop();
+
+    BenchLedger ledger;
+    P2PSink checker(gc.msgStart);
+    checker.verify = [&ledger](const unsigned char* data, uint32_t size) { return ledger.Verify(data, size); };
+    checker.Start();
+    BenchGenerate(bench, "generate to verifying sink", checker, coins, &ledger);
+    checker.Stop();
+    if (checker.invalid) printf("The sink found %lu invalid transactions\n", (uint64_t) checker.invalid);
+    return checker.invalid ? -1 : 0;
+}
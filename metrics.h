@@ -0,0 +1,237 @@
+#ifndef TXUNAMI_METRICS_H
+#define TXUNAMI_METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/** One schedule target's live counters.  Each is written only by the target's sending thread, with relaxed stores of
+    values it already keeps, so publishing costs a few uncontended stores and no locks.  The MetricsRegistry reads
+    them once a second. */
+class TargetMetrics
+{
+public:
+    /** How often (ns) a sender publishes its counters.  Finer than the registry's sampling so samples aren't stale */
+    static const uint64_t PUBLISH_NS = 100000000;
+
+    const std::string phase;
+    const std::string host;
+
+    std::atomic<uint64_t> txs{0};  // Transactions sent
+    std::atomic<uint64_t> built{0};  // Transactions signed
+    std::atomic<uint64_t> signNs{0};  // Time spent building and signing them
+    std::atomic<uint64_t> bytesSent{0};
+    std::atomic<uint64_t> writeCalls{0};
+    std::atomic<uint64_t> partialWrites{0};
+    std::atomic<uint64_t> reconnects{0};
+    std::atomic<uint64_t> queueFull{0};
+    std::atomic<uint64_t> stallNs{0};
+    std::atomic<uint64_t> skipped{0};  // Sends the pacer skipped to catch up
+    std::atomic<uint64_t> queuedBytes{0};  // Outbound queue depth now
+    std::atomic<uint64_t> ringDepth{0};  // Signed transactions waiting for the sender now
+    std::atomic<double> targetRate{0};  // Where the pacer's ramp is now (tx/sec)
+    std::atomic<bool> active{true};  // Cleared when the target ends
+
+    TargetMetrics(const std::string& _phase, const std::string& _host) : phase(_phase), host(_host) {}
+
+    /** Is it time to publish again?  Only call from the owning thread */
+    bool Due(uint64_t now)
+    {
+        if (now < nextPublish) return false;
+        nextPublish = now + PUBLISH_NS;
+        return true;
+    }
+
+    /** Publish a counter the owning thread keeps */
+    static void Set(std::atomic<uint64_t>& counter, uint64_t value) { counter.store(value, std::memory_order_relaxed); }
+
+protected:
+    uint64_t nextPublish = 0;
+};
+
+/** Every target's TargetMetrics, sampled once a second into rates.  The samples are formatted as Prometheus text
+    exposition format (for scraping) and as a JSON line (for a log).  Sample and the formatters are called from one
+    thread only. */
+class MetricsRegistry
+{
+protected:
+    /** The counters as of the previous sample, to turn into rates */
+    class Prev
+    {
+    public:
+        uint64_t txs = 0;
+        uint64_t built = 0;
+        uint64_t signNs = 0;
+        uint64_t bytesSent = 0;
+    };
+
+    /** One target as of the latest sample */
+    class Row
+    {
+    public:
+        std::shared_ptr<TargetMetrics> m;
+        Prev prev;
+        Prev cur;
+        uint64_t writeCalls, partialWrites, reconnects, queueFull, stallNs, skipped, queuedBytes, ringDepth;
+        double targetRate, tps, bps, signUsPerTx;
+        bool active;
+        bool reported = false;  // The sample after it ended has been logged
+    };
+
+    std::mutex cs;  // Guards added, which the targets' threads add to
+    std::vector<std::shared_ptr<TargetMetrics> > added;
+    std::vector<Row> rows;
+    uint64_t lastSample = 0;
+    uint64_t sampleTime = 0;  // Unix time (ms) of the latest sample
+
+    static std::string Escape(const std::string& s)
+    {
+        std::string ret;
+        for (char c : s)
+        {
+            if ((c == '"') || (c == '\\')) ret += '\\';
+            if (c == '\n')
+                ret += "\\n";
+            else
+                ret += c;
+        }
+        return ret;
+    }
+
+public:
+    /** Counters for a new target.  Thread safe */
+    std::shared_ptr<TargetMetrics> Add(const std::string& phase, const std::string& host)
+    {
+        auto ret = std::make_shared<TargetMetrics>(phase, host);
+        std::lock_guard<std::mutex> lock(cs);
+        added.push_back(ret);
+        return ret;
+    }
+
+    /** Read every target's counters at stopwatch time now (ns), unix time nowMs, and work out rates since the last
+        sample */
+    void Sample(uint64_t now, uint64_t nowMs)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            for (auto& m : added)
+            {
+                rows.push_back(Row());
+                rows.back().m = m;
+            }
+            added.clear();
+        }
+        double secs = (lastSample && (now > lastSample)) ? (now - lastSample) / 1e9 : 0;
+        lastSample = now;
+        sampleTime = nowMs;
+        auto get = [](const std::atomic<uint64_t>& a) { return a.load(std::memory_order_relaxed); };
+        for (auto& r : rows)
+        {
+            const TargetMetrics& m = *r.m;
+            r.active = m.active.load(std::memory_order_relaxed);
+            r.prev = r.cur;
+            r.cur.txs = get(m.txs);
+            r.cur.built = get(m.built);
+            r.cur.signNs = get(m.signNs);
+            r.cur.bytesSent = get(m.bytesSent);
+            r.writeCalls = get(m.writeCalls);
+            r.partialWrites = get(m.partialWrites);
+            r.reconnects = get(m.reconnects);
+            r.queueFull = get(m.queueFull);
+            r.stallNs = get(m.stallNs);
+            r.skipped = get(m.skipped);
+            r.queuedBytes = get(m.queuedBytes);
+            r.ringDepth = get(m.ringDepth);
+            r.targetRate = r.active ? m.targetRate.load(std::memory_order_relaxed) : 0;
+            r.tps = secs ? (r.cur.txs - r.prev.txs) / secs : 0;
+            r.bps = secs ? (r.cur.bytesSent - r.prev.bytesSent) / secs : 0;
+            uint64_t built = r.cur.built - r.prev.built;
+            r.signUsPerTx = built ? (r.cur.signNs - r.prev.signNs) / 1000.0 / built : 0;
+        }
+    }
+
+    /** The latest sample in Prometheus text format */
+    std::string Prometheus() const
+    {
+        class Metric
+        {
+        public:
+            const char* name;
+            const char* type;
+            const char* help;
+            std::function<double(const Row&)> value;
+        };
+        static const std::vector<Metric> metrics = {
+            {"txunami_txs_sent_total", "counter", "Transactions sent", [](const Row& r) { return (double) r.cur.txs; }},
+            {"txunami_txs_per_second", "gauge", "Transactions sent per second over the last sample", [](const Row& r) { return r.tps; }},
+            {"txunami_target_txs_per_second", "gauge", "The rate the schedule asks for now", [](const Row& r) { return r.targetRate; }},
+            {"txunami_txs_signed_total", "counter", "Transactions built and signed", [](const Row& r) { return (double) r.cur.built; }},
+            {"txunami_sign_seconds_total", "counter", "Time spent building and signing transactions", [](const Row& r) { return r.cur.signNs / 1e9; }},
+            {"txunami_sent_bytes_total", "counter", "Bytes written to the node", [](const Row& r) { return (double) r.cur.bytesSent; }},
+            {"txunami_write_calls_total", "counter", "Write syscalls", [](const Row& r) { return (double) r.writeCalls; }},
+            {"txunami_partial_writes_total", "counter", "Writes the socket took only part of", [](const Row& r) { return (double) r.partialWrites; }},
+            {"txunami_reconnects_total", "counter", "Connections reestablished", [](const Row& r) { return (double) r.reconnects; }},
+            {"txunami_queue_full_total", "counter", "Sends that waited for room in the outbound queue", [](const Row& r) { return (double) r.queueFull; }},
+            {"txunami_stall_seconds_total", "counter", "Time spent waiting for room in the outbound queue", [](const Row& r) { return r.stallNs / 1e9; }},
+            {"txunami_skipped_total", "counter", "Sends skipped because the sender fell behind", [](const Row& r) { return (double) r.skipped; }},
+            {"txunami_queued_bytes", "gauge", "Bytes waiting in the outbound queue", [](const Row& r) { return (double) r.queuedBytes; }},
+            {"txunami_signed_waiting", "gauge", "Signed transactions waiting for the sender", [](const Row& r) { return (double) r.ringDepth; }},
+            {"txunami_target_active", "gauge", "1 while the target is running", [](const Row& r) { return r.active ? 1.0 : 0.0; }},
+        };
+
+        std::string ret;
+        char buf[100];
+        for (const Metric& m : metrics)
+        {
+            ret += std::string("# HELP ") + m.name + " " + m.help + "\n# TYPE " + m.name + " " + m.type + "\n";
+            for (const Row& r : rows)
+            {
+                snprintf(buf, sizeof(buf), "%.17g", m.value(r));
+                ret += std::string(m.name) + "{phase=\"" + Escape(r.m->phase) + "\",host=\"" + Escape(r.m->host) +
+                    "\"} " + buf + "\n";
+            }
+        }
+        return ret;
+    }
+
+    /** The latest sample as one line of JSON: the time, totals, and each target that was running during it */
+    std::string JsonLine()
+    {
+        std::string targets;
+        double tps = 0, targetRate = 0, bps = 0;
+        uint64_t queued = 0, reconnects = 0, partial = 0;
+        char buf[600];
+        for (Row& r : rows)
+        {
+            tps += r.tps;
+            targetRate += r.targetRate;
+            bps += r.bps;
+            queued += r.queuedBytes;
+            reconnects += r.reconnects;
+            partial += r.partialWrites;
+            if (r.reported) continue;
+            r.reported = !r.active;  // Its last numbers are logged once more after it ends
+            targets += std::string(targets.empty() ? "" : ",") + "{\"phase\":\"" + Escape(r.m->phase) + "\",\"host\":\"" +
+                Escape(r.m->host) + "\",";
+            snprintf(buf, sizeof(buf), "\"active\":%s,\"txs\":%lu,\"tps\":%.1f,"
+                     "\"targetTps\":%.1f,\"signed\":%lu,\"signUsPerTx\":%.2f,\"bytes\":%lu,\"bytesPerSec\":%.0f,"
+                     "\"writes\":%lu,\"partialWrites\":%lu,\"reconnects\":%lu,\"queueFull\":%lu,\"stallSec\":%.3f,"
+                     "\"skipped\":%lu,\"queuedBytes\":%lu,\"signedWaiting\":%lu}",
+                     r.active ? "true" : "false", r.cur.txs, r.tps, r.targetRate, r.cur.built, r.signUsPerTx,
+                     r.cur.bytesSent, r.bps, r.writeCalls, r.partialWrites, r.reconnects, r.queueFull,
+                     r.stallNs / 1e9, r.skipped, r.queuedBytes, r.ringDepth);
+            targets += buf;
+        }
+        snprintf(buf, sizeof(buf), "{\"time\":%lu.%03lu,\"tps\":%.1f,\"targetTps\":%.1f,\"bytesPerSec\":%.0f,"
+                 "\"queuedBytes\":%lu,\"reconnects\":%lu,\"partialWrites\":%lu,\"targets\":[",
+                 sampleTime / 1000, sampleTime % 1000, tps, targetRate, bps, queued, reconnects, partial);
+        return buf + targets + "]}";
+    }
+};
+
+#endif
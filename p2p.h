@@ -0,0 +1,281 @@
+#ifndef TXUNAMI_P2P_H
+#define TXUNAMI_P2P_H
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/** The P2P protocol version we claim.  Nodes only send feefilter to peers at 70013 or later */
+static const int32_t TXUNAMI_PROTOCOL_VERSION = 70015;
+static const char* const TXUNAMI_USER_AGENT = "/txunami:0.2/";
+
+static const char TX_MSG[12] = {'t','x',0,0, 0,0,0,0, 0,0,0,0};
+static const char VERACK_MSG[12] = {'v','e','r','a', 'c','k',0,0, 0,0,0,0};
+static const char VER_MSG[12] = {'v','e','r','s', 'i','o','n',0, 0,0,0,0};
+static const char PING_MSG[12] = {'p','i','n','g', 0,0,0,0, 0,0,0,0};
+static const char PONG_MSG[12] = {'p','o','n','g', 0,0,0,0, 0,0,0,0};
+static const char INV_MSG[12] = {'i','n','v',0, 0,0,0,0, 0,0,0,0};
+static const char GETDATA_MSG[12] = {'g','e','t','d', 'a','t','a',0, 0,0,0,0};
+static const char NOTFOUND_MSG[12] = {'n','o','t','f', 'o','u','n','d', 0,0,0,0};
+
+/** The payload of a version message to a peer at ip (16 bytes, IPv4 addresses mapped into IPv6) and port.
+    We offer no services.  Unless relay is set, we ask not to be told about transactions, since we would only
+    throw the announcements away. */
+inline std::vector<unsigned char> VersionPayload(const unsigned char* ip, uint16_t port, uint64_t nonce, int64_t now,
+                                                 bool relay = false)
+{
+    std::vector<unsigned char> ret;
+    auto put = [&ret](const void* p, size_t len) {
+        ret.insert(ret.end(), (const unsigned char*)p, (const unsigned char*)p + len);
+    };
+    uint64_t noServices = 0;
+    unsigned char portBE[2] = {(unsigned char)(port >> 8), (unsigned char)port};
+    unsigned char anyIp[16] = {0};
+
+    put(&TXUNAMI_PROTOCOL_VERSION, 4);
+    put(&noServices, 8);
+    put(&now, 8);
+    put(&noServices, 8);  // addr_recv
+    put(ip, 16);
+    put(portBE, 2);
+    put(&noServices, 8);  // addr_from: unknown
+    put(anyIp, 16);
+    put(anyIp, 2);
+    put(&nonce, 8);
+    unsigned char agentLen = strlen(TXUNAMI_USER_AGENT);
+    put(&agentLen, 1);
+    put(TXUNAMI_USER_AGENT, agentLen);
+    int32_t startHeight = 0;
+    put(&startHeight, 4);
+    ret.push_back(relay ? 1 : 0);
+    return ret;
+}
+
+/** What a connection has heard from its peer */
+class InboundStats
+{
+public:
+    /** Distinct reject reasons tracked before the rest are lumped together */
+    static const size_t MAX_REASONS = 16;
+
+    uint64_t msgs = 0;
+    uint64_t pings = 0;  // Answered with a pong
+    uint64_t feeFilter = 0;  // The peer's latest feefilter (sat/kB), 0 if none
+    uint64_t rejects = 0;
+    std::map<std::string, uint64_t> rejectReasons;
+    bool sendHeaders = false;
+    int32_t peerVersion = 0;
+    std::string peerAgent;
+
+    void Reject(const std::string& reason, uint64_t n = 1)
+    {
+        rejects += n;
+        if ((rejectReasons.size() < MAX_REASONS) || rejectReasons.count(reason))
+            rejectReasons[reason] += n;
+        else
+            rejectReasons["(other)"] += n;
+    }
+
+    InboundStats& operator+=(const InboundStats& o)
+    {
+        msgs += o.msgs;
+        pings += o.pings;
+        feeFilter = std::max(feeFilter, o.feeFilter);
+        for (auto& r : o.rejectReasons) Reject(r.first, r.second);
+        sendHeaders |= o.sendHeaders;
+        if (peerAgent.empty())
+        {
+            peerVersion = o.peerVersion;
+            peerAgent = o.peerAgent;
+        }
+        return *this;
+    }
+
+    std::string ToString() const
+    {
+        char buf[200];
+        snprintf(buf, sizeof(buf), "peer %s (%d), %lu msgs received, %lu pings answered, feefilter %lu sat/kB, %lu rejects",
+                 peerAgent.c_str(), peerVersion, msgs, pings, feeFilter, rejects);
+        std::string ret = buf;
+        const char* sep = ": ";
+        for (auto& r : rejectReasons)
+        {
+            ret += sep + r.first + " " + std::to_string(r.second);
+            sep = ", ";
+        }
+        return ret;
+    }
+};
+
+/** The receiving half of a minimal P2P protocol layer.  Bytes read from the socket are fed in, in whatever pieces
+    they arrive, and are split into messages.  Pings are answered (through reply), and the peer's version, verack,
+    feefilter, reject and sendheaders messages are recorded in stats.  Transaction announcements (inv) are passed
+    to onTxInv, transactions to onTx, and requests (getdata) to onGetData, if they are set.  Everything else is
+    counted and dropped. */
+class P2PReader
+{
+public:
+    static const unsigned int HEADER_SIZE = 4+12+4+4;
+    /** A bigger message means the stream is corrupt (or isn't P2P at all) */
+    static const uint32_t MAX_PAYLOAD = 32*1024*1024;
+
+    typedef std::function<void(const char* msgname, const unsigned char* data, uint32_t size)> ReplyFn;
+
+    InboundStats stats;
+    bool gotVersion = false;
+    bool gotVerack = false;
+    uint64_t lastPong = 0;  // The nonce of the latest pong, answering one of our pings
+    ReplyFn reply;  // Sends a message back to the peer
+    std::function<void(const unsigned char* txid)> onTxInv;  // Called with each txid the peer announces
+    std::function<void(const unsigned char* tx, uint32_t size)> onTx;  // Called with each tx message's payload
+    /** Called with each getdata message's entries (count of them, 36 bytes each: type, then hash) */
+    std::function<void(const unsigned char* items, uint64_t count)> onGetData;
+
+protected:
+    std::vector<unsigned char> magic;
+    std::vector<unsigned char> buf;  // A message that has only partly arrived
+
+    /** Read a compact size prefixed string at p, advancing p.  Returns false if it runs past end */
+    static bool ReadString(const unsigned char*& p, const unsigned char* end, std::string& s)
+    {
+        if (p >= end) return false;
+        uint64_t len = *p++;
+        if (len >= 0xfd)  // Longer than any string a peer has reason to send us
+            return false;
+        if ((uint64_t)(end - p) < len) return false;
+        s.assign((const char*)p, len);
+        p += len;
+        return true;
+    }
+
+    /** Read a compact size at p, advancing p.  Returns false if it runs past end */
+    static bool ReadCompactSize(const unsigned char*& p, const unsigned char* end, uint64_t& n)
+    {
+        if (p >= end) return false;
+        unsigned char first = *p++;
+        unsigned int len = (first == 0xff) ? 8 : (first == 0xfe) ? 4 : (first == 0xfd) ? 2 : 0;
+        if (len == 0)
+        {
+            n = first;
+            return true;
+        }
+        if ((size_t)(end - p) < len) return false;
+        n = 0;
+        memcpy(&n, p, len);  // Little endian
+        p += len;
+        return true;
+    }
+
+    void Process(const char* cmd, const unsigned char* p, uint32_t size)
+    {
+        const unsigned char* end = p + size;
+        stats.msgs++;
+        if ((strncmp(cmd, "tx", 12) == 0) && onTx)  // First, since a sink gets little else
+            onTx(p, size);
+        else if ((strncmp(cmd, "ping", 12) == 0) && (size >= 8))
+        {
+            stats.pings++;
+            if (reply) reply(PONG_MSG, p, 8);
+        }
+        else if ((strncmp(cmd, "pong", 12) == 0) && (size >= 8))
+            memcpy(&lastPong, p, 8);
+        else if ((strncmp(cmd, "version", 12) == 0) && (size >= 4))
+        {
+            gotVersion = true;
+            memcpy(&stats.peerVersion, p, 4);
+            const unsigned char* agent = p + 4 + 8 + 8 + 26 + 26 + 8;
+            if ((agent >= end) || !ReadString(agent, end, stats.peerAgent)) stats.peerAgent = "?";
+        }
+        else if (strncmp(cmd, "verack", 12) == 0)
+            gotVerack = true;
+        else if ((strncmp(cmd, "feefilter", 12) == 0) && (size >= 8))
+        {
+            int64_t rate;
+            memcpy(&rate, p, 8);
+            stats.feeFilter = (rate > 0) ? rate : 0;
+        }
+        else if (strncmp(cmd, "reject", 12) == 0)
+        {
+            std::string msg, reason;
+            const unsigned char* q = p;
+            if (ReadString(q, end, msg) && (q < end))
+            {
+                unsigned int code = *q++;
+                if (!ReadString(q, end, reason)) reason.clear();
+                stats.Reject(msg + " " + std::to_string(code) + " " + reason);
+            }
+            else
+                stats.Reject("(unparseable)");
+        }
+        else if ((strncmp(cmd, "inv", 12) == 0) && onTxInv)
+        {
+            static const uint32_t MSG_TX = 1;
+            const unsigned char* q = p;
+            uint64_t count;
+            if (!ReadCompactSize(q, end, count)) return;
+            for (uint64_t i = 0; (i < count) && (end - q >= 36); i++, q += 36)
+            {
+                uint32_t type;
+                memcpy(&type, q, 4);
+                if (type == MSG_TX) onTxInv(q + 4);
+            }
+        }
+        else if ((strncmp(cmd, "getdata", 12) == 0) && onGetData)
+        {
+            const unsigned char* q = p;
+            uint64_t count;
+            if (!ReadCompactSize(q, end, count)) return;
+            onGetData(q, std::min(count, (uint64_t)(end - q) / 36));
+        }
+        else if (strncmp(cmd, "sendheaders", 12) == 0)
+            stats.sendHeaders = true;  // We never announce blocks, so there is nothing to change
+    }
+
+public:
+    P2PReader(const std::vector<unsigned char>& netMagic) : magic(netMagic) {}
+
+    /** Forget any partial message and the handshake, for a new connection */
+    void Reset()
+    {
+        buf.clear();
+        gotVersion = false;
+        gotVerack = false;
+    }
+
+    /** Take len bytes read from the socket, processing every message they complete.  Returns false if the stream
+        isn't P2P messages for our network, in which case the connection should be dropped. */
+    bool Feed(const char* data, size_t len)
+    {
+        buf.insert(buf.end(), (const unsigned char*)data, (const unsigned char*)data + len);
+        size_t pos = 0;
+        bool ok = true;
+        while (buf.size() - pos >= HEADER_SIZE)
+        {
+            const unsigned char* h = &buf[pos];
+            uint32_t size;
+            memcpy(&size, h + 4 + 12, 4);
+            if ((memcmp(h, magic.data(), 4) != 0) || (size > MAX_PAYLOAD))
+            {
+                ok = false;
+                break;
+            }
+            if (buf.size() - pos < HEADER_SIZE + size) break;
+            char cmd[12];
+            memcpy(cmd, h + 4, 12);
+            Process(cmd, h + HEADER_SIZE, size);
+            pos += HEADER_SIZE + size;
+        }
+        if (!ok)
+            buf.clear();
+        else
+            buf.erase(buf.begin(), buf.begin() + pos);
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef TXUNAMI_PACER_H
+#define TXUNAMI_PACER_H
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <time.h>
+
+#include "utiltime.h"
+
+/** Decides when each transaction of a schedule target is sent.
+
+    The rate moves from rateBegin to rateEnd between the target's start and end times, either linearly or
+    exponentially (a fixed ratio per second, so each doubling of the rate gets the same amount of time).  Send times
+    come from inverting N(t), the number of sends expected by time t (the integral of the rate), so the ramp is exact
+    at any rate and rounding never accumulates.
+
+    Arrivals can be evenly spaced, Poisson (independent exponential gaps, like many unrelated wallets) or on/off:
+    nothing is sent during the off part of each period, and the on part sends faster to make up for it, so the
+    average still follows the ramp.
+
+    Times are GetStopwatch() nanoseconds, which is a monotonic clock.
+*/
+class Pacer
+{
+public:
+    enum class Ramp
+    {
+        LINEAR,
+        EXPONENTIAL
+    };
+
+    enum class Arrivals
+    {
+        UNIFORM,
+        POISSON,
+        ONOFF
+    };
+
+    class Profile
+    {
+    public:
+        Ramp ramp = Ramp::LINEAR;
+        Arrivals arrivals = Arrivals::UNIFORM;
+        uint64_t onUs = 1000000;  // ONOFF: length of each burst
+        uint64_t offUs = 1000000;  // ONOFF: silence between bursts
+        uint64_t maxLagUs = 1000000;  // Sends that fall further behind than this are skipped instead of bunched up
+    };
+
+    /** Don't trust the scheduler to wake a sleeping thread more precisely than this; spin instead */
+    static const uint64_t SPIN_NS = 100000;
+
+    uint64_t skipped = 0;  // Sends that were skipped because the caller fell more than maxLagUs behind
+
+protected:
+    Profile prof;
+    double r0, r1;  // tx per second at the start and end
+    double duration;  // seconds
+    double logRatio = 0;  // ln(r1/r0) for an exponential ramp, otherwise 0 (linear)
+    double period;  // ONOFF period, seconds
+    uint64_t startNs;
+    uint64_t endNs;
+    double target = 0;  // The next send is the one at which N(t) reaches this
+    uint64_t nextNs;
+    std::mt19937_64 rng;
+    std::exponential_distribution<double> gap;
+
+    /** Expected sends in the first t seconds of the ramp */
+    double Sends(double t) const
+    {
+        if (t <= 0) return 0;
+        if (t > duration) return Sends(duration) + (t - duration) * r1;
+        if (logRatio != 0) return r0 * duration / logRatio * expm1(logRatio * t / duration);
+        return r0 * t + (r1 - r0) * t * t / (2 * duration);
+    }
+
+    /** When (seconds into the ramp) N(t) reaches n */
+    double When(double n) const
+    {
+        if (n <= 0) return 0;
+        double total = Sends(duration);
+        if (n >= total) return (r1 > 0) ? duration + (n - total) / r1 : std::numeric_limits<double>::infinity();
+        if (logRatio != 0) return duration / logRatio * log1p(n * logRatio / (r0 * duration));
+        // Root of (r1-r0)/(2*duration) t^2 + r0 t - n, in the form that stays accurate when the ramp is flat
+        double a = (r1 - r0) / (2 * duration);
+        return 2 * n / (r0 + sqrt(r0 * r0 + 4 * a * n));
+    }
+
+    /** On/off bursts run the ramp's clock period/on times faster while on, and stop it while off */
+    double RampTime(double realT) const
+    {
+        if (prof.arrivals != Arrivals::ONOFF) return realT;
+        double on = prof.onUs / 1000000.0;
+        double cycles = floor(realT / period);
+        return cycles * period + std::min(realT - cycles * period, on) * period / on;
+    }
+
+    double RealTime(double rampT) const
+    {
+        if (prof.arrivals != Arrivals::ONOFF) return rampT;
+        double on = prof.onUs / 1000000.0;
+        double cycles = floor(rampT / period);
+        return cycles * period + (rampT - cycles * period) * on / period;
+    }
+
+    void Schedule()
+    {
+        double t = RealTime(When(target));
+        if (!(t * 1e9 < (double)(std::numeric_limits<uint64_t>::max() - startNs)))
+            nextNs = std::numeric_limits<uint64_t>::max();
+        else
+            nextNs = startNs + (uint64_t)(t * 1e9);
+    }
+
+    void Advance()
+    {
+        target += (prof.arrivals == Arrivals::POISSON) ? gap(rng) : 1.0;
+        Schedule();
+    }
+
+public:
+    /** Pace rateBegin..rateEnd tx/sec between stopwatch times start and end */
+    Pacer(const Profile& p, uint64_t rateBegin, uint64_t rateEnd, uint64_t start, uint64_t end)
+        : prof(p), r0(rateBegin), r1(rateEnd), startNs(start), endNs(std::max(start, end)),
+          rng(std::random_device()()), gap(1.0)
+    {
+        duration = std::max((endNs - startNs) / 1e9, 1e-9);
+        if ((prof.ramp == Ramp::EXPONENTIAL) && (r0 > 0) && (r1 > 0) && (r0 != r1)) logRatio = log(r1 / r0);
+        if (prof.onUs == 0) prof.arrivals = Arrivals::UNIFORM;  // Never on: treat as always on
+        period = (prof.onUs + prof.offUs) / 1000000.0;
+        if (prof.arrivals == Arrivals::POISSON)
+            Advance();
+        else
+            Schedule();
+    }
+
+    /** Replace the ramp with a flat rate (tx/sec) from stopwatch time now until the end, for a caller that adapts
+        the rate as it goes (see Saturator).  The arrivals carry on as before, restarted from now. */
+    void SetRate(uint64_t now, double rate)
+    {
+        r0 = r1 = rate;
+        logRatio = 0;
+        startNs = std::min(std::max(now, startNs), endNs);
+        duration = std::max((endNs - startNs) / 1e9, 1e-9);
+        target = 0;
+        Advance();
+    }
+
+    /** The stopwatch time corresponding to unix time t (in seconds) */
+    static uint64_t StopwatchAt(uint64_t t)
+    {
+        int64_t deltaUs = (int64_t)(t * 1000000) - GetTimeMicros();
+        int64_t ret = (int64_t)GetStopwatch() + deltaUs * 1000;
+        return (ret > 0) ? ret : 0;
+    }
+
+    /** How many sends to expect over the whole run (Poisson runs will vary around this) */
+    double Expected() const { return Sends(RampTime(duration)); }
+
+    /** The rate (tx/sec) the ramp has reached at stopwatch time now, averaged over any on/off period */
+    double Rate(uint64_t now) const
+    {
+        double t = (now > startNs) ? std::min((now - startNs) / 1e9, duration) : 0;
+        if (logRatio != 0) return r0 * exp(logRatio * t / duration);
+        return r0 + (r1 - r0) * t / duration;
+    }
+
+    bool Done(uint64_t now) const { return now >= endNs; }
+
+    /** When the next send is due (never later than the end) */
+    uint64_t NextSend() const { return std::min(nextNs, endNs); }
+
+    /** Is a send due at stopwatch time now?  If the caller has fallen more than maxLagUs behind, the sends it missed
+        are dropped so that it doesn't try to send them all at once. */
+    bool Due(uint64_t now)
+    {
+        if ((now < nextNs) || (now >= endNs)) return false;
+        if (now - nextNs > prof.maxLagUs * 1000)
+        {
+            double caughtUp = Sends(RampTime((now - prof.maxLagUs * 1000 - startNs) / 1e9));
+            if (caughtUp > target)
+            {
+                skipped += (uint64_t)(caughtUp - target);
+                target = caughtUp;
+                Schedule();
+            }
+        }
+        return true;
+    }
+
+    /** Record that the due send was made */
+    void Sent() { Advance(); }
+
+    /** Sleep until the next send is due, or until stopwatch time limit if that is sooner.  When waiting for a send,
+        the last SPIN_NS are spent polling the clock since a sleeping thread may wake late.  A wait that ends at
+        limit (an idle wake to do housekeeping) just sleeps, so an idle sender doesn't burn a core. */
+    void Wait(uint64_t limit) const
+    {
+        uint64_t next = NextSend();
+        bool spin = (next <= limit);
+        uint64_t until = std::min(next, limit);
+        uint64_t now = GetStopwatch();
+        uint64_t spinNs = spin ? SPIN_NS : 0;
+        if ((until > now) && (until - now > spinNs))
+        {
+            uint64_t ns = until - now - spinNs;
+            struct timespec ts;
+            ts.tv_sec = ns / 1000000000ULL;
+            ts.tv_nsec = ns % 1000000000ULL;
+            nanosleep(&ts, nullptr);
+        }
+        while (spin && (GetStopwatch() < until))
+        {
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TXUNAMI_RING_H
+#define TXUNAMI_RING_H
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+/** A bounded lock-free multi-producer multi-consumer ring (Dmitry Vyukov's sequence-numbered cell design).
+    Items are swapped in and out rather than copied, so if T owns a heap buffer (like a std::vector) the buffers
+    circulate between producers and consumers and no allocation happens once the ring has warmed up.
+    Capacity is rounded up to a power of 2.
+*/
+template <typename T> class LockFreeRing
+{
+protected:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    // Keep the producer and consumer cursors on separate cache lines so they don't ping-pong
+    alignas(64) std::atomic<size_t> enqPos;
+    alignas(64) std::atomic<size_t> deqPos;
+
+public:
+    LockFreeRing(size_t capacity)
+    {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask = cap - 1;
+        cells.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+        enqPos.store(0, std::memory_order_relaxed);
+        deqPos.store(0, std::memory_order_relaxed);
+    }
+
+    LockFreeRing(const LockFreeRing&) = delete;
+    LockFreeRing& operator=(const LockFreeRing&) = delete;
+
+    /** Swap item into the ring.  On success, item holds whatever stale contents the cell had (reuse its buffer).
+        Returns false if the ring is full. */
+    bool push(T& item)
+    {
+        Cell* cell;
+        size_t pos = enqPos.load(std::memory_order_relaxed);
+        while (1)
+        {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (enqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0) return false;  // full
+            else pos = enqPos.load(std::memory_order_relaxed);
+        }
+        std::swap(cell->data, item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Swap the oldest item out of the ring into item.  Returns false if the ring is empty. */
+    bool pop(T& item)
+    {
+        Cell* cell;
+        size_t pos = deqPos.load(std::memory_order_relaxed);
+        while (1)
+        {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (deqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0) return false;  // empty
+            else pos = deqPos.load(std::memory_order_relaxed);
+        }
+        std::swap(cell->data, item);
+        cell->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Approximate number of items in the ring (exact only when no other thread is pushing or popping) */
+    size_t size() const
+    {
+        size_t e = enqPos.load(std::memory_order_relaxed);
+        size_t d = deqPos.load(std::memory_order_relaxed);
+        return (e > d) ? e - d : 0;
+    }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef TXUNAMI_SATURATE_H
+#define TXUNAMI_SATURATE_H
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/** Finds the highest rate a node can sustain by adjusting a target's rate while it runs.
+
+    The rate is held for a step at a time, and each step is judged by what the target saw over its last three
+    quarters (the first quarter lets the previous rate's backlog wash out).  The node is falling behind if it
+    rejected more than maxRejects transactions, if the outbound queue ended the step deeper than maxQueueBytes and
+    deeper than it started, if sends spent more than maxStall of the step waiting for room in the queue, if more than
+    maxWouldBlock of the socket writes found the socket buffer full, or if the mean time for the node to announce our
+    transactions back to an observer (see LatencyObserver) rose past latencyFactor times the best seen at a
+    sustainable rate.  If none of that happened but fewer transactions went out than the rate asked for, the
+    generator couldn't keep up, which ends the climb the same way.
+
+    While everything keeps up, the rate grows by growth each step.  Once a step fails, the rate is bisected
+    (geometrically) between the highest rate that kept up and the lowest that didn't, until they are within precision
+    of each other, and is then held at the one that kept up.  If the held rate later fails, the search resumes below
+    it.  Every step is kept, so the rate against latency curve can be reported at the end.
+*/
+class Saturator
+{
+public:
+    class Profile
+    {
+    public:
+        bool enabled = false;
+        uint64_t stepMs = 10000;
+        double growth = 1.25;  // Rate multiplier per step while climbing
+        double precision = 0.05;  // Stop bisecting when the failing rate is within this fraction of the good one
+        uint64_t maxQueueBytes = 1024 * 1024;
+        double maxStall = 0.01;  // Fraction of the step
+        double maxWouldBlock = 0.25;  // Fraction of the writes
+        double latencyFactor = 2.0;
+        uint64_t maxRejects = 0;  // Per step
+    };
+
+    /** A target's counters at one moment.  All but queuedBytes are running totals */
+    class Signals
+    {
+    public:
+        uint64_t sent = 0;
+        uint64_t queuedBytes = 0;
+        uint64_t stallNs = 0;  // Waiting for room in the outbound queue
+        uint64_t writeCalls = 0;
+        uint64_t wouldBlock = 0;
+        uint64_t rejects = 0;
+        uint64_t echoes = 0;  // Announcements of our transactions by the node, heard by an observer
+        uint64_t echoUs = 0;  // Their total latency
+    };
+
+    enum class Verdict
+    {
+        OK,
+        REJECTS,
+        QUEUE,
+        STALLS,
+        LATENCY,
+        GENERATOR
+    };
+
+    static const char* VerdictName(Verdict v)
+    {
+        static const char* names[] = {"ok", "rejects", "queue growing", "send stalls", "latency", "generator"};
+        return names[(unsigned int)v];
+    }
+
+    /** What happened during one step */
+    class Step
+    {
+    public:
+        double rate;  // Asked for (tx/sec)
+        double tps;  // Achieved
+        uint64_t queuedBytes;  // At the end
+        double stall;  // Fraction of the step
+        double wouldBlock;  // Fraction of the writes
+        uint64_t rejects;
+        uint64_t echoes;
+        double echoMs;  // Mean, 0 if there were none
+        Verdict verdict;
+    };
+
+    /** Fewer announcements in a step than this are too noisy to judge latency by */
+    static const uint64_t MIN_ECHOES = 10;
+    /** Latency must also rise by this much (ms), so jitter in a very quick node's announcements isn't failure */
+    static constexpr double LATENCY_SLACK_MS = 20;
+    /** A step that sent less than this fraction of its rate was held back by the generator */
+    static constexpr double GENERATOR_SLACK = 0.9;
+
+    std::vector<Step> curve;
+
+protected:
+    Profile prof;
+    double rate;
+    double maxRate;
+    double good = 0;  // Highest rate that kept up, 0 if none has yet
+    double bad = 0;  // Lowest rate that didn't, 0 if none has yet
+    Verdict limit = Verdict::OK;  // Why bad didn't keep up
+    double baselineMs = 0;  // Lowest mean latency at a rate that kept up, 0 if not known yet
+    uint64_t stepStart;
+    uint64_t fromNs = 0;
+    Signals from;
+    bool measuring = false;
+
+    void StartStep(uint64_t now)
+    {
+        stepStart = now;
+        measuring = false;
+    }
+
+    Step Judge(uint64_t now, const Signals& s) const
+    {
+        Step st;
+        double secs = std::max((now - fromNs) / 1e9, 1e-9);
+        uint64_t writes = s.writeCalls - from.writeCalls;
+        st.rate = rate;
+        st.tps = (s.sent - from.sent) / secs;
+        st.queuedBytes = s.queuedBytes;
+        st.stall = (s.stallNs - from.stallNs) / 1e9 / secs;
+        st.wouldBlock = writes ? (double)(s.wouldBlock - from.wouldBlock) / writes : 0;
+        st.rejects = s.rejects - from.rejects;
+        st.echoes = s.echoes - from.echoes;
+        st.echoMs = st.echoes ? (s.echoUs - from.echoUs) / 1000.0 / st.echoes : 0;
+
+        if (st.rejects > prof.maxRejects)
+            st.verdict = Verdict::REJECTS;
+        else if ((st.queuedBytes > prof.maxQueueBytes) && (st.queuedBytes > from.queuedBytes))
+            st.verdict = Verdict::QUEUE;
+        else if ((st.stall > prof.maxStall) || (st.wouldBlock > prof.maxWouldBlock))
+            st.verdict = Verdict::STALLS;
+        else if ((baselineMs > 0) && (st.echoes >= MIN_ECHOES) &&
+                 (st.echoMs > baselineMs * prof.latencyFactor + LATENCY_SLACK_MS))
+            st.verdict = Verdict::LATENCY;
+        else if (st.tps < rate * GENERATOR_SLACK)
+            st.verdict = Verdict::GENERATOR;
+        else
+            st.verdict = Verdict::OK;
+        return st;
+    }
+
+    /** The rate for the step after st */
+    double Next(const Step& st)
+    {
+        if (st.verdict == Verdict::OK)
+        {
+            good = std::max(good, rate);
+            if (st.echoes >= MIN_ECHOES) baselineMs = baselineMs ? std::min(baselineMs, st.echoMs) : st.echoMs;
+        }
+        else
+        {
+            bad = rate;
+            limit = st.verdict;
+            if (good >= bad) good = 0;  // The rate we were holding no longer keeps up
+        }
+
+        if (bad == 0) return std::min(rate * prof.growth, maxRate);
+        if (good == 0) return std::max(bad / prof.growth, 1.0);
+        if (bad <= good * (1 + prof.precision)) return good;
+        return sqrt(good * bad);
+    }
+
+public:
+    /** Start probing at startRate (tx/sec), never going above maxRate, at stopwatch time now (ns) */
+    Saturator(const Profile& p, double startRate, double maxRate_, uint64_t now)
+        : prof(p), rate(std::max(startRate, 1.0)), maxRate(std::max(maxRate_, rate))
+    {
+        StartStep(now);
+    }
+
+    /** The rate (tx/sec) to send at now */
+    double Rate() const { return rate; }
+
+    /** Does Update need to be called at stopwatch time now?  Until it does, the caller needn't gather Signals */
+    bool Due(uint64_t now) const
+    {
+        return now >= stepStart + prof.stepMs * 1000000 / (measuring ? 1 : 4);
+    }
+
+    /** Take the target's counters at stopwatch time now.  Returns true if the rate has changed, in which case the
+        caller should start sending at Rate() */
+    bool Update(uint64_t now, const Signals& s)
+    {
+        if (!Due(now)) return false;
+        if (!measuring)
+        {
+            from = s;
+            fromNs = now;
+            measuring = true;
+            return false;
+        }
+        curve.push_back(Judge(now, s));
+        double next = Next(curve.back());
+        StartStep(now);
+        if (next == rate) return false;
+        rate = next;
+        return true;
+    }
+
+    /** Print each step, and the highest sustainable rate found */
+    void Report(const std::string& title) const
+    {
+        printf("%s: %lu steps of %.1f sec, measured over the last 3/4 of each\n", title.c_str(), curve.size(),
+               prof.stepMs / 1000.0);
+        printf("  %10s %10s %10s %7s %7s %8s %8s %9s  %s\n", "rate", "tps", "queue KB", "stall%", "block%", "rejects",
+               "echoes", "echo ms", "verdict");
+        for (const Step& st : curve)
+        {
+            printf("  %10.0f %10.0f %10.1f %7.2f %7.2f %8lu %8lu %9.1f  %s\n", st.rate, st.tps, st.queuedBytes / 1024.0,
+                   st.stall * 100, st.wouldBlock * 100, st.rejects, st.echoes, st.echoMs, VerdictName(st.verdict));
+        }
+        if (bad == 0)
+            printf("%s: kept up with every rate tried, up to %.0f tps\n", title.c_str(), rate);
+        else if (good == 0)
+            printf("%s: no rate kept up; the lowest tried, %.0f tps, failed on %s\n", title.c_str(), bad,
+                   VerdictName(limit));
+        else
+            printf("%s: highest sustainable rate %.0f tps; %.0f tps failed on %s\n", title.c_str(), good, bad,
+                   VerdictName(limit));
+    }
+};
+
+#endif
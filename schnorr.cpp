@@ -0,0 +1,206 @@
+#define HAVE_CONFIG_H
+#include "schnorr.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <secp256k1.h>
+
+namespace
+{
+typedef unsigned __int128 uint128;
+
+// Field arithmetic mod p = 2^256 - 2^32 - 977, on 4 little endian 64 bit limbs.  Only used to decide whether R.y is a
+// quadratic residue, which the public secp256k1 API doesn't expose.
+const uint64_t P[4] = {0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL};
+const uint64_t P_COMPLEMENT = 0x1000003D1ULL;  // 2^256 - p
+
+// (p-1)/2
+const uint64_t HALF_P[4] = {0xFFFFFFFF7FFFFE17ULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL};
+
+bool GreaterEqualP(const uint64_t a[4])
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a[i] != P[i])
+            return a[i] > P[i];
+    }
+    return true;
+}
+
+void MulModP(const uint64_t a[4], const uint64_t b[4], uint64_t r[4])
+{
+    uint64_t t[8] = {};
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t carry = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            uint128 cur = (uint128)a[i] * b[j] + t[i + j] + carry;
+            t[i + j] = (uint64_t)cur;
+            carry = (uint64_t)(cur >> 64);
+        }
+        t[i + 4] = carry;
+    }
+
+    // hi * 2^256 + lo == lo + hi * (2^256 - p)  (mod p)
+    uint64_t s[4];
+    uint128 c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        c += (uint128)t[i + 4] * P_COMPLEMENT + t[i];
+        s[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    // Fold the (at most 35 bit) overflow back in the same way
+    c = c * P_COMPLEMENT;
+    for (int i = 0; i < 4; i++)
+    {
+        c += s[i];
+        r[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    if (c)  // Wrapped past 2^256, so r is small and adding the complement can't wrap again
+    {
+        c = P_COMPLEMENT;
+        for (int i = 0; i < 4; i++)
+        {
+            c += r[i];
+            r[i] = (uint64_t)c;
+            c >>= 64;
+        }
+    }
+    if (GreaterEqualP(r))
+    {
+        c = P_COMPLEMENT;
+        for (int i = 0; i < 4; i++)
+        {
+            c += r[i];
+            r[i] = (uint64_t)c;
+            c >>= 64;
+        }
+    }
+}
+
+/** Euler's criterion: y^((p-1)/2) is 1 exactly when y is a nonzero square mod p.  y is 32 big endian bytes. */
+bool IsQuadResidue(const unsigned char* y32)
+{
+    uint64_t y[4];
+    for (int i = 0; i < 4; i++) y[i] = ReadBE64(y32 + 8 * (3 - i));
+
+    uint64_t r[4] = {1, 0, 0, 0};
+    for (int bit = 255; bit >= 0; bit--)
+    {
+        MulModP(r, r, r);
+        if ((HALF_P[bit / 64] >> (bit % 64)) & 1)
+            MulModP(r, y, r);
+    }
+    return (r[0] == 1) && (r[1] == 0) && (r[2] == 0) && (r[3] == 0);
+}
+}
+
+SchnorrSigner::SchnorrSigner(size_t poolSize) : pool(poolSize ? poolSize : 1)
+{
+    ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+    unsigned char rnd[32];
+    GetStrongRandBytes(rnd, sizeof(rnd));
+    if (!secp256k1_context_randomize(ctx, rnd))
+        abort();
+    GetStrongRandBytes(seed, sizeof(seed));
+}
+
+SchnorrSigner::~SchnorrSigner() { secp256k1_context_destroy(ctx); }
+
+bool SchnorrSigner::MakeNonce(Nonce& n)
+{
+    // Nonces only need to be unpredictable and never reused, so derive them from a per-signer random seed
+    unsigned char ctr[8];
+    WriteLE64(ctr, counter++);
+    CSHA256().Write(seed, sizeof(seed)).Write(ctr, sizeof(ctr)).Finalize(n.k);
+    if (!secp256k1_ec_seckey_verify(ctx, n.k))
+        return false;
+
+    secp256k1_pubkey R;
+    if (!secp256k1_ec_pubkey_create(ctx, &R, n.k))
+        return false;
+    unsigned char ser[65];
+    size_t serLen = sizeof(ser);
+    secp256k1_ec_pubkey_serialize(ctx, ser, &serLen, &R, SECP256K1_EC_UNCOMPRESSED);
+    memcpy(n.rx, ser + 1, 32);
+
+    // The signature only commits to R.x, and verifiers require R.y to be a square.  -R has the same x and the other
+    // y, so if this y is not a square use -k instead.
+    if (!IsQuadResidue(ser + 33))
+        return secp256k1_ec_privkey_negate(ctx, n.k) == 1;
+    return true;
+}
+
+size_t SchnorrSigner::Precompute(size_t n)
+{
+    size_t added = 0;
+    while ((added < n) && (count < pool.size()))
+    {
+        if (MakeNonce(pool[(head + count) % pool.size()]))
+        {
+            count++;
+            added++;
+        }
+    }
+    return added;
+}
+
+void SchnorrSigner::PrecomputeUntil(uint64_t deadline)
+{
+    while (!Full() && (GetStopwatch() < deadline)) Precompute(16);
+}
+
+bool SchnorrSigner::Sign(const uint256& hash, const CKey& key, const CPubKey& pub, std::vector<unsigned char>& sig)
+{
+    signatures++;
+    if (!fastPath || !pub.IsCompressed())  // e commits to the compressed encoding of the public key
+        return key.SignSchnorr(hash, sig);
+
+    Nonce n;
+    if (count)
+    {
+        n = pool[head];
+        head = (head + 1) % pool.size();
+        count--;
+    }
+    else
+    {
+        poolMisses++;
+        while (!MakeNonce(n))
+        {
+        }
+    }
+
+    // e = H(R.x | P | m), s = k + e*x
+    unsigned char e[32];
+    CSHA256().Write(n.rx, 32).Write(pub.begin(), pub.size()).Write(hash.begin(), 32).Finalize(e);
+    unsigned char s[32];
+    memcpy(s, key.begin(), 32);
+    if (!secp256k1_ec_privkey_tweak_mul(ctx, s, e) || !secp256k1_ec_privkey_tweak_add(ctx, s, n.k))
+        return key.SignSchnorr(hash, sig);  // e >= n or s == 0: vanishingly unlikely
+
+    sig.resize(64);
+    memcpy(&sig[0], n.rx, 32);
+    memcpy(&sig[32], s, 32);
+
+    if (!verified)
+    {
+        verified = true;
+        if (!pub.VerifySchnorr(hash, sig))
+        {
+            printf("Precomputed nonce Schnorr signature did not verify, falling back to CKey::SignSchnorr\n");
+            fastPath = false;
+            return key.SignSchnorr(hash, sig);
+        }
+    }
+    return true;
+}
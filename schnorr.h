@@ -0,0 +1,66 @@
+#ifndef TXUNAMI_SCHNORR_H
+#define TXUNAMI_SCHNORR_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "key.h"
+#include "pubkey.h"
+#include "uint256.h"
+
+typedef struct secp256k1_context_struct secp256k1_context;
+
+/** Bitcoin Cash Schnorr signing with nonces computed ahead of time.
+
+    Almost all of the cost of a Schnorr signature is computing the nonce point R = k*G.  That doesn't depend on the
+    message or the key, so this class keeps a pool of (k, R.x) pairs that can be filled whenever the owning thread
+    would otherwise be idle -- waiting for its start time, or for its send queue to drain.  Signing with a pooled
+    nonce is then one SHA256 and two scalar operations: s = k + e*x.
+
+    Each instance has its own secp256k1 context and is meant to be used by one thread.  The first signature is
+    verified; if that fails for any reason every later signature is made by CKey::SignSchnorr instead.
+*/
+class SchnorrSigner
+{
+public:
+    SchnorrSigner(size_t poolSize);
+    ~SchnorrSigner();
+    SchnorrSigner(const SchnorrSigner&) = delete;
+    SchnorrSigner& operator=(const SchnorrSigner&) = delete;
+
+    /** Add up to n nonces to the pool (fewer if it fills up).  Returns how many were added */
+    size_t Precompute(size_t n);
+
+    /** Fill the pool until it is full or the stopwatch (GetStopwatch) reaches deadline */
+    void PrecomputeUntil(uint64_t deadline);
+
+    size_t Available() const { return count; }
+    bool Full() const { return count == pool.size(); }
+
+    /** Produce the 64 byte signature of hash by key (whose public key is pub) into sig.  No sighash type byte is
+        appended. */
+    bool Sign(const uint256& hash, const CKey& key, const CPubKey& pub, std::vector<unsigned char>& sig);
+
+    uint64_t signatures = 0;
+    uint64_t poolMisses = 0;  // signatures that had to compute their nonce on the spot
+
+protected:
+    struct Nonce
+    {
+        unsigned char k[32];
+        unsigned char rx[32];
+    };
+
+    secp256k1_context* ctx;
+    std::vector<Nonce> pool;  // circular
+    size_t head = 0;
+    size_t count = 0;
+    unsigned char seed[32];
+    uint64_t counter = 0;
+    bool verified = false;
+    bool fastPath = true;
+
+    bool MakeNonce(Nonce& n);
+};
+
+#endif
@@ -0,0 +1,204 @@
+#define HAVE_CONFIG_H
+#include "sha256multi.h"
+
+#include <string.h>
+
+#include "crypto/common.h"
+#include "hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <emmintrin.h>
+
+#include "sha256multi_impl.h"
+
+namespace sha256multi
+{
+void Transform8(uint32_t* state, const unsigned char* const* blocks);  // sha256multi_avx2.cpp
+
+// SSE2 is part of the x86-64 baseline, so the 4 way kernel needs no special compiler flags
+struct SSE2
+{
+    typedef __m128i T;
+    static const int LANES = 4;
+
+    static inline T add(T a, T b) { return _mm_add_epi32(a, b); }
+    static inline T xor_(T a, T b) { return _mm_xor_si128(a, b); }
+    static inline T xor3(T a, T b, T c) { return _mm_xor_si128(_mm_xor_si128(a, b), c); }
+    static inline T and_(T a, T b) { return _mm_and_si128(a, b); }
+    static inline T andnot(T a, T b) { return _mm_andnot_si128(a, b); }  // ~a & b
+    static inline T or_(T a, T b) { return _mm_or_si128(a, b); }
+    static inline T shr(T a, int n) { return _mm_srli_epi32(a, n); }
+    static inline T ror(T a, int n) { return _mm_or_si128(_mm_srli_epi32(a, n), _mm_slli_epi32(a, 32 - n)); }
+    static inline T set1(uint32_t k) { return _mm_set1_epi32(k); }
+    static inline T load(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void store(uint32_t* p, T a) { _mm_storeu_si128((__m128i*)p, a); }
+    static inline T loadBE(const unsigned char* const* blocks, int i)
+    {
+        return _mm_set_epi32(ReadBE32(blocks[3] + 4 * i), ReadBE32(blocks[2] + 4 * i), ReadBE32(blocks[1] + 4 * i),
+            ReadBE32(blocks[0] + 4 * i));
+    }
+};
+
+void Transform4(uint32_t* state, const unsigned char* const* blocks) { Transform<SSE2>(state, blocks); }
+}
+#endif
+
+namespace
+{
+const uint32_t SHA256_IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+const unsigned int MAX_LANES = 8;
+const unsigned int MAX_GROUP = 64;  // messages sorted by block count at once
+
+typedef void (*TransformN)(uint32_t* state, const unsigned char* const* blocks);
+
+int lanes = 1;
+TransformN transform = nullptr;
+
+size_t PaddedBlocks(size_t len) { return (len + 1 + 8 + 63) / 64; }
+
+/** Double SHA256 exactly lanes messages that all pad to nBlocks blocks */
+void HashLanes(const unsigned char* const* msgs, const size_t* lens, size_t nBlocks, uint256** out)
+{
+    alignas(32) uint32_t state[8 * MAX_LANES];
+    unsigned char tails[MAX_LANES][128];  // The final (padded) one or two blocks of each message
+    const unsigned char* blocks[MAX_LANES];
+
+    for (int w = 0; w < 8; w++)
+        for (int l = 0; l < lanes; l++) state[w * lanes + l] = SHA256_IV[w];
+
+    for (int l = 0; l < lanes; l++)
+    {
+        size_t full = lens[l] / 64;
+        size_t rem = lens[l] % 64;
+        size_t tailLen = (nBlocks - full) * 64;
+        memcpy(tails[l], msgs[l] + full * 64, rem);
+        tails[l][rem] = 0x80;
+        memset(tails[l] + rem + 1, 0, tailLen - rem - 1);
+        WriteBE32(tails[l] + tailLen - 8, (uint32_t)(lens[l] >> 29));
+        WriteBE32(tails[l] + tailLen - 4, (uint32_t)(lens[l] << 3));
+    }
+
+    for (size_t b = 0; b < nBlocks; b++)
+    {
+        for (int l = 0; l < lanes; l++)
+        {
+            size_t full = lens[l] / 64;
+            blocks[l] = (b < full) ? msgs[l] + b * 64 : tails[l] + (b - full) * 64;
+        }
+        transform(state, blocks);
+    }
+
+    // Second hash: the 32 byte digest padded to a single block
+    for (int l = 0; l < lanes; l++)
+    {
+        for (int w = 0; w < 8; w++) WriteBE32(tails[l] + 4 * w, state[w * lanes + l]);
+        tails[l][32] = 0x80;
+        memset(tails[l] + 33, 0, 64 - 33 - 2);
+        tails[l][62] = 0x01;  // 256 bits
+        tails[l][63] = 0x00;
+        blocks[l] = tails[l];
+    }
+    for (int w = 0; w < 8; w++)
+        for (int l = 0; l < lanes; l++) state[w * lanes + l] = SHA256_IV[w];
+    transform(state, blocks);
+
+    for (int l = 0; l < lanes; l++)
+        if (out[l])
+            for (int w = 0; w < 8; w++) WriteBE32(out[l]->begin() + 4 * w, state[w * lanes + l]);
+}
+}
+
+std::string SHA256DMultiAutoDetect()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29)))
+    {
+        lanes = 1;
+        return "CSHA256 (SHA extensions)";
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        lanes = 8;
+        transform = sha256multi::Transform8;
+        return "avx2 (8 way)";
+    }
+    lanes = 4;
+    transform = sha256multi::Transform4;
+    return "sse2 (4 way)";
+#else
+    lanes = 1;
+    return "CSHA256";
+#endif
+}
+
+int SHA256DMultiLanes() { return lanes; }
+
+void SHA256DMulti(const unsigned char* const* msgs, const size_t* lens, size_t n, uint256* out)
+{
+    if (lanes <= 1)
+    {
+        for (size_t i = 0; i < n; i++) CHash256().Write(msgs[i], lens[i]).Finalize(out[i].begin());
+        return;
+    }
+
+    while (n > 0)
+    {
+        size_t count = (n < MAX_GROUP) ? n : MAX_GROUP;
+
+        // Sort this group's indexes by padded block count so that runs of equal block count can share a pass
+        unsigned int idx[MAX_GROUP];
+        size_t nBlocks[MAX_GROUP];
+        for (size_t i = 0; i < count; i++)
+        {
+            nBlocks[i] = PaddedBlocks(lens[i]);
+            size_t j = i;
+            while ((j > 0) && (nBlocks[idx[j - 1]] > nBlocks[i]))
+            {
+                idx[j] = idx[j - 1];
+                j--;
+            }
+            idx[j] = i;
+        }
+
+        size_t i = 0;
+        while (i < count)
+        {
+            size_t run = 1;
+            while ((i + run < count) && (run < (size_t)lanes) && (nBlocks[idx[i + run]] == nBlocks[idx[i]])) run++;
+
+            if (run * 2 < (size_t)lanes)  // Too few to be worth a SIMD pass
+            {
+                for (size_t r = 0; r < run; r++)
+                {
+                    unsigned int k = idx[i + r];
+                    CHash256().Write(msgs[k], lens[k]).Finalize(out[k].begin());
+                }
+            }
+            else
+            {
+                // Fill any unused lanes by repeating the last message, and throw those results away
+                const unsigned char* m[MAX_LANES];
+                size_t l[MAX_LANES];
+                uint256* o[MAX_LANES];
+                for (int lane = 0; lane < lanes; lane++)
+                {
+                    unsigned int k = idx[i + ((size_t)lane < run ? lane : run - 1)];
+                    m[lane] = msgs[k];
+                    l[lane] = lens[k];
+                    o[lane] = ((size_t)lane < run) ? &out[k] : nullptr;
+                }
+                HashLanes(m, l, nBlocks[idx[i]], o);
+            }
+            i += run;
+        }
+
+        msgs += count;
+        lens += count;
+        out += count;
+        n -= count;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef TXUNAMI_SHA256MULTI_H
+#define TXUNAMI_SHA256MULTI_H
+
+#include <stddef.h>
+#include <string>
+
+#include "uint256.h"
+
+/** Pick the fastest way to double SHA256 many messages at once on this CPU and return a description of it.
+    Call once at startup, after SHA256AutoDetect. */
+std::string SHA256DMultiAutoDetect();
+
+/** How many messages SHA256DMulti hashes in one pass (1 means it just loops over CSHA256) */
+int SHA256DMultiLanes();
+
+/** Double SHA256 n independent messages into out[0..n).
+    Messages that pad to the same number of 64 byte blocks are hashed together, 4 or 8 at a time, using SIMD lanes.
+    Transactions (and sighash preimages) of the same shape are nearly the same size so they line up well.
+    If the CPU has the SHA extensions, one message at a time through CSHA256 is faster so that is used instead.
+*/
+void SHA256DMulti(const unsigned char* const* msgs, const size_t* lens, size_t n, uint256* out);
+
+#endif
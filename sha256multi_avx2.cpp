@@ -0,0 +1,40 @@
+// 8 way SHA256 using AVX2.  This file is compiled with -mavx2, and only called after the CPU has been checked.
+
+#define HAVE_CONFIG_H
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#include "sha256multi_impl.h"
+
+namespace sha256multi
+{
+struct AVX2
+{
+    typedef __m256i T;
+    static const int LANES = 8;
+
+    static inline T add(T a, T b) { return _mm256_add_epi32(a, b); }
+    static inline T xor_(T a, T b) { return _mm256_xor_si256(a, b); }
+    static inline T xor3(T a, T b, T c) { return _mm256_xor_si256(_mm256_xor_si256(a, b), c); }
+    static inline T and_(T a, T b) { return _mm256_and_si256(a, b); }
+    static inline T andnot(T a, T b) { return _mm256_andnot_si256(a, b); }  // ~a & b
+    static inline T or_(T a, T b) { return _mm256_or_si256(a, b); }
+    static inline T shr(T a, int n) { return _mm256_srli_epi32(a, n); }
+    static inline T ror(T a, int n) { return _mm256_or_si256(_mm256_srli_epi32(a, n), _mm256_slli_epi32(a, 32 - n)); }
+    static inline T set1(uint32_t k) { return _mm256_set1_epi32(k); }
+    static inline T load(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline void store(uint32_t* p, T a) { _mm256_storeu_si256((__m256i*)p, a); }
+    static inline T loadBE(const unsigned char* const* blocks, int i)
+    {
+        return _mm256_set_epi32(ReadBE32(blocks[7] + 4 * i), ReadBE32(blocks[6] + 4 * i), ReadBE32(blocks[5] + 4 * i),
+            ReadBE32(blocks[4] + 4 * i), ReadBE32(blocks[3] + 4 * i), ReadBE32(blocks[2] + 4 * i),
+            ReadBE32(blocks[1] + 4 * i), ReadBE32(blocks[0] + 4 * i));
+    }
+};
+
+void Transform8(uint32_t* state, const unsigned char* const* blocks) { Transform<AVX2>(state, blocks); }
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TXUNAMI_SHA256MULTI_IMPL_H
+#define TXUNAMI_SHA256MULTI_IMPL_H
+
+// SHA256 compression of several independent messages in parallel, one message per SIMD lane.
+// Only included by the translation units that instantiate it, each of which is compiled for its instruction set.
+
+#include <stdint.h>
+
+#include "crypto/common.h"
+
+namespace sha256multi
+{
+static const uint32_t K[64] = {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+    0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138,
+    0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70,
+    0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa,
+    0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/** Compress one 64 byte block per lane.  V supplies the vector type and operations, and V::LANES lanes.
+    state holds the 8 state words of every lane, word major: state[word * V::LANES + lane]. */
+template <class V> void Transform(uint32_t* state, const unsigned char* const* blocks)
+{
+    typedef typename V::T T;
+    const int L = V::LANES;
+
+    T a = V::load(state + 0 * L), b = V::load(state + 1 * L), c = V::load(state + 2 * L), d = V::load(state + 3 * L);
+    T e = V::load(state + 4 * L), f = V::load(state + 5 * L), g = V::load(state + 6 * L), h = V::load(state + 7 * L);
+
+    T w[16];
+    for (int i = 0; i < 16; i++) w[i] = V::loadBE(blocks, i);
+
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            T w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            T s0 = V::xor3(V::ror(w15, 7), V::ror(w15, 18), V::shr(w15, 3));
+            T s1 = V::xor3(V::ror(w2, 17), V::ror(w2, 19), V::shr(w2, 10));
+            w[i & 15] = V::add(V::add(w[i & 15], s0), V::add(w[(i - 7) & 15], s1));
+        }
+        T S1 = V::xor3(V::ror(e, 6), V::ror(e, 11), V::ror(e, 25));
+        T ch = V::xor_(V::and_(e, f), V::andnot(e, g));
+        T t1 = V::add(V::add(V::add(h, S1), V::add(ch, V::set1(K[i]))), w[i & 15]);
+        T S0 = V::xor3(V::ror(a, 2), V::ror(a, 13), V::ror(a, 22));
+        T maj = V::or_(V::and_(a, b), V::and_(c, V::or_(a, b)));
+        T t2 = V::add(S0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = V::add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = V::add(t1, t2);
+    }
+
+    V::store(state + 0 * L, V::add(V::load(state + 0 * L), a));
+    V::store(state + 1 * L, V::add(V::load(state + 1 * L), b));
+    V::store(state + 2 * L, V::add(V::load(state + 2 * L), c));
+    V::store(state + 3 * L, V::add(V::load(state + 3 * L), d));
+    V::store(state + 4 * L, V::add(V::load(state + 4 * L), e));
+    V::store(state + 5 * L, V::add(V::load(state + 5 * L), f));
+    V::store(state + 6 * L, V::add(V::load(state + 6 * L), g));
+    V::store(state + 7 * L, V::add(V::load(state + 7 * L), h));
+}
+}
+
+#endif
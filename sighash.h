@@ -0,0 +1,158 @@
+#ifndef TXUNAMI_SIGHASH_H
+#define TXUNAMI_SIGHASH_H
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+
+/** Number of bytes at the start of a BIP143 preimage that are the same for every input of a transaction.
+    It is exactly one SHA256 block (version, hashPrevouts, and the first 28 bytes of hashSequence), so the
+    SHA256 midstate after it can be shared by all inputs.
+ */
+static const unsigned int SIGHASH_SHARED_PREFIX = 64;
+
+/** Finish a double SHA256 sighash: continue from the shared prefix midstate with the rest of the preimage */
+inline void SighashFromMidstate(const CSHA256& prefix, const unsigned char* rest, size_t len, uint256& out)
+{
+    unsigned char first[CSHA256::OUTPUT_SIZE];
+    CSHA256 h(prefix);
+    h.Write(rest, len).Finalize(first);
+    CSHA256().Write(first, sizeof(first)).Finalize(out.begin());
+}
+
+template <class Hasher> void WriteCompactSizeTo(Hasher& h, uint64_t n)
+{
+    unsigned char b[9];
+    if (n < 0xfd)
+    {
+        b[0] = n;
+        h.Write(b, 1);
+    }
+    else if (n <= 0xffff)
+    {
+        b[0] = 0xfd;
+        b[1] = n & 0xff;
+        b[2] = (n >> 8) & 0xff;
+        h.Write(b, 3);
+    }
+    else if (n <= 0xffffffff)
+    {
+        b[0] = 0xfe;
+        WriteLE32(&b[1], n);
+        h.Write(b, 5);
+    }
+    else
+    {
+        b[0] = 0xff;
+        WriteLE64(&b[1], n);
+        h.Write(b, 9);
+    }
+}
+
+/** BIP143 (SIGHASH_FORKID) signature hashing for SIGHASH_ALL that does per-transaction work once.
+    SignatureHash recomputes hashPrevouts, hashSequence and hashOutputs for every input.  Here Begin computes
+    hashPrevouts and hashOutputs once per transaction, hashSequence once per input count (we always use final
+    sequence numbers), and compresses the shared first block of the preimage once.  Each Input call then only
+    hashes the 118+ bytes that differ between inputs.
+*/
+class SighashEngine
+{
+protected:
+    std::vector<uint256> hashSequenceCache;  // For all-final inputs, indexed by input count.  Null if not yet computed
+    const CMutableTransaction* tx = nullptr;
+    CSHA256 prefix;
+    unsigned char hashSequenceTail[32 - (SIGHASH_SHARED_PREFIX - 4 - 32)];
+    uint256 hashOutputs;
+
+public:
+    uint32_t sighashType = SIGHASH_ALL | SIGHASH_FORKID;
+
+    /** Compute everything shared by the inputs of tx.  tx's inputs and outputs must not change until the last
+        Input call. */
+    void Begin(const CMutableTransaction& t)
+    {
+        tx = &t;
+
+        unsigned char b[36];
+        CHash256 prevouts;
+        bool allFinal = true;
+        for (const CTxIn& in : t.vin)
+        {
+            memcpy(b, in.prevout.hash.begin(), 32);
+            WriteLE32(&b[32], in.prevout.n);
+            prevouts.Write(b, 36);
+            if (in.nSequence != CTxIn::SEQUENCE_FINAL) allFinal = false;
+        }
+        uint256 hashPrevouts;
+        prevouts.Finalize(hashPrevouts.begin());
+
+        uint256 hashSequence;
+        if (allFinal && (t.vin.size() < hashSequenceCache.size()) && !hashSequenceCache[t.vin.size()].IsNull())
+            hashSequence = hashSequenceCache[t.vin.size()];
+        else
+        {
+            CHash256 seqs;
+            for (const CTxIn& in : t.vin)
+            {
+                WriteLE32(b, in.nSequence);
+                seqs.Write(b, 4);
+            }
+            seqs.Finalize(hashSequence.begin());
+            if (allFinal)
+            {
+                if (t.vin.size() >= hashSequenceCache.size()) hashSequenceCache.resize(t.vin.size() + 1);
+                hashSequenceCache[t.vin.size()] = hashSequence;
+            }
+        }
+
+        CHash256 outputs;
+        for (const CTxOut& out : t.vout)
+        {
+            WriteLE64(b, out.nValue);
+            outputs.Write(b, 8);
+            WriteCompactSizeTo(outputs, out.scriptPubKey.size());
+            outputs.Write(out.scriptPubKey.data(), out.scriptPubKey.size());
+        }
+        outputs.Finalize(hashOutputs.begin());
+
+        unsigned char first[SIGHASH_SHARED_PREFIX];
+        WriteLE32(first, t.nVersion);
+        memcpy(&first[4], hashPrevouts.begin(), 32);
+        memcpy(&first[4 + 32], hashSequence.begin(), SIGHASH_SHARED_PREFIX - 4 - 32);
+        memcpy(hashSequenceTail, hashSequence.begin() + SIGHASH_SHARED_PREFIX - 4 - 32, sizeof(hashSequenceTail));
+        prefix.Reset();
+        prefix.Write(first, sizeof(first));
+    }
+
+    /** Return the signature hash of input n, which spends a coin locked by scriptCode holding amount satoshis */
+    uint256 Input(unsigned int n, const CScript& scriptCode, uint64_t amount)
+    {
+        const CTxIn& in = tx->vin[n];
+        CSHA256 h(prefix);
+        unsigned char b[36];
+        h.Write(hashSequenceTail, sizeof(hashSequenceTail));
+        memcpy(b, in.prevout.hash.begin(), 32);
+        WriteLE32(&b[32], in.prevout.n);
+        h.Write(b, 36);
+        WriteCompactSizeTo(h, scriptCode.size());
+        h.Write(scriptCode.data(), scriptCode.size());
+        WriteLE64(b, amount);
+        WriteLE32(&b[8], in.nSequence);
+        h.Write(b, 12);
+        h.Write(hashOutputs.begin(), 32);
+        WriteLE32(b, tx->nLockTime);
+        WriteLE32(&b[4], sighashType);
+        h.Write(b, 8);
+
+        unsigned char first[CSHA256::OUTPUT_SIZE];
+        h.Finalize(first);
+        uint256 ret;
+        CSHA256().Write(first, sizeof(first)).Finalize(ret.begin());
+        return ret;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef TXUNAMI_SINK_H
+#define TXUNAMI_SINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "p2p.h"
+
+/** A stand-in for a node, listening on the loopback interface, so that the generator can be measured without one.
+    It does the version handshake with whoever connects, answers pings, and takes tx messages as fast as they arrive.
+    Transactions announced with inv are asked for with a getdata, as a node would, so announce mode works too.
+    If verify is set, every transaction is also passed to it, on the sink's thread.  Counts are kept in atomics so
+    they can be watched while it runs.
+*/
+class P2PSink
+{
+public:
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> txs{0};
+    std::atomic<uint64_t> bytes{0};  // Read from the sockets
+    std::atomic<uint64_t> invalid{0};  // Transactions verify rejected
+    std::function<bool(const unsigned char* tx, uint32_t size)> verify;  // Set before Start
+
+protected:
+    static const size_t READ_SIZE = 256 * 1024;
+
+    /** One peer that has connected.  Kept alive by its read handler */
+    class Conn : public std::enable_shared_from_this<Conn>
+    {
+    public:
+        P2PSink& sink;
+        boost::asio::ip::tcp::socket socket;
+        P2PReader reader;
+        std::vector<char> buf;
+        std::vector<unsigned char> wanted;  // Announced in what was just read: a getdata payload, less its count
+        bool shookHands = false;
+
+        Conn(P2PSink& s) : sink(s), socket(s.ios), reader(s.magic), buf(READ_SIZE)
+        {
+            reader.reply = [this](const char* msgname, const unsigned char* data, uint32_t size) {
+                Send(msgname, data, size);
+            };
+            reader.onTx = [this](const unsigned char* tx, uint32_t size) {
+                sink.txs.fetch_add(1, std::memory_order_relaxed);
+                if (sink.verify && !sink.verify(tx, size)) sink.invalid.fetch_add(1, std::memory_order_relaxed);
+            };
+            reader.onTxInv = [this](const unsigned char* txid) {
+                uint32_t type = 1;  // MSG_TX
+                wanted.insert(wanted.end(), (const unsigned char*)&type, (const unsigned char*)&type + 4);
+                wanted.insert(wanted.end(), txid, txid + 32);
+            };
+        }
+
+        /** Ask for everything announced since the last time, at most 50000 (the protocol's limit) per getdata */
+        void Request()
+        {
+            static const size_t MAX_GETDATA = 50000;
+            std::vector<unsigned char> msg;
+            for (size_t pos = 0; pos < wanted.size(); pos += MAX_GETDATA * 36)
+            {
+                uint16_t count = std::min(wanted.size() - pos, MAX_GETDATA * 36) / 36;
+                msg.clear();
+                if (count < 0xfd)
+                    msg.push_back(count);
+                else
+                {
+                    msg.push_back(0xfd);
+                    msg.insert(msg.end(), (const unsigned char*)&count, (const unsigned char*)&count + 2);
+                }
+                msg.insert(msg.end(), wanted.begin() + pos, wanted.begin() + pos + count * 36);
+                Send(GETDATA_MSG, msg.data(), msg.size());
+            }
+            wanted.clear();
+        }
+
+        /** Send a message.  Only the handshake, pongs and getdata are sent, so blocking is harmless */
+        void Send(const char* msgname, const unsigned char* data, uint32_t size)
+        {
+            std::vector<unsigned char> msg(P2PReader::HEADER_SIZE + size, 0);
+            memcpy(&msg[0], sink.magic.data(), 4);
+            memcpy(&msg[4], msgname, 12);
+            memcpy(&msg[4 + 12], &size, 4);  // The checksum is left 0, meaning none
+            if (size) memcpy(&msg[P2PReader::HEADER_SIZE], data, size);
+            boost::system::error_code ignored;
+            boost::asio::write(socket, boost::asio::buffer(msg), ignored);
+        }
+
+        void Read()
+        {
+            auto self = shared_from_this();
+            socket.async_read_some(boost::asio::buffer(buf), [this, self](const boost::system::error_code& e, size_t len) {
+                    if (e) return;
+                    sink.bytes.fetch_add(len, std::memory_order_relaxed);
+                    if (!reader.Feed(buf.data(), len)) return;  // Not P2P, so drop it
+                    Request();
+                    if (reader.gotVersion && !shookHands)
+                    {
+                        shookHands = true;
+                        auto version = VersionPayload(std::vector<unsigned char>(16, 0).data(), 0, 0,
+                            std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::system_clock::now().time_since_epoch()).count());
+                        Send(VER_MSG, version.data(), version.size());
+                        Send(VERACK_MSG, nullptr, 0);
+                    }
+                    Read();
+                });
+        }
+    };
+
+    std::vector<unsigned char> magic;
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread thrd;
+
+    void Accept()
+    {
+        auto c = std::make_shared<Conn>(*this);
+        acceptor.async_accept(c->socket, [this, c](const boost::system::error_code& e) {
+                if (e) return;
+                connections++;
+                boost::system::error_code ignored;
+                c->socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+                c->Read();
+                Accept();
+            });
+    }
+
+public:
+    /** Listen on 127.0.0.1:port for peers on the network with this netMagic.  Port 0 picks a free one */
+    P2PSink(const std::vector<unsigned char>& netMagic, uint16_t port = 0)
+        : magic(netMagic), acceptor(ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port))
+    {
+    }
+
+    ~P2PSink() { Stop(); }
+
+    uint16_t Port() const { return acceptor.local_endpoint().port(); }
+
+    void Start()
+    {
+        Accept();
+        thrd = std::thread([this] { ios.run(); });
+    }
+
+    void Stop()
+    {
+        if (!thrd.joinable()) return;
+        ios.stop();
+        thrd.join();
+    }
+
+    /** Wait up to timeoutMs for n transactions to have arrived.  Returns false if they didn't */
+    bool WaitFor(uint64_t n, unsigned int timeoutMs)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (txs.load() < n)
+        {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#define HAVE_CONFIG_H
+#include "snapshot.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char MAGIC[8] = {'T', 'X', 'U', 'C', 'O', 'I', 'N', 'S'};
+const uint32_t ENDIAN_MARK = 0x01020304;
+const unsigned int SECRET_SIZE = 32;
+const unsigned int EXTRA_KEY_SIZE = SECRET_SIZE + 1;  // secret then compressed flag
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t coins;
+    uint32_t derivedKeys;
+    uint32_t extraKeys;
+    unsigned char keySeed[32];
+    unsigned char netMagic[4];
+    uint32_t reserved;
+};
+
+size_t Align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/** Where each section starts, relative to the beginning of the file */
+class Layout
+{
+public:
+    size_t txids, vouts, amounts, keyIdxs, scriptTypes, extraKeys, total;
+
+    Layout(uint64_t coins, uint32_t extra)
+    {
+        txids = Align8(sizeof(Header));
+        vouts = Align8(txids + coins * sizeof(uint256));
+        amounts = Align8(vouts + coins * sizeof(uint32_t));
+        keyIdxs = Align8(amounts + coins * sizeof(uint64_t));
+        scriptTypes = Align8(keyIdxs + coins * sizeof(uint32_t));
+        extraKeys = Align8(scriptTypes + coins * sizeof(uint8_t));
+        total = extraKeys + (size_t)extra * EXTRA_KEY_SIZE;
+    }
+};
+
+bool WriteAt(FILE* f, size_t offset, const void* data, size_t len)
+{
+    long pos = ftell(f);
+    static const char zeros[8] = {};
+    if ((pos < 0) || ((size_t)pos > offset) || (offset - pos > sizeof(zeros))) return false;
+    if ((offset > (size_t)pos) && (fwrite(zeros, 1, offset - pos, f) != offset - pos)) return false;
+    return (len == 0) || (fwrite(data, 1, len, f) == len);
+}
+}
+
+bool CoinSnapshot::Save(const std::string& path, const UtxoPool& pool, const KeyRing& keys,
+    const std::vector<unsigned char>& netMagic)
+{
+    // Slots with nothing in them (a mix empties the ones it spends without refilling) are left out, or a run that
+    // loads the snapshot would try to spend them
+    size_t empty = std::count(pool.amounts.begin(), pool.amounts.end(), (uint64_t)0);
+    UtxoPool compacted(keys);
+    if (empty)
+    {
+        compacted.reserve(pool.size() - empty);
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            if (pool.amounts[i] != 0)
+                compacted.push_back(pool.txids[i], pool.vouts[i], pool.amounts[i], pool.keyIdxs[i],
+                    (ScriptType)pool.scriptTypes[i]);
+        }
+    }
+    const UtxoPool& coins = empty ? compacted : pool;
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.endian = ENDIAN_MARK;
+    h.coins = coins.size();
+    h.derivedKeys = keys.Derived();
+    h.extraKeys = keys.size() - keys.Derived();
+    memcpy(h.keySeed, keys.Seed().begin(), 32);
+    memcpy(h.netMagic, netMagic.data(), std::min(netMagic.size(), sizeof(h.netMagic)));
+
+    std::vector<unsigned char> extra(h.extraKeys * EXTRA_KEY_SIZE);
+    for (uint32_t i = 0; i < h.extraKeys; i++)
+    {
+        const CKey& k = keys[h.derivedKeys + i].priv;
+        memcpy(&extra[i * EXTRA_KEY_SIZE], k.begin(), SECRET_SIZE);
+        extra[i * EXTRA_KEY_SIZE + SECRET_SIZE] = k.IsCompressed();
+    }
+
+    Layout l(h.coins, h.extraKeys);
+    std::string tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+    {
+        printf("Cannot create coin snapshot %s: %s\n", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = WriteAt(f, 0, &h, sizeof(h)) && WriteAt(f, l.txids, coins.txids.data(), h.coins * sizeof(uint256)) &&
+              WriteAt(f, l.vouts, coins.vouts.data(), h.coins * sizeof(uint32_t)) &&
+              WriteAt(f, l.amounts, coins.amounts.data(), h.coins * sizeof(uint64_t)) &&
+              WriteAt(f, l.keyIdxs, coins.keyIdxs.data(), h.coins * sizeof(uint32_t)) &&
+              WriteAt(f, l.scriptTypes, coins.scriptTypes.data(), h.coins * sizeof(uint8_t)) &&
+              WriteAt(f, l.extraKeys, extra.data(), extra.size());
+    ok = (fflush(f) == 0) && ok;
+    ok = (fsync(fileno(f)) == 0) && ok;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || (rename(tmpPath.c_str(), path.c_str()) != 0))
+    {
+        printf("Cannot write coin snapshot %s: %s\n", path.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CoinSnapshot::Load(const std::string& path, UtxoPool& pool, KeyRing& keys,
+    const std::vector<unsigned char>& netMagic, unsigned int threads)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Cannot open coin snapshot %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(Header)))
+    {
+        printf("Coin snapshot %s is truncated\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("Cannot map coin snapshot %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const unsigned char* base = (const unsigned char*)map;
+
+    Header h;
+    memcpy(&h, base, sizeof(h));
+    const char* problem = nullptr;
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+        problem = "is not a coin snapshot";
+    else if (h.version != VERSION)
+        problem = "is a different snapshot version";
+    else if (h.endian != ENDIAN_MARK)
+        problem = "was written on a machine with a different byte order";
+    else if ((netMagic.size() != sizeof(h.netMagic)) || (memcmp(h.netMagic, netMagic.data(), sizeof(h.netMagic)) != 0))
+        problem = "is for a different network";
+    else if ((h.derivedKeys == 0) || (Layout(h.coins, h.extraKeys).total > (size_t)st.st_size))
+        problem = "is truncated or corrupt";
+    if (problem)
+    {
+        printf("Coin snapshot %s %s\n", path.c_str(), problem);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    Layout l(h.coins, h.extraKeys);
+    keys.Generate(uint256(std::vector<unsigned char>(h.keySeed, h.keySeed + 32)), h.derivedKeys, threads);
+    for (uint32_t i = 0; i < h.extraKeys; i++)
+    {
+        const unsigned char* k = base + l.extraKeys + i * EXTRA_KEY_SIZE;
+        CKey key;
+        key.Set(k, k + SECRET_SIZE, k[SECRET_SIZE] != 0);
+        keys.Add(key);
+    }
+
+    pool.resize(h.coins);
+    memcpy(pool.txids.data(), base + l.txids, h.coins * sizeof(uint256));
+    memcpy(pool.vouts.data(), base + l.vouts, h.coins * sizeof(uint32_t));
+    memcpy(pool.amounts.data(), base + l.amounts, h.coins * sizeof(uint64_t));
+    memcpy(pool.keyIdxs.data(), base + l.keyIdxs, h.coins * sizeof(uint32_t));
+    memcpy(pool.scriptTypes.data(), base + l.scriptTypes, h.coins * sizeof(uint8_t));
+    munmap(map, st.st_size);
+
+    for (size_t i = 0; i < h.coins; i++)
+    {
+        if (pool.keyIdxs[i] >= keys.size())
+        {
+            printf("Coin snapshot %s refers to key %u, which does not exist\n", path.c_str(), pool.keyIdxs[i]);
+            pool.clear();
+            return false;
+        }
+    }
+    return true;
+}
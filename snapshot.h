@@ -0,0 +1,35 @@
+#ifndef TXUNAMI_SNAPSHOT_H
+#define TXUNAMI_SNAPSHOT_H
+
+#include <string>
+#include <vector>
+
+#include "keyring.h"
+#include "utxopool.h"
+
+/** Saves and restores a coin pool (and the key ring its key indexes refer to) as a binary file, so a run can start
+    from coins that a previous run already split instead of splitting again.
+
+    The file is a fixed header followed by the pool's arrays exactly as they are laid out in memory, each starting on
+    an 8 byte boundary, so loading is an mmap and a copy per array.  Keys are not stored: the ring is re-derived from
+    the seed in the header.  Only keys that were not derived (the funding coins' keys) are stored, as raw secrets.
+    Numbers are in host byte order; the header records the byte order and the network the coins belong to, and a
+    file that doesn't match is refused.
+*/
+class CoinSnapshot
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    /** Write pool and keys to path (via a temporary file and rename, so a crash never leaves half a snapshot).
+        Empty (0 satoshi) slots are left out.  Returns false, having printed why, on failure. */
+    static bool Save(const std::string& path, const UtxoPool& pool, const KeyRing& keys,
+        const std::vector<unsigned char>& netMagic);
+
+    /** Replace the contents of pool and keys with the snapshot in path, deriving keys with up to threads threads.
+        Returns false, having printed why, on failure. */
+    static bool Load(const std::string& path, UtxoPool& pool, KeyRing& keys, const std::vector<unsigned char>& netMagic,
+        unsigned int threads);
+};
+
+#endif
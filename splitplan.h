@@ -0,0 +1,85 @@
+#ifndef TXUNAMI_SPLITPLAN_H
+#define TXUNAMI_SPLITPLAN_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+/** The node's limits on chains of unconfirmed transactions (bitcoind's -limitancestorcount, -limitancestorsize,
+    -limitdescendantcount and -limitdescendantsize).  Counts include the transaction itself; sizes are in bytes. */
+class MempoolLimits
+{
+public:
+    uint64_t ancestorCount = 25;
+    uint64_t ancestorSize = 101000;
+    uint64_t descendantCount = 25;
+    uint64_t descendantSize = 101000;
+};
+
+/** Plans the preparation phase's split tree so that no transaction exceeds the node's unconfirmed chain limits.
+
+    The split is made of levels: every coin of a level is spent by one transaction to the same number of outputs,
+    so a level's transactions are independent of each other and the node can validate them in any order.  Each
+    confirmed coin is the root of a tree of unconfirmed transactions, in which a transaction's ancestors are the path
+    up to the root and the root transaction's descendants are the whole tree.  The planner adds levels, each as wide
+    as splitPerTx allows, until the next one would break a limit, and then asks for the tree to be confirmed so that
+    every leaf becomes the root of a new tree.
+*/
+class SplitPlanner
+{
+public:
+    /** Bytes of a transaction that spends a P2PKH coin to n P2PKH outputs, at most */
+    static uint64_t TxSize(unsigned int n) { return 10 + 148 + 34 * n; }
+
+    class Level
+    {
+    public:
+        unsigned int split;  // Outputs per transaction
+        uint64_t coins;  // Coins once the level is done
+        bool confirmAfter;  // Must be confirmed before the next level is sent
+    };
+
+    /** Plan how to split inputs (confirmed) coins into at least minUtxos without any transaction exceeding limits */
+    static std::vector<Level> Plan(uint64_t inputs, uint64_t minUtxos, unsigned int splitPerTx,
+                                   const MempoolLimits& limits)
+    {
+        if ((limits.ancestorCount < 1) || (limits.descendantCount < 1) || (TxSize(2) > limits.ancestorSize) ||
+            (TxSize(2) > limits.descendantSize) || (splitPerTx < 2))
+            throw std::invalid_argument("these mempool limits don't allow a single split transaction");
+
+        std::vector<Level> ret;
+        uint64_t coins = inputs;
+        // The tree each confirmed coin roots: its depth, transactions, leaves, and the bytes of its transactions
+        // and of the path down to a leaf
+        uint64_t depth = 0, txs = 0, leaves = 1, treeSize = 0, pathSize = 0;
+        while ((coins > 0) && (coins < minUtxos))
+        {
+            // Split by the maximum allowed per tx, or by the minimum needed to get beyond minUtxos
+            unsigned int split = (minUtxos / coins < splitPerTx) ? minUtxos / coins + 1 : splitPerTx;
+            // Each leaf is spent by a transaction, so the level adds leaves transactions to the tree
+            uint64_t room = (limits.descendantSize > treeSize) ? (limits.descendantSize - treeSize) / leaves : 0;
+            while ((split > 1) && ((TxSize(split) > room) || (pathSize + TxSize(split) > limits.ancestorSize)))
+                split--;
+            if ((depth + 1 > limits.ancestorCount) || (txs + leaves > limits.descendantCount) || (split < 2))
+            {
+                if (depth == 0)
+                    throw std::invalid_argument("these mempool limits don't allow a single split transaction");
+                ret.back().confirmAfter = true;
+                depth = txs = treeSize = pathSize = 0;
+                leaves = 1;
+                continue;
+            }
+            depth++;
+            txs += leaves;
+            treeSize += leaves * TxSize(split);
+            pathSize += TxSize(split);
+            leaves *= split;
+            coins *= split;
+            ret.push_back(Level{split, coins, false});
+        }
+        return ret;
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef TXUNAMI_TRACE_H
+#define TXUNAMI_TRACE_H
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** Stage level tracing of the per transaction path.
+
+    Built only with TXUNAMI_TRACE defined (make TRACE=1).  Otherwise TRACE_SCOPE compiles to nothing and the Tracer
+    has nothing to report, so the hot path pays nothing for it.
+
+    A TRACE_SCOPE(stage) times the rest of its block with the CPU's timestamp counter.  Each thread records its own
+    timings, without locks, into a buffer of its own: a running count, total and maximum per stage, and a ring of the
+    most recent individual events.  The totals are printed as a table (Tracer::Report) and the events can be written
+    as a Chrome trace (Tracer::WriteChrome) to be browsed in chrome://tracing or https://ui.perfetto.dev.
+*/
+
+/** The stages of making and sending a transaction.  They don't overlap, so their times add up */
+enum class TraceStage : uint8_t
+{
+    COINS,  // Taking coins from the dispenser
+    PREPARE,  // Patching the coins and keys into the template and laying out the sighash preimages
+    SIGHASH,  // Hashing the preimages
+    SIGN,  // ECDSA or Schnorr signing of one input
+    TXID,  // Hashing the finished transaction
+    SERIALIZE,  // Serializing a CTransaction (coin splitting only; the templates are laid out serialized)
+    RING,  // Handing a signed transaction from a signer to its sender
+    QUEUE,  // Framing a message into a connection's outbound queue
+    WRITE,  // Socket writes
+    NUM
+};
+
+inline const char* TraceStageName(TraceStage s)
+{
+    static const char* names[] = {"coins", "prepare", "sighash", "sign", "txid", "serialize", "ring", "queue", "write"};
+    return names[(unsigned int)s];
+}
+
+/** The timestamp counter, or nanoseconds where there isn't one */
+inline uint64_t TraceTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/** Count, total and maximum ticks of each stage */
+class TraceTotals
+{
+public:
+    uint64_t count[(unsigned int)TraceStage::NUM] = {};
+    uint64_t ticks[(unsigned int)TraceStage::NUM] = {};
+    uint64_t maxTicks[(unsigned int)TraceStage::NUM] = {};
+};
+
+/** One thread's timings.  Written only by that thread */
+class TraceBuffer
+{
+public:
+    class Event
+    {
+    public:
+        uint64_t start;
+        uint32_t ticks;  // Saturates rather than wraps
+        TraceStage stage;
+    };
+
+    std::string name;
+    unsigned int tid;
+    TraceTotals totals;
+    TraceTotals reported;  // totals as of the last Report
+    std::vector<Event> events;  // A ring of the most recent, oldest at next once it has wrapped
+    uint64_t recorded = 0;
+
+    TraceBuffer(unsigned int _tid, size_t capacity) : name("thread " + std::to_string(_tid)), tid(_tid)
+    {
+        events.resize(std::max(capacity, (size_t)1));
+    }
+
+    void Record(TraceStage s, uint64_t start, uint64_t end)
+    {
+        uint64_t t = end - start;
+        unsigned int i = (unsigned int)s;
+        totals.count[i]++;
+        totals.ticks[i] += t;
+        if (t > totals.maxTicks[i]) totals.maxTicks[i] = t;
+        Event& e = events[recorded++ % events.size()];
+        e.start = start;
+        e.ticks = (t > UINT32_MAX) ? UINT32_MAX : t;
+        e.stage = s;
+    }
+};
+
+/** Owns every thread's TraceBuffer, which outlive their threads so that they can be reported at the end */
+class Tracer
+{
+protected:
+    std::mutex cs;  // Guards buffers.  Only taken when a thread first records, and to report
+    std::vector<std::unique_ptr<TraceBuffer> > buffers;
+    uint64_t startTicks;
+    std::chrono::steady_clock::time_point startTime;
+
+    Tracer() : startTicks(TraceTicks()), startTime(std::chrono::steady_clock::now()) {}
+
+    /** Ticks per microsecond, measured over the run so far */
+    double TicksPerUs()
+    {
+        double us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                          startTime).count();
+        return (us > 0) ? (TraceTicks() - startTicks) / us : 1;
+    }
+
+public:
+    /** Events each thread keeps for WriteChrome.  Set before any thread records */
+    static size_t& Capacity()
+    {
+        static size_t capacity = 65536;
+        return capacity;
+    }
+
+    static Tracer& Get()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    /** This thread's buffer */
+    static TraceBuffer& Buffer()
+    {
+        thread_local TraceBuffer* buf = nullptr;
+        if (!buf)
+        {
+            Tracer& t = Get();
+            std::lock_guard<std::mutex> lock(t.cs);
+            t.buffers.emplace_back(new TraceBuffer(t.buffers.size() + 1, Capacity()));
+            buf = t.buffers.back().get();
+        }
+        return *buf;
+    }
+
+    /** Name this thread in reports */
+    static void NameThread(const std::string& name)
+    {
+#ifdef TXUNAMI_TRACE
+        Buffer().name = name;
+#endif
+    }
+
+    /** Print a table of the time spent in each stage since the last report.  Call it when the threads it covers
+        have finished (or are otherwise synchronized with the caller), since it reads their buffers */
+    void Report(const std::string& title)
+    {
+#ifdef TXUNAMI_TRACE
+        std::lock_guard<std::mutex> lock(cs);
+        TraceTotals sum;
+        for (auto& b : buffers)
+        {
+            for (unsigned int i = 0; i < (unsigned int)TraceStage::NUM; i++)
+            {
+                sum.count[i] += b->totals.count[i] - b->reported.count[i];
+                sum.ticks[i] += b->totals.ticks[i] - b->reported.ticks[i];
+                sum.maxTicks[i] = std::max(sum.maxTicks[i], b->totals.maxTicks[i]);
+            }
+            b->reported = b->totals;
+        }
+        double perUs = TicksPerUs();
+        uint64_t all = 0;
+        for (unsigned int i = 0; i < (unsigned int)TraceStage::NUM; i++) all += sum.ticks[i];
+        printf("%s: time by stage, over all threads (max is over the whole run)\n", title.c_str());
+        printf("  %-10s %12s %12s %10s %10s %6s\n", "stage", "calls", "total ms", "avg us", "max us", "%");
+        for (unsigned int i = 0; i < (unsigned int)TraceStage::NUM; i++)
+        {
+            if (sum.count[i] == 0) continue;
+            printf("  %-10s %12lu %12.1f %10.2f %10.1f %6.1f\n", TraceStageName((TraceStage)i), sum.count[i],
+                   sum.ticks[i] / perUs / 1000, sum.ticks[i] / perUs / sum.count[i], sum.maxTicks[i] / perUs,
+                   all ? 100.0 * sum.ticks[i] / all : 0);
+        }
+#endif
+    }
+
+    /** Write each thread's recent events as Chrome trace event JSON.  Returns false if path can't be written */
+    bool WriteChrome(const std::string& path)
+    {
+#ifdef TXUNAMI_TRACE
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f)
+        {
+            printf("Cannot write %s\n", path.c_str());
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(cs);
+        double perUs = TicksPerUs();
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        const char* sep = "";
+        for (auto& b : buffers)
+        {
+            std::string name;
+            for (char c : b->name)
+                if ((c != '"') && (c != '\\')) name += c;
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", sep,
+                    b->tid, name.c_str());
+            sep = ",\n";
+            size_t n = std::min(b->recorded, (uint64_t)b->events.size());
+            for (size_t k = b->recorded - n; k < b->recorded; k++)
+            {
+                const TraceBuffer::Event& e = b->events[k % b->events.size()];
+                double ts = (e.start > startTicks) ? (e.start - startTicks) / perUs : 0;
+                fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", sep,
+                        TraceStageName(e.stage), b->tid, ts, e.ticks / perUs);
+            }
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
+#else
+        printf("Not writing %s: txunami was built without tracing (make TRACE=1)\n", path.c_str());
+        return false;
+#endif
+    }
+};
+
+#ifdef TXUNAMI_TRACE
+/** Times the rest of the enclosing block as stage s */
+class TraceScope
+{
+    TraceStage stage;
+    uint64_t start;
+
+public:
+    TraceScope(TraceStage s) : stage(s), start(TraceTicks()) {}
+    ~TraceScope() { Tracer::Buffer().Record(stage, start, TraceTicks()); }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(s) TraceScope TRACE_CONCAT(traceScope, __LINE__)(TraceStage::s)
+#else
+#define TRACE_SCOPE(s) do {} while (0)
+#endif
+
+#endif
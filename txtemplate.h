@@ -0,0 +1,329 @@
+#ifndef TXUNAMI_TXTEMPLATE_H
+#define TXUNAMI_TXTEMPLATE_H
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "schnorr.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "sha256multi.h"
+#include "sighash.h"
+#include "trace.h"
+#include "utxopool.h"
+
+/** Script policy for TxTemplate: coins are locked to and spent from pay-to-public-key-hash scripts */
+class P2PKHScript
+{
+public:
+    static const unsigned int SCRIPT_SIZE = 25;
+    static const unsigned int PUBKEY_SIZE = 33;  // Only compressed public keys are supported
+    static const unsigned int MAX_SIG_SIZE = 73;  // DER ECDSA plus the sighash type byte (Schnorr is always 65)
+    static const unsigned int MAX_SCRIPTSIG_SIZE = 1 + MAX_SIG_SIZE + 1 + PUBKEY_SIZE;
+    static const ScriptType TYPE = ScriptType::P2PKH;
+
+    static void WriteScript(unsigned char* p, const CKeyID& dest)
+    {
+        p[0] = OP_DUP;
+        p[1] = OP_HASH160;
+        p[2] = 20;
+        memcpy(p + 3, dest.begin(), 20);
+        p[23] = OP_EQUALVERIFY;
+        p[24] = OP_CHECKSIG;
+    }
+
+    /** Write the scriptSig (without its length prefix), returning its length */
+    static unsigned int WriteScriptSig(unsigned char* p, const std::vector<unsigned char>& sig, const CPubKey& pub)
+    {
+        p[0] = sig.size();
+        memcpy(p + 1, sig.data(), sig.size());
+        p[1 + sig.size()] = PUBKEY_SIZE;
+        memcpy(p + 2 + sig.size(), pub.begin(), PUBKEY_SIZE);
+        return 2 + sig.size() + PUBKEY_SIZE;
+    }
+};
+
+/** Builds NIN input, NOUT output transactions directly in wire format.
+    Every byte that is the same from transaction to transaction (version, counts, sequence numbers, script
+    skeletons, locktime) is laid down once when the template is constructed, and Build only patches the prevouts,
+    values, destination hashes and signatures.  The BIP143 sighash and the txid are computed straight from these
+    bytes (hashSequence once per template, the shared first preimage block once per transaction), so once the
+    signature buffer has grown to its maximum size building a transaction does no heap allocation at all.
+
+    Coins are passed as iterators to objects providing txid(), vout(), satoshi(), scriptType(), privKey(), pubKey(),
+    keyID() and Set() (like UtxoPool::Coin).  Like createTx, outputs split the input value evenly and are Set to
+    describe the new coin.  Outputs are only written after every input has been read, so a 1 input 1 output
+    transaction can use the same slot for both.
+*/
+template <unsigned int NIN, unsigned int NOUT, class Script = P2PKHScript> class TxTemplate
+{
+public:
+    static_assert((NIN > 0) && (NIN < 0xfd) && (NOUT > 0) && (NOUT < 0xfd), "counts must fit in a 1 byte compact size");
+
+    static const int32_t VERSION = CTransaction::CURRENT_VERSION;
+    static const uint32_t SEQUENCE = 0xffffffff;
+    static const uint32_t LOCKTIME = 0;
+    static const uint32_t SIGHASH_TYPE = SIGHASH_ALL | SIGHASH_FORKID;
+    static const unsigned int OUTPOINT_SIZE = 32 + 4;
+    static const unsigned int MAX_INPUT_SIZE = OUTPOINT_SIZE + 1 + Script::MAX_SCRIPTSIG_SIZE + 4;
+    static const unsigned int OUTPUT_SIZE = 8 + 1 + Script::SCRIPT_SIZE;
+    static const unsigned int MAX_SIZE = 4 + 1 + NIN * MAX_INPUT_SIZE + 1 + NOUT * OUTPUT_SIZE + 4;
+    // BIP143 preimage: version, hashPrevouts, hashSequence, outpoint, scriptCode, amount, sequence, hashOutputs,
+    // locktime, sighash type
+    static const unsigned int PREIMAGE_SIZE =
+        4 + 32 + 32 + OUTPOINT_SIZE + 1 + Script::SCRIPT_SIZE + 8 + 4 + 32 + 4 + 4;
+
+protected:
+    unsigned char buf[MAX_SIZE];
+    size_t len = 0;
+    unsigned char outputs[1 + NOUT * OUTPUT_SIZE];  // Count then outputs. Without the count, the hashOutputs preimage
+    unsigned char outpoints[NIN * OUTPOINT_SIZE];  // Also the hashPrevouts preimage
+    unsigned char preimages[NIN][PREIMAGE_SIZE];
+    uint256 hashSequence;
+    uint64_t outQty = 0;
+    std::vector<unsigned char> sig;
+
+public:
+    uint256 txid;
+    SchnorrSigner* schnorr = nullptr;  // If set, sign with Schnorr instead of ECDSA
+
+    TxTemplate()
+    {
+        sig.reserve(Script::MAX_SIG_SIZE);
+
+        outputs[0] = NOUT;
+        for (unsigned int i = 0; i < NOUT; i++)
+        {
+            unsigned char* o = &outputs[1 + i * OUTPUT_SIZE];
+            WriteLE64(o, 0);
+            o[8] = Script::SCRIPT_SIZE;
+            Script::WriteScript(o + 9, CKeyID());
+        }
+
+        unsigned char seqs[NIN * 4];
+        for (unsigned int i = 0; i < NIN; i++) WriteLE32(&seqs[i * 4], SEQUENCE);
+        CHash256().Write(seqs, sizeof(seqs)).Finalize(hashSequence.begin());
+
+        // Lay down the constant parts of the sighash preimages
+        for (unsigned int i = 0; i < NIN; i++)
+        {
+            unsigned char* p = preimages[i];
+            WriteLE32(p, VERSION);
+            memcpy(p + 4 + 32, hashSequence.begin(), 32);
+            p += 4 + 32 + 32 + OUTPOINT_SIZE;
+            p[0] = Script::SCRIPT_SIZE;
+            p += 1 + Script::SCRIPT_SIZE + 8;
+            WriteLE32(p, SEQUENCE);
+            p += 4 + 32;
+            WriteLE32(p, LOCKTIME);
+            WriteLE32(p + 4, SIGHASH_TYPE);
+        }
+    }
+
+    const char* data() const { return (const char*)buf; }
+    size_t size() const { return len; }
+
+    /** Build a transaction spending NIN coins starting at in to NOUT coins starting at out.
+        Returns false if the inputs can't pay the fee, or can't be spent by this template. */
+    template <class InIter, class OutIter> bool Build(InIter in, OutIter out, uint64_t fee)
+    {
+        {
+            TRACE_SCOPE(PREPARE);
+            if (!Prepare(in, out, fee)) return false;
+        }
+
+        uint256 sighashes[NIN];
+        {
+            TRACE_SCOPE(SIGHASH);
+            // The first block of the preimage is identical for every input so compress it once
+            CSHA256 prefix;
+            prefix.Write(preimages[0], SIGHASH_SHARED_PREFIX);
+            for (unsigned int i = 0; i < NIN; i++)
+                SighashFromMidstate(prefix, &preimages[i][SIGHASH_SHARED_PREFIX], PREIMAGE_SIZE - SIGHASH_SHARED_PREFIX,
+                    sighashes[i]);
+        }
+
+        Sign(in, sighashes);
+        {
+            TRACE_SCOPE(TXID);
+            CHash256().Write(buf, len).Finalize(txid.begin());
+        }
+        Commit(out);
+        return true;
+    }
+
+    // Build is split into these steps so TxTemplateBatch can hash many transactions' preimages and txids together.
+
+    /** Patch in the coins and fill in the sighash preimages.  Returns false if the transaction can't be built */
+    template <class InIter, class OutIter> bool Prepare(InIter in, OutIter out, uint64_t fee)
+    {
+        uint64_t inQty = 0;
+        InIter it = in;
+        for (unsigned int i = 0; i < NIN; i++, ++it)
+        {
+            if ((it->pubKey().size() != Script::PUBKEY_SIZE) || (it->scriptType() != Script::TYPE))
+                return false;
+            inQty += it->satoshi();
+            unsigned char* op = &outpoints[i * OUTPOINT_SIZE];
+            memcpy(op, it->txid().begin(), 32);
+            WriteLE32(op + 32, it->vout());
+        }
+
+        if (fee > inQty) return false;
+        outQty = (inQty - fee) / NOUT;
+        if (outQty == 0) return false;
+
+        OutIter ot = out;
+        for (unsigned int i = 0; i < NOUT; i++, ++ot)
+        {
+            unsigned char* o = &outputs[1 + i * OUTPUT_SIZE];
+            WriteLE64(o, outQty);
+            memcpy(o + 9 + 3, ot->keyID().begin(), 20);
+        }
+
+        // Fields of the sighash preimage that are common to every input
+        CHash256().Write(outpoints, sizeof(outpoints)).Finalize(&preimages[0][4]);
+        CHash256().Write(&outputs[1], NOUT * OUTPUT_SIZE).Finalize(&preimages[0][PREIMAGE_SIZE - 4 - 4 - 32]);
+
+        it = in;
+        for (unsigned int i = 0; i < NIN; i++, ++it)
+        {
+            unsigned char* pi = preimages[i];
+            if (i > 0)
+            {
+                memcpy(pi + 4, &preimages[0][4], 32);
+                memcpy(pi + PREIMAGE_SIZE - 4 - 4 - 32, &preimages[0][PREIMAGE_SIZE - 4 - 4 - 32], 32);
+            }
+            pi += 4 + 32 + 32;
+            memcpy(pi, &outpoints[i * OUTPOINT_SIZE], OUTPOINT_SIZE);
+            pi += OUTPOINT_SIZE + 1;
+            Script::WriteScript(pi, it->keyID());
+            WriteLE64(pi + Script::SCRIPT_SIZE, it->satoshi());
+        }
+        return true;
+    }
+
+    const unsigned char* Preimage(unsigned int i) const { return preimages[i]; }
+
+    /** Sign every input given its sighash, and lay out the complete transaction */
+    template <class InIter> void Sign(InIter in, const uint256* sighashes)
+    {
+        unsigned char* p = buf;
+        WriteLE32(p, VERSION);
+        p[4] = NIN;
+        p += 5;
+
+        InIter it = in;
+        for (unsigned int i = 0; i < NIN; i++, ++it)
+        {
+            bool signedOk;
+            {
+                TRACE_SCOPE(SIGN);
+                signedOk = schnorr ? schnorr->Sign(sighashes[i], it->privKey(), it->pubKey(), sig) :
+                                     it->privKey().SignECDSA(sighashes[i], sig);
+            }
+            if (!signedOk)
+            {
+                printf("signing error");
+                abort();
+            }
+            sig.push_back((unsigned char)SIGHASH_TYPE);
+
+            memcpy(p, &outpoints[i * OUTPOINT_SIZE], OUTPOINT_SIZE);
+            p += OUTPOINT_SIZE;
+            unsigned int scriptSigLen = Script::WriteScriptSig(p + 1, sig, it->pubKey());
+            p[0] = scriptSigLen;
+            p += 1 + scriptSigLen;
+            WriteLE32(p, SEQUENCE);
+            p += 4;
+        }
+
+        memcpy(p, outputs, sizeof(outputs));
+        p += sizeof(outputs);
+        WriteLE32(p, LOCKTIME);
+        p += 4;
+        len = p - buf;
+    }
+
+    /** Once txid is set, make the output coins describe what this transaction created */
+    template <class OutIter> void Commit(OutIter out)
+    {
+        OutIter ot = out;
+        for (unsigned int i = 0; i < NOUT; i++, ++ot) ot->Set(txid, i, outQty, Script::TYPE);
+    }
+};
+
+/** Builds up to N same-shaped transactions at once so that their sighashes, and then their txids, can be double
+    SHA256ed together by the SIMD lanes of SHA256DMulti.
+    Transaction j spends the NIN coins starting at in + j*NIN to the NOUT coins starting at out + j*NOUT.
+*/
+template <unsigned int NIN, unsigned int NOUT, class Script, unsigned int N> class TxTemplateBatch
+{
+public:
+    TxTemplate<NIN, NOUT, Script> txs[N];
+    bool ok[N];
+
+    void UseSchnorr(SchnorrSigner* signer)
+    {
+        for (unsigned int j = 0; j < N; j++) txs[j].schnorr = signer;
+    }
+
+    /** Build min(count, N) transactions, returning how many were attempted.  ok[j] says whether txs[j] was built.
+        fee is called once per transaction. */
+    template <class InIter, class OutIter, class FeeFn>
+    unsigned int Build(InIter in, OutIter out, unsigned int count, FeeFn& fee)
+    {
+        if (count > N) count = N;
+
+        const unsigned char* msgs[N * NIN] = {};
+        size_t lens[N * NIN] = {};
+        uint256 hashes[N * NIN];
+        unsigned int m = 0;
+        for (unsigned int j = 0; j < count; j++)
+        {
+            {
+                TRACE_SCOPE(PREPARE);
+                ok[j] = txs[j].Prepare(in + j * NIN, out + j * NOUT, fee());
+            }
+            if (!ok[j]) continue;
+            for (unsigned int i = 0; i < NIN; i++, m++)
+            {
+                msgs[m] = txs[j].Preimage(i);
+                lens[m] = TxTemplate<NIN, NOUT, Script>::PREIMAGE_SIZE;
+            }
+        }
+        {
+            TRACE_SCOPE(SIGHASH);
+            SHA256DMulti(msgs, lens, m, hashes);
+        }
+
+        m = 0;
+        unsigned int t = 0;
+        for (unsigned int j = 0; j < count; j++)
+        {
+            if (!ok[j]) continue;
+            txs[j].Sign(in + j * NIN, &hashes[m]);
+            m += NIN;
+            msgs[t] = (const unsigned char*)txs[j].data();
+            lens[t] = txs[j].size();
+            t++;
+        }
+        {
+            TRACE_SCOPE(TXID);
+            SHA256DMulti(msgs, lens, t, hashes);
+        }
+
+        t = 0;
+        for (unsigned int j = 0; j < count; j++)
+        {
+            if (!ok[j]) continue;
+            txs[j].txid = hashes[t++];
+            txs[j].Commit(out + j * NOUT);
+        }
+        return count;
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef TXUNAMI_UTXOPOOL_H
+#define TXUNAMI_UTXOPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "hash.h"
+#include "keyring.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "uint256.h"
+
+/** How a coin's output script locks it to its key */
+enum class ScriptType : uint8_t
+{
+    P2PKH = 0,
+    P2PK = 1,
+    P2SH_MULTISIG = 2  // 2 of 3 multisig over the coin's key and the two after it in the ring
+};
+
+/** The coins txunami can spend, stored as a structure of arrays: txid, output index, amount, key index and script
+    type, 49 bytes per coin.  Keys live once in a KeyRing and scripts are rebuilt from the key when needed, so
+    tens of millions of coins fit in memory and the generator loops only touch the bytes they use.
+
+    Coins are accessed through UtxoPool::iterator, which acts like a pointer to a Coin.  When a transaction spends a
+    coin to a single output, the output can be written back into the spent coin's slot (see TxTemplate::Commit),
+    so the generation phase recycles slots in place.
+*/
+class UtxoPool
+{
+protected:
+    std::vector<uint256> txids;
+    std::vector<uint32_t> vouts;
+    std::vector<uint64_t> amounts;
+    std::vector<uint32_t> keyIdxs;
+    std::vector<uint8_t> scriptTypes;
+    const KeyRing* keys;
+
+    friend class CoinSnapshot;
+
+public:
+    static const size_t BYTES_PER_COIN = sizeof(uint256) + 4 + 8 + 4 + 1;
+
+    /** A reference to one slot in a pool */
+    class Coin
+    {
+    protected:
+        UtxoPool* pool;
+        size_t idx;
+
+    public:
+        Coin(UtxoPool* p, size_t i) : pool(p), idx(i) {}
+
+        const uint256& txid() const { return pool->txids[idx]; }
+        uint32_t vout() const { return pool->vouts[idx]; }
+        COutPoint prevout() const { return COutPoint(pool->txids[idx], pool->vouts[idx]); }
+        uint64_t satoshi() const { return pool->amounts[idx]; }
+        uint32_t keyIdx() const { return pool->keyIdxs[idx]; }
+        ScriptType scriptType() const { return (ScriptType)pool->scriptTypes[idx]; }
+
+        const CKey& privKey() const { return (*pool->keys)[keyIdx()].priv; }
+        const CPubKey& pubKey() const { return (*pool->keys)[keyIdx()].pub; }
+        const CKeyID& keyID() const { return (*pool->keys)[keyIdx()].id; }
+
+        /** Key i (0 to 2) of this coin's multisig: its own key and the next two in the ring */
+        const KeyRing::Key& multisigKey(unsigned int i) const
+        {
+            return (*pool->keys)[(keyIdx() + i) % pool->keys->size()];
+        }
+
+        /** The script a P2SH_MULTISIG coin's hash commits to.  Also the script its signatures cover */
+        CScript redeemScript() const
+        {
+            return CScript() << OP_2 << ToByteVector(multisigKey(0).pub) << ToByteVector(multisigKey(1).pub)
+                             << ToByteVector(multisigKey(2).pub) << OP_3 << OP_CHECKMULTISIG;
+        }
+
+        /** Rebuild the output script this coin is locked by */
+        CScript constraintScript() const { return constraintScript(scriptType()); }
+
+        /** The output script that would lock this coin's key(s) with type */
+        CScript constraintScript(ScriptType type) const
+        {
+            CScript ret;
+            if (type == ScriptType::P2PK)
+                ret << ToByteVector(pubKey()) << OP_CHECKSIG;
+            else if (type == ScriptType::P2SH_MULTISIG)
+            {
+                CScript redeem = redeemScript();
+                ret << OP_HASH160 << ToByteVector(Hash160(redeem.begin(), redeem.end())) << OP_EQUAL;
+            }
+            else
+                ret << OP_DUP << OP_HASH160 << ToByteVector(keyID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+            return ret;
+        }
+
+        /** Make this slot describe output n of txid.  The key stays the same */
+        void Set(const uint256& txid, uint32_t n, uint64_t satoshi, ScriptType type = ScriptType::P2PKH)
+        {
+            pool->txids[idx] = txid;
+            pool->vouts[idx] = n;
+            pool->amounts[idx] = satoshi;
+            pool->scriptTypes[idx] = (uint8_t)type;
+        }
+
+        void SetKey(uint32_t keyIdx) { pool->keyIdxs[idx] = keyIdx; }
+    };
+
+    /** Random access iterator over the coins of a pool.  -> and * give the Coin in the current slot */
+    class iterator : protected Coin
+    {
+    public:
+        iterator(UtxoPool* p, size_t i) : Coin(p, i) {}
+
+        Coin* operator->() { return this; }
+        const Coin* operator->() const { return this; }
+        Coin& operator*() { return *this; }
+
+        iterator& operator++()
+        {
+            idx++;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator ret = *this;
+            idx++;
+            return ret;
+        }
+        iterator& operator+=(ptrdiff_t n)
+        {
+            idx += n;
+            return *this;
+        }
+        iterator operator+(ptrdiff_t n) const { return iterator(pool, idx + n); }
+        ptrdiff_t operator-(const iterator& other) const { return (ptrdiff_t)idx - (ptrdiff_t)other.idx; }
+        bool operator==(const iterator& other) const { return idx == other.idx; }
+        bool operator!=(const iterator& other) const { return idx != other.idx; }
+        size_t index() const { return idx; }
+    };
+
+    UtxoPool(const KeyRing& ring) : keys(&ring) {}
+
+    size_t size() const { return txids.size(); }
+    size_t Bytes() const { return size() * BYTES_PER_COIN; }
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, size()); }
+    Coin operator[](size_t idx) { return Coin(this, idx); }
+
+    /** Grow or shrink the pool.  New slots are zeroed and locked to key 0 */
+    void resize(size_t n)
+    {
+        txids.resize(n);
+        vouts.resize(n);
+        amounts.resize(n);
+        keyIdxs.resize(n);
+        scriptTypes.resize(n);
+    }
+
+    void reserve(size_t n)
+    {
+        txids.reserve(n);
+        vouts.reserve(n);
+        amounts.reserve(n);
+        keyIdxs.reserve(n);
+        scriptTypes.reserve(n);
+    }
+
+    void push_back(const uint256& txid, uint32_t vout, uint64_t satoshi, uint32_t keyIdx, ScriptType type)
+    {
+        txids.push_back(txid);
+        vouts.push_back(vout);
+        amounts.push_back(satoshi);
+        keyIdxs.push_back(keyIdx);
+        scriptTypes.push_back((uint8_t)type);
+    }
+
+    /** Remove every coin and give the memory back */
+    void clear()
+    {
+        std::vector<uint256>().swap(txids);
+        std::vector<uint32_t>().swap(vouts);
+        std::vector<uint64_t>().swap(amounts);
+        std::vector<uint32_t>().swap(keyIdxs);
+        std::vector<uint8_t>().swap(scriptTypes);
+    }
+
+    void swap(UtxoPool& other)
+    {
+        txids.swap(other.txids);
+        vouts.swap(other.vouts);
+        amounts.swap(other.amounts);
+        keyIdxs.swap(other.keyIdxs);
+        scriptTypes.swap(other.scriptTypes);
+        std::swap(keys, other.keys);
+    }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef TXUNAMI_WORKLOAD_H
+#define TXUNAMI_WORKLOAD_H
+
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "utxopool.h"
+
+/** A weighted choice among values: Pick returns each with probability proportional to its weight */
+template <class T> class Weighted
+{
+protected:
+    std::vector<T> values;
+    std::vector<double> cumulative;
+
+public:
+    void Add(const T& v, double weight)
+    {
+        if (weight <= 0) return;
+        values.push_back(v);
+        cumulative.push_back((cumulative.empty() ? 0 : cumulative.back()) + weight);
+    }
+
+    bool empty() const { return values.empty(); }
+    const std::vector<T>& Values() const { return values; }
+
+    /** The expected value of f(Pick()) */
+    template <class F> double Mean(F f) const
+    {
+        double sum = 0;
+        for (size_t i = 0; i < values.size(); i++) sum += (cumulative[i] - (i ? cumulative[i - 1] : 0)) * f(values[i]);
+        return values.empty() ? 0 : sum / cumulative.back();
+    }
+
+    template <class Rng> const T& Pick(Rng& rng) const
+    {
+        if (values.size() == 1) return values[0];
+        double r = std::uniform_real_distribution<double>(0, cumulative.back())(rng);
+        size_t i = std::upper_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin();
+        return values[std::min(i, values.size() - 1)];
+    }
+};
+
+/** The shapes of transaction a target sends, so that a node can be loaded by validation cost rather than just by
+    transaction count.  Each transaction picks a shape (by weight), which gives a range of input and output counts
+    to draw from -- many inputs to one output is a consolidation, one input to many outputs a fan-out.  Each output
+    then picks a script type (P2PKH, P2PK or 2 of 3 P2SH multisig) and the transaction picks an OP_RETURN payload
+    size (0 for none).  Counts are drawn uniformly from the shape's range.
+*/
+class WorkloadMix
+{
+public:
+    /** Limits on a shape's counts.  Together they must also keep MaxSize() within MAX_TX_SIZE */
+    static const unsigned int MAX_INPUTS = 200;
+    static const unsigned int MAX_OUTPUTS = 1000;
+    static const unsigned int MAX_OP_RETURN = 220;  // The default datacarrier limit, less the opcodes
+    static const unsigned int MAX_TX_SIZE = 100000;  // Nodes don't relay bigger transactions
+
+    /** The largest a transaction's parts can be when signed (ECDSA signatures are the biggest) */
+    static const unsigned int TX_OVERHEAD = 4 + 3 + 3 + 4;  // version, input and output counts, locktime
+    static const unsigned int MAX_P2PKH_INPUT = 36 + 1 + 1 + 73 + 1 + 33 + 4;
+    static const unsigned int MAX_P2PK_INPUT = 36 + 1 + 1 + 73 + 4;
+    static const unsigned int MAX_MULTISIG_INPUT = 36 + 3 + 1 + 2 * (1 + 73) + 2 + 105 + 4;  // OP_0, sigs, redeem script
+    static const unsigned int P2PKH_OUTPUT = 8 + 1 + 25;
+    static const unsigned int P2PK_OUTPUT = 8 + 1 + 35;
+    static const unsigned int P2SH_OUTPUT = 8 + 1 + 23;
+    static const unsigned int OP_RETURN_OUTPUT = 8 + 1 + 1 + 2;  // Plus the payload
+
+    class Range
+    {
+    public:
+        unsigned int lo = 1;
+        unsigned int hi = 1;
+    };
+
+    class Shape
+    {
+    public:
+        std::string name;
+        Range inputs;
+        Range outputs;
+    };
+
+    /** One transaction's draw */
+    class Draw
+    {
+    public:
+        unsigned int shape;
+        unsigned int inputs;
+        unsigned int outputs;
+        unsigned int opReturn;  // Payload bytes, 0 for no OP_RETURN output
+    };
+
+    std::vector<Shape> shapes;
+    Weighted<unsigned int> shapeWeights;  // Indexes into shapes
+    Weighted<ScriptType> scripts;
+    Weighted<unsigned int> opReturns;
+
+    template <class Rng> void Pick(Rng& rng, Draw& d) const
+    {
+        d.shape = shapeWeights.Pick(rng);
+        const Shape& s = shapes[d.shape];
+        d.inputs = std::uniform_int_distribution<unsigned int>(s.inputs.lo, s.inputs.hi)(rng);
+        d.outputs = std::uniform_int_distribution<unsigned int>(s.outputs.lo, s.outputs.hi)(rng);
+        d.opReturn = opReturns.empty() ? 0 : opReturns.Pick(rng);
+    }
+
+    template <class Rng> ScriptType PickScript(Rng& rng) const
+    {
+        return scripts.empty() ? ScriptType::P2PKH : scripts.Pick(rng);
+    }
+
+    static unsigned int MaxInputSize(ScriptType t)
+    {
+        if (t == ScriptType::P2PK) return MAX_P2PK_INPUT;
+        if (t == ScriptType::P2SH_MULTISIG) return MAX_MULTISIG_INPUT;
+        return MAX_P2PKH_INPUT;
+    }
+
+    static unsigned int OutputSize(ScriptType t)
+    {
+        if (t == ScriptType::P2PK) return P2PK_OUTPUT;
+        if (t == ScriptType::P2SH_MULTISIG) return P2SH_OUTPUT;
+        return P2PKH_OUTPUT;
+    }
+
+    /** An upper bound on the average size of the mix's transactions */
+    double MeanSize() const
+    {
+        double opReturn = opReturns.Mean([](unsigned int b) { return b ? OP_RETURN_OUTPUT + b : 0; });
+        return shapeWeights.Mean([this](unsigned int i) {
+            const Shape& s = shapes[i];
+            return TX_OVERHEAD + (s.inputs.lo + s.inputs.hi) / 2.0 * MAX_MULTISIG_INPUT +
+                   (s.outputs.lo + s.outputs.hi) / 2.0 * P2PK_OUTPUT;
+        }) + opReturn;
+    }
+
+    /** The biggest transaction the mix can make */
+    unsigned int MaxSize() const
+    {
+        unsigned int ins = 0, outs = 0, opReturn = 0;
+        for (const Shape& s : shapes)
+        {
+            ins = std::max(ins, s.inputs.hi);
+            outs = std::max(outs, s.outputs.hi);
+        }
+        for (unsigned int b : opReturns.Values()) opReturn = std::max(opReturn, b);
+        return TX_OVERHEAD + ins * MAX_MULTISIG_INPUT + outs * P2PK_OUTPUT + (opReturn ? OP_RETURN_OUTPUT + opReturn : 0);
+    }
+};
+
+/** What a target built from each shape of its mix */
+class MixStats
+{
+public:
+    class PerShape
+    {
+    public:
+        uint64_t txs = 0;
+        uint64_t bytes = 0;
+        uint64_t inputs = 0;
+        uint64_t outputs = 0;  // Not counting OP_RETURN
+        uint64_t trimmed = 0;  // Transactions given fewer outputs than drawn, for lack of slots or value
+    };
+
+    std::vector<PerShape> shapes;
+    uint64_t failures = 0;  // Draws whose coins couldn't pay for them
+
+    void Resize(size_t n) { shapes.resize(n); }
+
+    MixStats& operator+=(const MixStats& o)
+    {
+        if (shapes.size() < o.shapes.size()) shapes.resize(o.shapes.size());
+        for (size_t i = 0; i < o.shapes.size(); i++)
+        {
+            shapes[i].txs += o.shapes[i].txs;
+            shapes[i].bytes += o.shapes[i].bytes;
+            shapes[i].inputs += o.shapes[i].inputs;
+            shapes[i].outputs += o.shapes[i].outputs;
+            shapes[i].trimmed += o.shapes[i].trimmed;
+        }
+        failures += o.failures;
+        return *this;
+    }
+
+    /** Print a line per shape, each prefixed with prefix.  secs is how long the target ran, or 0 to leave out the
+        rates.  These count what was built, some of which may not have been sent by the end */
+    void Report(const std::string& prefix, const WorkloadMix& mix, double secs) const
+    {
+        for (size_t i = 0; i < shapes.size() && i < mix.shapes.size(); i++)
+        {
+            const PerShape& s = shapes[i];
+            if (s.txs == 0) continue;
+            char rates[80] = "";
+            if (secs > 0) snprintf(rates, sizeof(rates), " at %.2f tps, %.0f bytes/sec", s.txs / secs, s.bytes / secs);
+            printf("%s: shape %s: built %lu tx (%lu bytes)%s, %.1f bytes, %.1f inputs and %.1f outputs per tx, %lu trimmed\n",
+                   prefix.c_str(), mix.shapes[i].name.c_str(), s.txs, s.bytes, rates, (double)s.bytes / s.txs,
+                   (double)s.inputs / s.txs, (double)s.outputs / s.txs, s.trimmed);
+        }
+        if (failures) printf("%s: %lu drawn transactions couldn't be paid for by their coins\n", prefix.c_str(), failures);
+    }
+};
+
+#endif